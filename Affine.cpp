@@ -0,0 +1,233 @@
+#include "Affine.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AFFINE_USE_SSE
+#include <emmintrin.h>
+#endif
+
+//helper: step a pointer forward by 'bytes':
+template< typename T >
+static T const *step_bytes(T const *ptr, size_t bytes) {
+	return reinterpret_cast< T const * >(reinterpret_cast< char const * >(ptr) + bytes);
+}
+
+//---------------------------------------------------------------
+//local-to-parent matrices
+
+//scalar version (also used for the leftovers after SSE batches):
+static glm::mat4x3 local_to_parent(glm::vec3 const &p, glm::quat const &q, glm::vec3 const &s) {
+	//same result as glm::mat3_cast(q), with columns scaled:
+	float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+	float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+	float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+	return glm::mat4x3(
+		s.x * glm::vec3(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy)),
+		s.y * glm::vec3(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx)),
+		s.z * glm::vec3(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy)),
+		p
+	);
+}
+
+void Affine::make_local_to_parent(
+	uint32_t count,
+	glm::vec3 const *position, glm::quat const *rotation, glm::vec3 const *scale, size_t stride,
+	glm::mat4x3 *out) {
+
+	uint32_t i = 0;
+
+#ifdef AFFINE_USE_SSE
+	//four transforms at a time, with each lane holding one transform:
+	for (; i + 4 <= count; i += 4) {
+		glm::quat const &q0 = *step_bytes(rotation, (i+0) * stride);
+		glm::quat const &q1 = *step_bytes(rotation, (i+1) * stride);
+		glm::quat const &q2 = *step_bytes(rotation, (i+2) * stride);
+		glm::quat const &q3 = *step_bytes(rotation, (i+3) * stride);
+		glm::vec3 const &s0 = *step_bytes(scale, (i+0) * stride);
+		glm::vec3 const &s1 = *step_bytes(scale, (i+1) * stride);
+		glm::vec3 const &s2 = *step_bytes(scale, (i+2) * stride);
+		glm::vec3 const &s3 = *step_bytes(scale, (i+3) * stride);
+
+		//(n.b. _mm_set_ps takes lanes in 3,2,1,0 order)
+		__m128 x = _mm_set_ps(q3.x, q2.x, q1.x, q0.x);
+		__m128 y = _mm_set_ps(q3.y, q2.y, q1.y, q0.y);
+		__m128 z = _mm_set_ps(q3.z, q2.z, q1.z, q0.z);
+		__m128 w = _mm_set_ps(q3.w, q2.w, q1.w, q0.w);
+		__m128 sx = _mm_set_ps(s3.x, s2.x, s1.x, s0.x);
+		__m128 sy = _mm_set_ps(s3.y, s2.y, s1.y, s0.y);
+		__m128 sz = _mm_set_ps(s3.z, s2.z, s1.z, s0.z);
+
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 two = _mm_set1_ps(2.0f);
+
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+		//rows of the (column-scaled) rotation, stored as [column*3+row][lane]:
+		alignas(16) float r[9][4];
+		_mm_store_ps(r[0], _mm_mul_ps(sx, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)))));
+		_mm_store_ps(r[1], _mm_mul_ps(sx, _mm_mul_ps(two, _mm_add_ps(xy, wz))));
+		_mm_store_ps(r[2], _mm_mul_ps(sx, _mm_mul_ps(two, _mm_sub_ps(xz, wy))));
+		_mm_store_ps(r[3], _mm_mul_ps(sy, _mm_mul_ps(two, _mm_sub_ps(xy, wz))));
+		_mm_store_ps(r[4], _mm_mul_ps(sy, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)))));
+		_mm_store_ps(r[5], _mm_mul_ps(sy, _mm_mul_ps(two, _mm_add_ps(yz, wx))));
+		_mm_store_ps(r[6], _mm_mul_ps(sz, _mm_mul_ps(two, _mm_add_ps(xz, wy))));
+		_mm_store_ps(r[7], _mm_mul_ps(sz, _mm_mul_ps(two, _mm_sub_ps(yz, wx))));
+		_mm_store_ps(r[8], _mm_mul_ps(sz, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)))));
+
+		for (uint32_t l = 0; l < 4; ++l) {
+			glm::mat4x3 &m = out[i + l];
+			m[0] = glm::vec3(r[0][l], r[1][l], r[2][l]);
+			m[1] = glm::vec3(r[3][l], r[4][l], r[5][l]);
+			m[2] = glm::vec3(r[6][l], r[7][l], r[8][l]);
+			m[3] = *step_bytes(position, (i+l) * stride);
+		}
+	}
+#endif
+
+	for (; i < count; ++i) {
+		out[i] = local_to_parent(
+			*step_bytes(position, i * stride),
+			*step_bytes(rotation, i * stride),
+			*step_bytes(scale, i * stride)
+		);
+	}
+}
+
+//---------------------------------------------------------------
+//composition
+
+glm::mat4x3 Affine::compose(glm::mat4x3 const &a, glm::mat4x3 const &b) {
+#ifdef AFFINE_USE_SSE
+	//columns of a (the fourth lane of each is ignored; n.b. these loads stay inside 'a'):
+	__m128 a0 = _mm_loadu_ps(&a[0][0]);
+	__m128 a1 = _mm_loadu_ps(&a[1][0]);
+	__m128 a2 = _mm_loadu_ps(&a[2][0]);
+	__m128 a3 = _mm_set_ps(0.0f, a[3].z, a[3].y, a[3].x);
+
+	alignas(16) float c[4][4];
+	for (uint32_t col = 0; col < 4; ++col) {
+		__m128 r = _mm_add_ps(
+			_mm_add_ps(
+				_mm_mul_ps(a0, _mm_set1_ps(b[col].x)),
+				_mm_mul_ps(a1, _mm_set1_ps(b[col].y))
+			),
+			_mm_mul_ps(a2, _mm_set1_ps(b[col].z))
+		);
+		if (col == 3) r = _mm_add_ps(r, a3);
+		_mm_store_ps(c[col], r);
+	}
+	return glm::mat4x3(
+		glm::vec3(c[0][0], c[0][1], c[0][2]),
+		glm::vec3(c[1][0], c[1][1], c[1][2]),
+		glm::vec3(c[2][0], c[2][1], c[2][2]),
+		glm::vec3(c[3][0], c[3][1], c[3][2])
+	);
+#else
+	glm::mat3 a3x3 = glm::mat3(a);
+	return glm::mat4x3(
+		a3x3 * b[0],
+		a3x3 * b[1],
+		a3x3 * b[2],
+		a3x3 * b[3] + a[3]
+	);
+#endif
+}
+
+glm::mat4 Affine::compose(glm::mat4 const &a, glm::mat4x3 const &b) {
+	glm::mat4 ret;
+#ifdef AFFINE_USE_SSE
+	__m128 a0 = _mm_loadu_ps(&a[0][0]);
+	__m128 a1 = _mm_loadu_ps(&a[1][0]);
+	__m128 a2 = _mm_loadu_ps(&a[2][0]);
+	__m128 a3 = _mm_loadu_ps(&a[3][0]);
+	for (uint32_t col = 0; col < 4; ++col) {
+		__m128 r = _mm_add_ps(
+			_mm_add_ps(
+				_mm_mul_ps(a0, _mm_set1_ps(b[col].x)),
+				_mm_mul_ps(a1, _mm_set1_ps(b[col].y))
+			),
+			_mm_mul_ps(a2, _mm_set1_ps(b[col].z))
+		);
+		if (col == 3) r = _mm_add_ps(r, a3);
+		_mm_storeu_ps(&ret[col][0], r);
+	}
+#else
+	for (uint32_t col = 0; col < 4; ++col) {
+		ret[col] = a[0] * b[col].x + a[1] * b[col].y + a[2] * b[col].z;
+	}
+	ret[3] += a[3];
+#endif
+	return ret;
+}
+
+//---------------------------------------------------------------
+//normal matrices
+
+//inverse(transpose(M)) for M = [a b c] is [b x c, c x a, a x b] / det(M):
+glm::mat3 Affine::normal_matrix(glm::mat4x3 const &m) {
+	glm::vec3 bc = glm::cross(m[1], m[2]);
+	glm::vec3 ca = glm::cross(m[2], m[0]);
+	glm::vec3 ab = glm::cross(m[0], m[1]);
+	float det = glm::dot(m[0], bc);
+	float inv_det = (det == 0.0f ? 0.0f : 1.0f / det);
+	return glm::mat3(bc * inv_det, ca * inv_det, ab * inv_det);
+}
+
+void Affine::make_normal_matrices(uint32_t count, glm::mat4x3 const *in, glm::mat3 *out) {
+	uint32_t i = 0;
+
+#ifdef AFFINE_USE_SSE
+	for (; i + 4 <= count; i += 4) {
+		glm::mat4x3 const &m0 = in[i+0];
+		glm::mat4x3 const &m1 = in[i+1];
+		glm::mat4x3 const &m2 = in[i+2];
+		glm::mat4x3 const &m3 = in[i+3];
+		#define LANES( C, R ) _mm_set_ps(m3[C][R], m2[C][R], m1[C][R], m0[C][R])
+		__m128 ax = LANES(0,0), ay = LANES(0,1), az = LANES(0,2);
+		__m128 bx = LANES(1,0), by = LANES(1,1), bz = LANES(1,2);
+		__m128 cx = LANES(2,0), cy = LANES(2,1), cz = LANES(2,2);
+		#undef LANES
+
+		//cross products (lane-wise):
+		#define CROSS( U, V, OUT ) \
+			__m128 OUT ## x = _mm_sub_ps(_mm_mul_ps(U ## y, V ## z), _mm_mul_ps(U ## z, V ## y)); \
+			__m128 OUT ## y = _mm_sub_ps(_mm_mul_ps(U ## z, V ## x), _mm_mul_ps(U ## x, V ## z)); \
+			__m128 OUT ## z = _mm_sub_ps(_mm_mul_ps(U ## x, V ## y), _mm_mul_ps(U ## y, V ## x));
+		CROSS(b, c, bc)
+		CROSS(c, a, ca)
+		CROSS(a, b, ab)
+		#undef CROSS
+
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bcx), _mm_mul_ps(ay, bcy)), _mm_mul_ps(az, bcz));
+		//1/det, but zero where det is zero:
+		__m128 inv_det = _mm_and_ps(
+			_mm_div_ps(_mm_set1_ps(1.0f), det),
+			_mm_cmpneq_ps(det, _mm_setzero_ps())
+		);
+
+		alignas(16) float r[9][4];
+		_mm_store_ps(r[0], _mm_mul_ps(bcx, inv_det));
+		_mm_store_ps(r[1], _mm_mul_ps(bcy, inv_det));
+		_mm_store_ps(r[2], _mm_mul_ps(bcz, inv_det));
+		_mm_store_ps(r[3], _mm_mul_ps(cax, inv_det));
+		_mm_store_ps(r[4], _mm_mul_ps(cay, inv_det));
+		_mm_store_ps(r[5], _mm_mul_ps(caz, inv_det));
+		_mm_store_ps(r[6], _mm_mul_ps(abx, inv_det));
+		_mm_store_ps(r[7], _mm_mul_ps(aby, inv_det));
+		_mm_store_ps(r[8], _mm_mul_ps(abz, inv_det));
+
+		for (uint32_t l = 0; l < 4; ++l) {
+			out[i + l] = glm::mat3(
+				r[0][l], r[1][l], r[2][l],
+				r[3][l], r[4][l], r[5][l],
+				r[6][l], r[7][l], r[8][l]
+			);
+		}
+	}
+#endif
+
+	for (; i < count; ++i) {
+		out[i] = normal_matrix(in[i]);
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+/*
+ * Kernels for affine transformations stored as glm::mat4x3
+ *  (i.e., 4x4 matrices whose bottom row is implicitly [0 0 0 1]).
+ *
+ * These avoid widening to glm::mat4 just to multiply, and use SSE where
+ *  available (falling back to plain scalar code elsewhere).
+ *
+ */
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Affine {
+
+//local-to-parent matrices (translate * rotate * scale) for 'count' transforms.
+// the i'th position/rotation/scale are found 'stride' bytes after the (i-1)'th,
+// which allows reading directly out of arrays of structures (like Scene::Transform):
+void make_local_to_parent(
+	uint32_t count,
+	glm::vec3 const *position, glm::quat const *rotation, glm::vec3 const *scale, size_t stride,
+	glm::mat4x3 *out
+);
+
+//a * b, treating both as affine:
+glm::mat4x3 compose(glm::mat4x3 const &a, glm::mat4x3 const &b);
+
+//a * b, treating only b as affine (e.g., world_to_clip * object_to_world):
+glm::mat4 compose(glm::mat4 const &a, glm::mat4x3 const &b);
+
+//matrix that transforms normals, i.e., inverse(transpose(upper 3x3 of m)):
+// (degenerate matrices produce a zero matrix rather than NaNs)
+glm::mat3 normal_matrix(glm::mat4x3 const &m);
+
+//normal_matrix() for 'count' matrices at once:
+void make_normal_matrices(uint32_t count, glm::mat4x3 const *in, glm::mat3 *out);
+
+}
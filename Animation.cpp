@@ -0,0 +1,199 @@
+#include "Animation.hpp"
+
+#include "read_write_chunk.hpp"
+#include "parallel_for.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ANIMATION_USE_SSE
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+Animation::Animation(std::string const &filename) {
+	std::ifstream file(filename, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Failed to open animation '" + filename + "'");
+	}
+
+	struct Header {
+		float frames_per_second;
+		uint32_t frames;
+	};
+	static_assert(sizeof(Header) == 4 + 4, "Header is packed.");
+
+	struct TrackEntry {
+		uint32_t name_begin, name_end;
+		uint32_t key_begin, key_count;
+		float offset[Channels];
+		float step[Channels];
+	};
+	static_assert(sizeof(TrackEntry) == 4 * 4 + 4 * Channels * 2, "TrackEntry is packed.");
+
+	std::vector< Header > header;
+	std::vector< char > strings;
+	std::vector< TrackEntry > entries;
+	std::vector< uint16_t > frames;
+	std::vector< uint16_t > packed;
+	read_chunk(file, "anm0", &header);
+	read_chunk(file, "str0", &strings);
+	read_chunk(file, "trk0", &entries);
+	read_chunk(file, "key0", &frames);
+	read_chunk(file, "val0", &packed);
+
+	if (header.size() != 1) {
+		throw std::runtime_error("Animation '" + filename + "' should have exactly one header.");
+	}
+	if (!(header[0].frames_per_second > 0.0f)) {
+		throw std::runtime_error("Animation '" + filename + "' has a non-positive frame rate.");
+	}
+	if (packed.size() != frames.size() * Channels) {
+		throw std::runtime_error("Animation '" + filename + "' has " + std::to_string(frames.size()) + " keys but " + std::to_string(packed.size()) + " values.");
+	}
+	frames_per_second = header[0].frames_per_second;
+	duration = std::max(0, int32_t(header[0].frames) - 1) / frames_per_second;
+
+	times.reserve(frames.size());
+	for (uint16_t frame : frames) {
+		times.emplace_back(frame / frames_per_second);
+	}
+
+	//pad keys out to Stride values:
+	values.assign(frames.size() * Stride, 0);
+	for (size_t k = 0; k < frames.size(); ++k) {
+		std::copy(packed.begin() + k * Channels, packed.begin() + (k + 1) * Channels, values.begin() + k * Stride);
+	}
+
+	tracks.reserve(entries.size());
+	for (TrackEntry const &entry : entries) {
+		if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
+			throw std::runtime_error("Animation '" + filename + "' has a track with an out-of-range name.");
+		}
+		if (entry.key_count == 0 || entry.key_begin > frames.size() || entry.key_count > frames.size() - entry.key_begin) {
+			throw std::runtime_error("Animation '" + filename + "' has a track with out-of-range keys.");
+		}
+		for (uint32_t k = entry.key_begin + 1; k < entry.key_begin + entry.key_count; ++k) {
+			if (!(frames[k-1] < frames[k])) {
+				throw std::runtime_error("Animation '" + filename + "' has a track with out-of-order keys.");
+			}
+		}
+
+		tracks.emplace_back();
+		Track &track = tracks.back();
+		track.path = std::string(strings.begin() + entry.name_begin, strings.begin() + entry.name_end);
+		track.key_begin = entry.key_begin;
+		track.key_count = entry.key_count;
+		std::copy(entry.offset, entry.offset + Channels, track.offset);
+		std::copy(entry.step, entry.step + Channels, track.step);
+	}
+
+	if (file.peek() != EOF) {
+		std::cerr << "WARNING: trailing data in animation '" << filename << "'" << std::endl;
+	}
+}
+
+void Animation::sample(uint32_t index, float time, uint32_t *cursor_, Scene::Transform *transform) const {
+	assert(index < tracks.size());
+	assert(cursor_);
+	assert(transform);
+	Track const &track = tracks[index];
+	uint32_t &cursor = *cursor_;
+	float const *track_times = times.data() + track.key_begin;
+	uint32_t count = track.key_count;
+
+	//find the last key at or before time (stepping from the cursor when playing forward, searching otherwise):
+	if (cursor >= count || track_times[cursor] > time || (cursor + 2 < count && track_times[cursor + 2] <= time)) {
+		cursor = uint32_t(std::upper_bound(track_times, track_times + count, time) - track_times);
+		if (cursor > 0) cursor -= 1;
+	} else if (cursor + 1 < count && track_times[cursor + 1] <= time) {
+		cursor += 1;
+	}
+	uint32_t next = std::min(cursor + 1, count - 1);
+	float u = 0.0f;
+	if (next != cursor) {
+		u = (time - track_times[cursor]) / (track_times[next] - track_times[cursor]);
+		u = std::max(0.0f, std::min(1.0f, u));
+	}
+
+	uint16_t const *a = values.data() + size_t(track.key_begin + cursor) * Stride;
+	uint16_t const *b = values.data() + size_t(track.key_begin + next) * Stride;
+	float out[Stride];
+
+#ifdef ANIMATION_USE_SSE
+	//interpolate in fixed point, then scale into each channel's range; four channels at a time:
+	__m128i zero = _mm_setzero_si128();
+	__m128 vu = _mm_set1_ps(u);
+	auto lerp = [&](__m128i qa, __m128i qb, uint32_t c) {
+		__m128 fa = _mm_cvtepi32_ps(qa);
+		__m128 fb = _mm_cvtepi32_ps(qb);
+		__m128 q = _mm_add_ps(fa, _mm_mul_ps(vu, _mm_sub_ps(fb, fa)));
+		_mm_storeu_ps(out + c, _mm_add_ps(_mm_loadu_ps(track.offset + c), _mm_mul_ps(_mm_loadu_ps(track.step + c), q)));
+	};
+	__m128i a0 = _mm_loadu_si128(reinterpret_cast< __m128i const * >(a));
+	__m128i b0 = _mm_loadu_si128(reinterpret_cast< __m128i const * >(b));
+	__m128i a8 = _mm_loadl_epi64(reinterpret_cast< __m128i const * >(a + 8));
+	__m128i b8 = _mm_loadl_epi64(reinterpret_cast< __m128i const * >(b + 8));
+	lerp(_mm_unpacklo_epi16(a0, zero), _mm_unpacklo_epi16(b0, zero), 0);
+	lerp(_mm_unpackhi_epi16(a0, zero), _mm_unpackhi_epi16(b0, zero), 4);
+	lerp(_mm_unpacklo_epi16(a8, zero), _mm_unpacklo_epi16(b8, zero), 8);
+#else
+	for (uint32_t c = 0; c < Channels; ++c) {
+		float q = float(a[c]) + u * (float(b[c]) - float(a[c]));
+		out[c] = track.offset[c] + track.step[c] * q;
+	}
+#endif
+
+	//channels are position xyz, rotation xyzw, scale xyz:
+	transform->position = glm::vec3(out[0], out[1], out[2]);
+	float length2 = out[3] * out[3] + out[4] * out[4] + out[5] * out[5] + out[6] * out[6];
+	if (length2 > 0.0f) {
+		float inv = 1.0f / std::sqrt(length2);
+		transform->rotation = glm::quat(out[6] * inv, out[3] * inv, out[4] * inv, out[5] * inv);
+	} else {
+		transform->rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+	}
+	transform->scale = glm::vec3(out[7], out[8], out[9]);
+}
+
+Animation::Player::Player(Animation const &animation_, Scene &scene) : animation(animation_) {
+	targets.reserve(animation.tracks.size());
+	for (Track const &track : animation.tracks) {
+		Scene::Transform *transform = scene.find(track.path);
+		if (!transform) {
+			std::cerr << "WARNING: animation track '" << track.path << "' doesn't match any transform." << std::endl;
+		}
+		targets.emplace_back(transform);
+	}
+	cursors.assign(targets.size(), 0);
+}
+
+void Animation::Player::update(float elapsed) {
+	time += speed * elapsed;
+	if (loop && animation.duration > 0.0f) {
+		time = std::fmod(time, animation.duration);
+		if (time < 0.0f) time += animation.duration;
+	} else {
+		time = std::max(0.0f, std::min(animation.duration, time));
+	}
+	apply();
+}
+
+void Animation::Player::apply() {
+	auto before = std::chrono::high_resolution_clock::now();
+
+	uint32_t count = uint32_t(targets.size());
+	parallel_for(count, 256, [this](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i) {
+			if (targets[i]) animation.sample(i, time, &cursors[i], targets[i]);
+		}
+	});
+
+	stats.transforms = uint32_t(count - std::count(targets.begin(), targets.end(), nullptr));
+	stats.sample_ms = std::chrono::duration< float, std::milli >(std::chrono::high_resolution_clock::now() - before).count();
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+/*
+ * Animation holds a keyframed clip (as exported by scenes/export-animation.py) that
+ *  moves Scene::Transforms by setting their position, rotation, and scale.
+ *
+ * Each track animates one transform, named by its path from the root (e.g., "Body/Leg.1").
+ *  A track's keyframes set all ten channels (position xyz, rotation xyzw, scale xyz) at once,
+ *  with each channel stored as 16-bit fixed point within the track's range for that channel.
+ *  The exporter only keeps the frames that linear interpolation can't reproduce, so
+ *  tracks that hold still or move steadily have very few keys.
+ *
+ * Since every channel shares its track's key times, sampling a track is one interpolation
+ *  of all ten channels together (three SSE vectors), and tracks are sampled in parallel.
+ *
+ * Usage:
+ *  Animation animation("hexapod.anim");
+ *  Animation::Player player(animation, scene); //binds tracks to the scene's transforms
+ *  player.update(elapsed); //advance time and set transforms
+ *
+ */
+
+#include "Scene.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Animation {
+	//load from a '.anim' file (throws on error):
+	Animation(std::string const &filename);
+
+	float frames_per_second = 24.0f;
+	float duration = 0.0f; //in seconds
+
+	enum : uint32_t { Channels = 10, Stride = 12 }; //(keys are padded to a multiple of four channels)
+
+	struct Track {
+		std::string path; //transform that the track animates
+		uint32_t key_begin = 0, key_count = 0; //range of keys (in times) used by the track
+		//channel c of key k is: offset[c] + step[c] * values[k * Stride + c]
+		float offset[Stride] = {0.0f};
+		float step[Stride] = {0.0f};
+	};
+	std::vector< Track > tracks;
+
+	std::vector< float > times; //key times (seconds), increasing within each track
+	std::vector< uint16_t > values; //Stride values per key
+
+	//write the value of 'track' at 'time' (clamped to the track's keys) to transform:
+	// 'cursor' is the key that the previous call for this track ended up at, and is updated
+	// (so that playing forward doesn't need to search for keys)
+	void sample(uint32_t track, float time, uint32_t *cursor, Scene::Transform *transform) const;
+
+	struct Player {
+		//bind each track to the transform at its path in 'scene' (tracks without a transform are skipped):
+		Player(Animation const &animation, Scene &scene);
+
+		Animation const &animation;
+		std::vector< Scene::Transform * > targets; //per track (nullptr if not found)
+		std::vector< uint32_t > cursors; //per track
+
+		float time = 0.0f;
+		bool loop = true;
+		float speed = 1.0f;
+
+		//advance time (wrapping or clamping at the end) and apply:
+		void update(float elapsed);
+
+		//set every bound transform to its value at 'time':
+		void apply();
+
+		//Measurements (from the most recent apply):
+		struct {
+			uint32_t transforms = 0; //animated transforms set
+			float sample_ms = 0.0f; //time spent sampling
+		} stats;
+	};
+};
@@ -0,0 +1,183 @@
+#include "BVH.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+//surface area (well, half of it) of a box, treating empty boxes as zero:
+static float half_area(glm::vec3 const &min, glm::vec3 const &max) {
+	glm::vec3 size = glm::max(max - min, glm::vec3(0.0f));
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+void BVH::build(uint32_t count, glm::vec3 const *mins, glm::vec3 const *maxs) {
+	nodes.clear();
+	items.resize(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		items[i] = i;
+	}
+	if (count == 0) return;
+	nodes.reserve(2 * count);
+
+	//splits are decided by box centers:
+	std::vector< glm::vec3 > centers(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		//(empty boxes get a finite center so that they don't poison the bins)
+		centers[i] = (mins[i].x <= maxs[i].x ? 0.5f * (mins[i] + maxs[i]) : glm::vec3(0.0f));
+	}
+
+	constexpr uint32_t Bins = 12;
+	constexpr uint32_t MaxLeaf = 8; //leaves may hold up to this many items if splitting doesn't help
+	constexpr uint32_t MaxSAHDepth = 48; //past this depth, split at the median (keeps raycast()'s stack bounded)
+
+	struct Task {
+		uint32_t node;
+		uint32_t begin, end; //range of items
+		uint32_t depth;
+	};
+	std::vector< Task > tasks;
+	nodes.emplace_back();
+	tasks.emplace_back(Task{0, 0, count, 0});
+
+	while (!tasks.empty()) {
+		Task task = tasks.back();
+		tasks.pop_back();
+
+		//bounds of the items and their centers:
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		glm::vec3 center_min = min;
+		glm::vec3 center_max = max;
+		for (uint32_t i = task.begin; i < task.end; ++i) {
+			min = glm::min(min, mins[items[i]]);
+			max = glm::max(max, maxs[items[i]]);
+			center_min = glm::min(center_min, centers[items[i]]);
+			center_max = glm::max(center_max, centers[items[i]]);
+		}
+		nodes[task.node].min = min;
+		nodes[task.node].max = max;
+
+		uint32_t n = task.end - task.begin;
+		auto make_leaf = [&]() {
+			nodes[task.node].first = task.begin;
+			nodes[task.node].count = n;
+		};
+		if (n <= 2) {
+			make_leaf();
+			continue;
+		}
+
+		//split along the axis with the most spread of centers:
+		glm::vec3 extent = center_max - center_min;
+		uint32_t axis = (extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2));
+		if (!(extent[axis] > 0.0f)) {
+			//all centers coincide; nothing to split on:
+			if (n <= MaxLeaf) {
+				make_leaf();
+				continue;
+			}
+		}
+
+		uint32_t middle = task.begin;
+		if (extent[axis] > 0.0f && task.depth < MaxSAHDepth) {
+			//bin items by center:
+			struct Bin {
+				glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+				glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+				uint32_t count = 0;
+			} bins[Bins];
+			float scale = float(Bins) / extent[axis];
+			auto bin_of = [&](uint32_t item) {
+				return std::min(Bins - 1, uint32_t((centers[item][axis] - center_min[axis]) * scale));
+			};
+			for (uint32_t i = task.begin; i < task.end; ++i) {
+				Bin &bin = bins[bin_of(items[i])];
+				bin.min = glm::min(bin.min, mins[items[i]]);
+				bin.max = glm::max(bin.max, maxs[items[i]]);
+				bin.count += 1;
+			}
+
+			//sweep from the right to get areas of the right sides:
+			float right_cost[Bins];
+			{
+				Bin acc;
+				for (uint32_t b = Bins - 1; b > 0; --b) {
+					acc.min = glm::min(acc.min, bins[b].min);
+					acc.max = glm::max(acc.max, bins[b].max);
+					acc.count += bins[b].count;
+					right_cost[b] = half_area(acc.min, acc.max) * acc.count;
+				}
+			}
+			//..then from the left, picking the cheapest split:
+			float best_cost = std::numeric_limits< float >::infinity();
+			uint32_t best_split = 0; //items in bins < best_split go left
+			{
+				Bin acc;
+				for (uint32_t b = 1; b < Bins; ++b) {
+					acc.min = glm::min(acc.min, bins[b-1].min);
+					acc.max = glm::max(acc.max, bins[b-1].max);
+					acc.count += bins[b-1].count;
+					if (acc.count == 0 || acc.count == n) continue;
+					float cost = half_area(acc.min, acc.max) * acc.count + right_cost[b];
+					if (cost < best_cost) {
+						best_cost = cost;
+						best_split = b;
+					}
+				}
+			}
+
+			//splitting costs a traversal step (counted as one box-intersection) plus the children:
+			float leaf_cost = half_area(min, max) * n;
+			float split_cost = half_area(min, max) + best_cost;
+			if (best_split == 0 || (n <= MaxLeaf && split_cost >= leaf_cost)) {
+				if (n <= MaxLeaf) {
+					make_leaf();
+					continue;
+				}
+			} else {
+				middle = uint32_t(std::partition(items.begin() + task.begin, items.begin() + task.end, [&](uint32_t item) {
+					return bin_of(item) < best_split;
+				}) - items.begin());
+			}
+		}
+
+		if (middle == task.begin || middle == task.end) {
+			//fall back to a median split:
+			middle = task.begin + n / 2;
+			std::nth_element(items.begin() + task.begin, items.begin() + middle, items.begin() + task.end, [&](uint32_t a, uint32_t b) {
+				return centers[a][axis] < centers[b][axis];
+			});
+		}
+
+		uint32_t left = uint32_t(nodes.size());
+		nodes.emplace_back();
+		nodes.emplace_back();
+		nodes[task.node].first = left;
+		nodes[task.node].count = 0;
+		tasks.emplace_back(Task{left + 1, middle, task.end, task.depth + 1});
+		tasks.emplace_back(Task{left, task.begin, middle, task.depth + 1});
+	}
+}
+
+void BVH::refit(glm::vec3 const *mins, glm::vec3 const *maxs) {
+	//children are always after their parents, so a reverse pass sees children first:
+	for (uint32_t n = uint32_t(nodes.size()); n > 0; --n) {
+		Node &node = nodes[n-1];
+		if (node.count != 0) {
+			node.min = glm::vec3( std::numeric_limits< float >::infinity());
+			node.max = glm::vec3(-std::numeric_limits< float >::infinity());
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				node.min = glm::min(node.min, mins[items[i]]);
+				node.max = glm::max(node.max, maxs[items[i]]);
+			}
+		} else {
+			node.min = glm::min(nodes[node.first].min, nodes[node.first + 1].min);
+			node.max = glm::max(nodes[node.first].max, nodes[node.first + 1].max);
+		}
+	}
+}
+
+float BVH::root_area() const {
+	if (nodes.empty()) return 0.0f;
+	return half_area(nodes[0].min, nodes[0].max);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+/*
+ * A BVH is a bounding volume hierarchy over a set of axis-aligned boxes
+ *  (e.g., the triangles of a mesh, or the drawables of a scene), used to
+ *  find the boxes that a ray passes through without testing all of them.
+ *
+ * It is built top-down using binned surface area heuristic (SAH) splits,
+ *  and can be refit (cheaply) when its boxes move a bit.
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+struct BVH {
+	//nodes are stored in one array, with both children of an interior node next to each other
+	// (and after their parent):
+	struct Node {
+		glm::vec3 min;
+		uint32_t first; //leaf: first entry in 'items'; interior: index of left child (right child is first+1)
+		glm::vec3 max;
+		uint32_t count; //leaf: number of items (always > 0); interior: 0
+	};
+	static_assert(sizeof(Node) == 32, "BVH::Node is packed.");
+	std::vector< Node > nodes; //nodes[0] is the root (empty if there are no items)
+	std::vector< uint32_t > items; //item indices, in leaf order
+
+	//build over 'count' boxes (boxes may be empty -- min > max -- in which case they are never hit):
+	void build(uint32_t count, glm::vec3 const *mins, glm::vec3 const *maxs);
+
+	//update node bounds for moved boxes (same count as build(); tree structure stays the same):
+	void refit(glm::vec3 const *mins, glm::vec3 const *maxs);
+
+	//surface area of the root's box (useful to notice when refits have made the tree loose):
+	float root_area() const;
+
+	//call test(item, &max_t) for items whose boxes the ray origin + t * direction (0 <= t <= max_t) passes through,
+	// roughly nearest-first; test() should reduce max_t when it finds a hit, which prunes the rest of the search:
+	template< typename Test >
+	void raycast(glm::vec3 const &origin, glm::vec3 const &direction, float *max_t, Test const &test) const;
+
+	//ray vs. box test, returning the distance at which the ray enters the box in *t_enter:
+	static bool hit_box(glm::vec3 const &min, glm::vec3 const &max, glm::vec3 const &origin, glm::vec3 const &inv_direction, float max_t, float *t_enter) {
+		glm::vec3 t0 = (min - origin) * inv_direction;
+		glm::vec3 t1 = (max - origin) * inv_direction;
+		glm::vec3 t_near = glm::min(t0, t1);
+		glm::vec3 t_far = glm::max(t0, t1);
+		float enter = glm::max(glm::max(t_near.x, t_near.y), glm::max(t_near.z, 0.0f));
+		float exit = glm::min(glm::min(t_far.x, t_far.y), glm::min(t_far.z, max_t));
+		*t_enter = enter;
+		return enter <= exit && min.x <= max.x; //(empty boxes are never hit)
+	}
+};
+
+template< typename Test >
+void BVH::raycast(glm::vec3 const &origin, glm::vec3 const &direction, float *max_t, Test const &test) const {
+	if (nodes.empty()) return;
+	glm::vec3 inv_direction = 1.0f / direction;
+
+	//build() limits depth, so a small fixed stack is enough:
+	struct Entry {
+		uint32_t node;
+		float t_enter;
+	};
+	Entry stack[128];
+	uint32_t top = 0;
+
+	float t_root;
+	if (!hit_box(nodes[0].min, nodes[0].max, origin, inv_direction, *max_t, &t_root)) return;
+	stack[top++] = Entry{0, t_root};
+
+	while (top > 0) {
+		Entry entry = stack[--top];
+		if (entry.t_enter > *max_t) continue; //(a closer hit was found since this was pushed)
+		Node const &node = nodes[entry.node];
+		if (node.count != 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				test(items[i], max_t);
+			}
+			continue;
+		}
+		Node const &a = nodes[node.first];
+		Node const &b = nodes[node.first + 1];
+		float t_a, t_b;
+		bool hit_a = hit_box(a.min, a.max, origin, inv_direction, *max_t, &t_a);
+		bool hit_b = hit_box(b.min, b.max, origin, inv_direction, *max_t, &t_b);
+		//push the farther child first, so the nearer one is visited first:
+		if (hit_a && hit_b) {
+			if (t_a <= t_b) {
+				stack[top++] = Entry{node.first + 1, t_b};
+				stack[top++] = Entry{node.first, t_a};
+			} else {
+				stack[top++] = Entry{node.first, t_a};
+				stack[top++] = Entry{node.first + 1, t_b};
+			}
+		} else if (hit_a) {
+			stack[top++] = Entry{node.first, t_a};
+		} else if (hit_b) {
+			stack[top++] = Entry{node.first + 1, t_b};
+		}
+	}
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+/*
+ * A ChunkedArray< T > stores its elements in fixed-size contiguous chunks.
+ *
+ * Like std::list, elements never move once they have been added, so pointers
+ *  to them stay valid (Scene relies on this for Transform::parent and friends).
+ * Like std::vector, neighboring elements are adjacent in memory, so a
+ *  range-for over the array is a linear scan rather than a pointer chase.
+ *
+ * Elements can only be added at the end; there is no erase().
+ *
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+template< typename T, uint32_t ChunkSize = 64 >
+struct ChunkedArray {
+	static_assert((ChunkSize & (ChunkSize - 1)) == 0, "ChunkSize should be a power of two.");
+
+	ChunkedArray() = default;
+	ChunkedArray(ChunkedArray const &other) { *this = other; }
+	ChunkedArray(ChunkedArray &&other) { *this = std::move(other); }
+	ChunkedArray &operator=(ChunkedArray const &other) {
+		if (this == &other) return *this;
+		clear();
+		for (T const &t : other) {
+			emplace_back(t);
+		}
+		return *this;
+	}
+	ChunkedArray &operator=(ChunkedArray &&other) {
+		if (this == &other) return *this;
+		clear();
+		chunks = std::move(other.chunks);
+		by_address = std::move(other.by_address);
+		count = other.count;
+		other.chunks.clear();
+		other.by_address.clear();
+		other.count = 0;
+		return *this;
+	}
+	~ChunkedArray() { clear(); }
+
+	//---- size ----
+	uint32_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	//---- element access ----
+	T &operator[](uint32_t index) {
+		assert(index < count);
+		return chunks[index / ChunkSize]->data()[index % ChunkSize];
+	}
+	T const &operator[](uint32_t index) const {
+		assert(index < count);
+		return chunks[index / ChunkSize]->data()[index % ChunkSize];
+	}
+	T &front() { return (*this)[0]; }
+	T const &front() const { return (*this)[0]; }
+	T &back() { return (*this)[count - 1]; }
+	T const &back() const { return (*this)[count - 1]; }
+
+	//number of elements stored contiguously starting at 'index' (i.e., before the next chunk begins):
+	uint32_t run_length(uint32_t index) const {
+		assert(index < count);
+		return std::min(count - index, ChunkSize - index % ChunkSize);
+	}
+
+	//index of the element stored at 'ptr', or size() if 'ptr' isn't an element of this array:
+	// (binary search over chunk addresses, so O(log(size() / ChunkSize)))
+	uint32_t index_of(T const *ptr) const {
+		uintptr_t addr = reinterpret_cast< uintptr_t >(ptr);
+		auto after = std::upper_bound(by_address.begin(), by_address.end(), addr, [](uintptr_t a, ChunkAddress const &c){
+			return a < c.base;
+		});
+		if (after == by_address.begin()) return count;
+		--after;
+		uintptr_t offset = addr - after->base;
+		if (offset >= sizeof(T) * ChunkSize || offset % sizeof(T) != 0) return count;
+		uint32_t index = after->chunk * ChunkSize + uint32_t(offset / sizeof(T));
+		return (index < count ? index : count);
+	}
+
+	//---- modification ----
+	template< typename... Args >
+	T &emplace_back(Args&&... args) {
+		if (count == uint32_t(chunks.size()) * ChunkSize) {
+			chunks.emplace_back(std::make_unique< Chunk >());
+			ChunkAddress address;
+			address.base = reinterpret_cast< uintptr_t >(chunks.back()->data());
+			address.chunk = uint32_t(chunks.size() - 1);
+			by_address.insert(std::upper_bound(by_address.begin(), by_address.end(), address), address);
+		}
+		T *slot = chunks[count / ChunkSize]->data() + (count % ChunkSize);
+		new (slot) T(std::forward< Args >(args)...);
+		count += 1;
+		return *slot;
+	}
+
+	void clear() {
+		while (count > 0) {
+			count -= 1;
+			chunks[count / ChunkSize]->data()[count % ChunkSize].~T();
+		}
+		chunks.clear();
+		by_address.clear();
+	}
+
+	//---- iteration ----
+	template< typename V, typename A >
+	struct Iterator {
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = V *;
+		using reference = V &;
+
+		Iterator(A *array_, uint32_t index_) : array(array_), index(index_) { }
+		V &operator*() const { return (*array)[index]; }
+		V *operator->() const { return &(*array)[index]; }
+		Iterator &operator++() { ++index; return *this; }
+		Iterator operator++(int) { Iterator ret = *this; ++index; return ret; }
+		bool operator==(Iterator const &o) const { return index == o.index && array == o.array; }
+		bool operator!=(Iterator const &o) const { return !(*this == o); }
+
+		A *array;
+		uint32_t index;
+	};
+	using iterator = Iterator< T, ChunkedArray >;
+	using const_iterator = Iterator< T const, ChunkedArray const >;
+
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, count); }
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, count); }
+
+	//---- internals ----
+	struct Chunk {
+		alignas(T) unsigned char storage[sizeof(T) * ChunkSize];
+		T *data() { return reinterpret_cast< T * >(storage); }
+	};
+	std::vector< std::unique_ptr< Chunk > > chunks;
+
+	//chunks sorted by address, used by index_of():
+	struct ChunkAddress {
+		uintptr_t base = 0;
+		uint32_t chunk = 0;
+		bool operator<(ChunkAddress const &o) const { return base < o.base; }
+	};
+	std::vector< ChunkAddress > by_address;
+
+	uint32_t count = 0;
+};
@@ -0,0 +1,129 @@
+#include "DynamicResolution.hpp"
+
+#include "gl_errors.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+DynamicResolution::DynamicResolution() {
+	//timer queries are part of OpenGL 3.3, but may still count with zero bits (i.e., not at all):
+	GLint bits = 0;
+	glGetQueryiv(GL_TIME_ELAPSED, GL_QUERY_COUNTER_BITS, &bits);
+	if (bits > 0) {
+		glGenQueries(QueryCount, queries);
+		gpu_timing = true;
+	}
+	GL_ERRORS();
+}
+
+DynamicResolution::~DynamicResolution() {
+	if (gpu_timing) glDeleteQueries(QueryCount, queries);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteRenderbuffers(1, &color_renderbuffer);
+	glDeleteRenderbuffers(1, &depth_renderbuffer);
+}
+
+void DynamicResolution::allocate(glm::uvec2 const &size) {
+	if (framebuffer == 0) {
+		glGenFramebuffers(1, &framebuffer);
+		glGenRenderbuffers(1, &color_renderbuffer);
+		glGenRenderbuffers(1, &depth_renderbuffer);
+	}
+
+	glBindRenderbuffer(GL_RENDERBUFFER, color_renderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, size.x, size.y);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, size.x, size.y);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_renderbuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth_renderbuffer);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		throw std::runtime_error("DynamicResolution framebuffer is incomplete.");
+	}
+
+	allocated_size = size;
+	GL_ERRORS();
+}
+
+glm::uvec2 DynamicResolution::begin(glm::uvec2 const &drawable_size_) {
+	drawable_size = glm::max(drawable_size_, glm::uvec2(1));
+
+	//time this frame (reading the result of the query issued QueryCount - 1 frames ago, if it is ready):
+	if (gpu_timing) {
+		GLuint query = queries[next_query];
+		if (query_pending[next_query]) {
+			GLuint available = 0;
+			glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available) {
+				GLuint64 ns = 0;
+				glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+				add_frame_time(float(double(ns) * 1e-6));
+			}
+			query_pending[next_query] = false;
+		}
+		glBeginQuery(GL_TIME_ELAPSED, query);
+	}
+
+	if (disabled) {
+		render_size = drawable_size;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	} else {
+		if (allocated_size != drawable_size) allocate(drawable_size);
+		render_size = glm::clamp(glm::uvec2(glm::round(glm::vec2(drawable_size) * scale)), glm::uvec2(1), drawable_size);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	}
+	glViewport(0, 0, render_size.x, render_size.y);
+
+	return render_size;
+}
+
+void DynamicResolution::end() {
+	if (!disabled) {
+		//stretch the lower-left corner of the framebuffer over the whole window:
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(
+			0, 0, render_size.x, render_size.y,
+			0, 0, drawable_size.x, drawable_size.y,
+			GL_COLOR_BUFFER_BIT,
+			(render_size == drawable_size ? GL_NEAREST : GL_LINEAR)
+		);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, drawable_size.x, drawable_size.y);
+	}
+
+	if (gpu_timing) {
+		glEndQuery(GL_TIME_ELAPSED);
+		query_pending[next_query] = true;
+		next_query = (next_query + 1) % QueryCount;
+	}
+
+	auto now = std::chrono::high_resolution_clock::now();
+	if (!gpu_timing && have_previous_end) {
+		add_frame_time(std::chrono::duration< float, std::milli >(now - previous_end).count());
+	}
+	previous_end = now;
+	have_previous_end = true;
+
+	GL_ERRORS();
+}
+
+void DynamicResolution::add_frame_time(float ms) {
+	//smooth out frame-to-frame noise:
+	frame_ms = (frame_ms == 0.0f ? ms : frame_ms + 0.1f * (ms - frame_ms));
+	if (disabled) return;
+
+	//drawing cost goes (mostly) with the number of pixels, which goes with scale^2, so the scale that would hit the target is about:
+	float ideal = scale * std::sqrt(target_ms / std::max(frame_ms, 0.01f));
+
+	//move part of the way there, ignoring small differences so the resolution doesn't jitter:
+	if (std::abs(ideal - scale) > 0.02f * scale) {
+		scale += 0.1f * (ideal - scale);
+	}
+	scale = std::min(max_scale, std::max(min_scale, scale));
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+/*
+ * DynamicResolution draws frames into an offscreen framebuffer at a fraction
+ *  ('scale') of the window's resolution, then stretches them to the window.
+ *  The scale is adjusted automatically so that GPU time per frame stays near target_ms.
+ *
+ * Each frame:
+ *  - begin() with the window's drawable size; draw at the size it returns,
+ *  - end() to copy the frame to the window (and update the scale).
+ *
+ * The framebuffer is allocated at the full drawable size and frames are drawn into
+ *  its lower-left corner, so changing the scale never reallocates anything.
+ *
+ * GPU time is measured with GL_TIME_ELAPSED queries, read a few frames later so
+ *  nothing waits on the GPU. If timer queries aren't available, the CPU time between
+ *  calls to end() is used instead (which can't tell fill rate from vsync waits, so
+ *  with vsync on it only reacts once frames are missed).
+ *
+ */
+
+#include "GL.hpp"
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cstdint>
+
+struct DynamicResolution {
+	DynamicResolution();
+	~DynamicResolution();
+	DynamicResolution(DynamicResolution const &) = delete;
+	DynamicResolution &operator=(DynamicResolution const &) = delete;
+
+	//GPU time per frame to aim for (a bit under the display's refresh interval leaves room for everything else):
+	float target_ms = 14.0f;
+
+	//range that scale stays in (scale is the fraction of the drawable size drawn in each direction):
+	float min_scale = 0.5f;
+	float max_scale = 1.0f;
+	float scale = 1.0f;
+
+	//if set, draw at full resolution straight into the window (no offscreen framebuffer):
+	bool disabled = false;
+
+	//bind the offscreen framebuffer, set the viewport, and return the size to draw at:
+	glm::uvec2 begin(glm::uvec2 const &drawable_size);
+
+	//stretch the frame to the window (leaves the default framebuffer bound with a full-window viewport):
+	void end();
+
+	//Measurements:
+	float frame_ms = 0.0f; //smoothed frame time that scale is being adjusted from
+	bool gpu_timing = false; //were timer queries used (otherwise, CPU frame times)?
+
+	//----- internals -----
+	glm::uvec2 drawable_size = glm::uvec2(0);
+	glm::uvec2 render_size = glm::uvec2(0);
+
+	glm::uvec2 allocated_size = glm::uvec2(0);
+	GLuint framebuffer = 0;
+	GLuint color_renderbuffer = 0;
+	GLuint depth_renderbuffer = 0;
+	void allocate(glm::uvec2 const &size);
+
+	//timer queries are used round-robin, so results are read QueryCount - 1 frames after they were issued:
+	enum : uint32_t { QueryCount = 4 };
+	GLuint queries[QueryCount] = {0};
+	bool query_pending[QueryCount] = {false};
+	uint32_t next_query = 0;
+
+	std::chrono::high_resolution_clock::time_point previous_end;
+	bool have_previous_end = false;
+
+	//fold a new frame time into frame_ms and adjust scale:
+	void add_frame_time(float ms);
+};
@@ -0,0 +1,72 @@
+#include "Frustum.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_USE_SSE
+#include <emmintrin.h>
+#endif
+
+#include <cmath>
+
+Frustum::Frustum(glm::mat4 const &world_to_clip) {
+	//(Gribb & Hartmann) a point is inside if -w <= x,y,z <= w in clip space,
+	// so each plane is a sum or difference of rows of the matrix:
+	glm::mat4 rows = glm::transpose(world_to_clip);
+	planes[0] = rows[3] + rows[0]; //left
+	planes[1] = rows[3] - rows[0]; //right
+	planes[2] = rows[3] + rows[1]; //bottom
+	planes[3] = rows[3] - rows[1]; //top
+	planes[4] = rows[3] + rows[2]; //near
+	planes[5] = rows[3] - rows[2]; //far (degenerates to "always inside" for infinite projections)
+}
+
+void Frustum::test(uint32_t count,
+	float const *center_x, float const *center_y, float const *center_z,
+	float const *extent_x, float const *extent_y, float const *extent_z,
+	uint8_t *visible) const {
+
+	uint32_t i = 0;
+
+#ifdef FRUSTUM_USE_SSE
+	//four boxes at a time:
+	for (; i + 4 <= count; i += 4) {
+		__m128 cx = _mm_loadu_ps(center_x + i);
+		__m128 cy = _mm_loadu_ps(center_y + i);
+		__m128 cz = _mm_loadu_ps(center_z + i);
+		__m128 ex = _mm_loadu_ps(extent_x + i);
+		__m128 ey = _mm_loadu_ps(extent_y + i);
+		__m128 ez = _mm_loadu_ps(extent_z + i);
+
+		__m128 outside = _mm_setzero_ps();
+		for (uint32_t p = 0; p < 6; ++p) {
+			glm::vec4 const &plane = planes[p];
+			//signed distance of box center to plane:
+			__m128 d = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+				_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w))
+			);
+			//projected radius of box onto plane normal:
+			__m128 r = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(std::abs(plane.x))), _mm_mul_ps(ey, _mm_set1_ps(std::abs(plane.y)))),
+				_mm_mul_ps(ez, _mm_set1_ps(std::abs(plane.z)))
+			);
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+		}
+		int mask = _mm_movemask_ps(outside);
+		visible[i+0] = (mask & 1 ? 0 : 1);
+		visible[i+1] = (mask & 2 ? 0 : 1);
+		visible[i+2] = (mask & 4 ? 0 : 1);
+		visible[i+3] = (mask & 8 ? 0 : 1);
+	}
+#endif
+
+	for (; i < count; ++i) {
+		bool outside = false;
+		for (uint32_t p = 0; p < 6; ++p) {
+			glm::vec4 const &plane = planes[p];
+			float d = center_x[i] * plane.x + center_y[i] * plane.y + center_z[i] * plane.z + plane.w;
+			float r = extent_x[i] * std::abs(plane.x) + extent_y[i] * std::abs(plane.y) + extent_z[i] * std::abs(plane.z);
+			if (d + r < 0.0f) outside = true;
+		}
+		visible[i] = (outside ? 0 : 1);
+	}
+}
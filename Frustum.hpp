@@ -0,0 +1,29 @@
+#pragma once
+
+/*
+ * A Frustum holds the six clipping planes of a world-to-clip matrix and
+ *  tests axis-aligned boxes against them (several boxes at a time).
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+struct Frustum {
+	//extract planes from a world-to-clip matrix (OpenGL clip conventions):
+	Frustum(glm::mat4 const &world_to_clip);
+
+	//planes are stored as (a,b,c,d) with ax + by + cz + d >= 0 for points inside:
+	// order is left, right, bottom, top, near, far
+	glm::vec4 planes[6];
+
+	//test 'count' world-space boxes, given as arrays of centers and half-extents
+	// (one array per component, so that boxes can be tested four at a time):
+	// writes 1 into 'visible' for boxes that touch the frustum, 0 otherwise
+	// (n.b. this is conservative: some boxes near frustum corners will be reported visible)
+	void test(uint32_t count,
+		float const *center_x, float const *center_y, float const *center_z,
+		float const *extent_x, float const *extent_y, float const *extent_z,
+		uint8_t *visible) const;
+};
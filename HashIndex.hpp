@@ -0,0 +1,80 @@
+#pragma once
+
+/*
+ * A HashIndex maps 32-bit hashes to 32-bit values (usually indices into some other array)
+ *  using open addressing with linear probing, all stored in one flat array of slots.
+ *
+ * Different keys may have the same hash, so find() takes a function that checks
+ *  candidate values against the actual key.
+ *
+ */
+
+#include <cassert>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+struct HashIndex {
+	enum : uint32_t { Empty = -1U }; //value stored in empty slots (and returned by find() on failure)
+
+	struct Slot {
+		uint32_t hash = 0;
+		uint32_t value = Empty;
+	};
+	std::vector< Slot > slots; //size is zero or a power of two
+	uint32_t count = 0;
+
+	void clear() {
+		slots.clear();
+		count = 0;
+	}
+
+	//make room for 'total' values without growing (keeps the table at most half full):
+	void reserve(uint32_t total) {
+		uint32_t want = 16;
+		while (want < 2 * total) want *= 2;
+		if (want <= slots.size()) return;
+		std::vector< Slot > old;
+		old.swap(slots);
+		slots.resize(want);
+		count = 0;
+		for (Slot const &slot : old) {
+			if (slot.value != Empty) insert(slot.hash, slot.value);
+		}
+	}
+
+	//add a value (n.b. doesn't check for an existing value with the same key):
+	void insert(uint32_t hash, uint32_t value) {
+		assert(value != Empty);
+		reserve(count + 1);
+		uint32_t mask = uint32_t(slots.size()) - 1;
+		for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+			if (slots[i].value == Empty) {
+				slots[i].hash = hash;
+				slots[i].value = value;
+				count += 1;
+				return;
+			}
+		}
+	}
+
+	//first value with the given hash for which matches(value) is true, or Empty:
+	template< typename Matches >
+	uint32_t find(uint32_t hash, Matches const &matches) const {
+		if (slots.empty()) return Empty;
+		uint32_t mask = uint32_t(slots.size()) - 1;
+		for (uint32_t i = hash & mask; slots[i].value != Empty; i = (i + 1) & mask) {
+			if (slots[i].hash == hash && matches(slots[i].value)) return slots[i].value;
+		}
+		return Empty;
+	}
+
+	//FNV-1a, which can be continued (hash(a + b) == hash(b, hash(a))):
+	static constexpr uint32_t HashStart = 2166136261U;
+	static uint32_t hash(std::string_view str, uint32_t state = HashStart) {
+		for (char c : str) {
+			state = (state ^ uint8_t(c)) * 16777619U;
+		}
+		return state;
+	}
+};
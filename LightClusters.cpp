@@ -0,0 +1,199 @@
+#include "LightClusters.hpp"
+
+#include "gl_errors.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+LightClusters::LightClusters() {
+	glGenBuffers(1, &block_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, block_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	//texture buffers just wrap buffers, so they only need to be attached once:
+	auto make_texture_buffer = [](GLenum format, GLuint *buffer, GLuint *texture) {
+		glGenBuffers(1, buffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, *buffer);
+		glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		glGenTextures(1, texture);
+		glBindTexture(GL_TEXTURE_BUFFER, *texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, format, *buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	};
+	make_texture_buffer(GL_RGBA32F, &light_buffer, &light_texture);
+	make_texture_buffer(GL_RG32UI, &cluster_buffer, &cluster_texture);
+	make_texture_buffer(GL_R16UI, &index_buffer, &index_texture);
+
+	GL_ERRORS();
+}
+
+LightClusters::~LightClusters() {
+	glDeleteTextures(1, &light_texture);
+	glDeleteTextures(1, &cluster_texture);
+	glDeleteTextures(1, &index_texture);
+	glDeleteBuffers(1, &light_buffer);
+	glDeleteBuffers(1, &cluster_buffer);
+	glDeleteBuffers(1, &index_buffer);
+	glDeleteBuffers(1, &block_buffer);
+}
+
+void LightClusters::update(Scene const &scene, Scene::Camera const &camera, glm::uvec2 const &viewport, glm::mat4x3 const &world_to_light) {
+	assert(camera.transform);
+	glm::mat4x3 world_to_view = camera.transform->make_world_to_local();
+	glm::mat4 projection = camera.make_projection();
+	float near_plane = camera.near;
+	float log_near = std::log(near_plane);
+	float slice_scale = float(Slices) / std::log(std::max(slice_far, near_plane * 1.001f) / near_plane);
+
+	//---- light data (global lights first, then local lights) ----
+	light_data.clear();
+	stats = Stats();
+
+	struct Local {
+		glm::vec3 at; //view-space position
+		float range;
+	};
+	std::vector< Local > locals;
+
+	//(two passes so global lights end up at the start of light_data)
+	for (uint32_t pass = 0; pass < 2; ++pass) {
+		for (Scene::Light const &light : scene.lights) {
+			bool global = (light.type == Scene::Light::Hemisphere || light.type == Scene::Light::Directional);
+			if (global != (pass == 0)) continue;
+			if (light_data.size() / 3 >= 0x10000) {
+				//(light indices are stored as 16-bit values)
+				std::cerr << "WARNING: LightClusters ignoring lights past the first 65536." << std::endl;
+				break;
+			}
+
+			glm::mat4x3 light_to_world = light.transform->make_local_to_world();
+			glm::vec3 location = light_to_world[3];
+			glm::vec3 direction = -glm::normalize(light_to_world[2]);
+
+			float type = 0.0f;
+			if (light.type == Scene::Light::Point) type = 0.0f;
+			else if (light.type == Scene::Light::Hemisphere) type = 1.0f;
+			else if (light.type == Scene::Light::Spot) type = 2.0f;
+			else if (light.type == Scene::Light::Directional) type = 3.0f;
+
+			float range = 0.0f;
+			if (!global) {
+				float energy = std::max(light.energy.r, std::max(light.energy.g, light.energy.b));
+				if (!(energy > 0.0f)) continue;
+				range = std::max(1.0f, std::sqrt(energy / min_energy));
+				locals.emplace_back();
+				locals.back().at = world_to_view * glm::vec4(location, 1.0f);
+				locals.back().range = range;
+			}
+
+			light_data.emplace_back(world_to_light * glm::vec4(location, 1.0f), type);
+			light_data.emplace_back(glm::normalize(world_to_light * glm::vec4(direction, 0.0f)), std::cos(0.5f * light.spot_fov));
+			light_data.emplace_back(light.energy, range);
+		}
+		if (pass == 0) stats.global_lights = uint32_t(light_data.size() / 3);
+	}
+	stats.local_lights = uint32_t(locals.size());
+
+	//---- binning ----
+
+	//calls fn(cluster) for every cluster that the sphere around a local light might touch:
+	auto for_each_cluster = [&](Local const &local, auto const &fn) {
+		float depth = -local.at.z;
+		float min_depth = std::max(near_plane, depth - local.range);
+		float max_depth = depth + local.range;
+		if (max_depth < near_plane) return; //(entirely behind the camera)
+
+		auto slice_of = [&](float d) {
+			return uint32_t(std::min(float(Slices - 1), std::max(0.0f, (std::log(d) - log_near) * slice_scale)));
+		};
+		//ndc of view-space coordinate v at depth range [a,b], on the side that makes it smallest (or largest):
+		auto ndc_min = [](float scale, float v, float a, float b) { return scale * v / (v < 0.0f ? a : b); };
+		auto ndc_max = [](float scale, float v, float a, float b) { return scale * v / (v > 0.0f ? a : b); };
+		auto tile_of = [](float ndc, uint32_t tiles) {
+			return uint32_t(std::min(float(tiles - 1), std::max(0.0f, std::floor((ndc * 0.5f + 0.5f) * tiles))));
+		};
+
+		for (uint32_t s = slice_of(min_depth); s <= slice_of(max_depth); ++s) {
+			//the part of the sphere's depth range inside this slice:
+			float a = std::max(min_depth, std::exp(log_near + s / slice_scale));
+			float b = (s + 1 == Slices ? max_depth : std::min(max_depth, std::exp(log_near + (s + 1) / slice_scale)));
+			if (a > b) continue;
+
+			uint32_t x0 = tile_of(ndc_min(projection[0][0], local.at.x - local.range, a, b), TilesX);
+			uint32_t x1 = tile_of(ndc_max(projection[0][0], local.at.x + local.range, a, b), TilesX);
+			uint32_t y0 = tile_of(ndc_min(projection[1][1], local.at.y - local.range, a, b), TilesY);
+			uint32_t y1 = tile_of(ndc_max(projection[1][1], local.at.y + local.range, a, b), TilesY);
+			for (uint32_t y = y0; y <= y1; ++y) {
+				for (uint32_t x = x0; x <= x1; ++x) {
+					fn((s * TilesY + y) * TilesX + x);
+				}
+			}
+		}
+	};
+
+	//count lights per cluster, then lay out each cluster's list and fill them in:
+	cluster_data.assign(TilesX * TilesY * Slices, glm::uvec2(0));
+	for (Local const &local : locals) {
+		for_each_cluster(local, [&](uint32_t c) { cluster_data[c].y += 1; });
+	}
+	uint32_t total = 0;
+	for (glm::uvec2 &cluster : cluster_data) {
+		cluster.x = total;
+		total += cluster.y;
+		stats.max_per_cluster = std::max(stats.max_per_cluster, cluster.y);
+		cluster.y = 0;
+	}
+	stats.references = total;
+	indices.resize(total);
+	for (uint32_t l = 0; l < locals.size(); ++l) {
+		uint16_t index = uint16_t(stats.global_lights + l);
+		for_each_cluster(locals[l], [&](uint32_t c) {
+			indices[cluster_data[c].x + cluster_data[c].y] = index;
+			cluster_data[c].y += 1;
+		});
+	}
+
+	//---- upload ----
+	Block block;
+	block.counts = glm::uvec4(TilesX, TilesY, Slices, stats.global_lights);
+	block.scale = glm::vec4(
+		float(TilesX) / float(std::max(1U, viewport.x)),
+		float(TilesY) / float(std::max(1U, viewport.y)),
+		slice_scale,
+		log_near
+	);
+	glBindBuffer(GL_UNIFORM_BUFFER, block_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), &block, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	//(buffers are re-specified each frame, so the driver doesn't need to wait for draws still using the old data)
+	auto upload = [](GLuint buffer, size_t size, void const *data) {
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, std::max< size_t >(size, 16), nullptr, GL_STREAM_DRAW);
+		if (size) glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	};
+	upload(light_buffer, light_data.size() * sizeof(glm::vec4), light_data.data());
+	upload(cluster_buffer, cluster_data.size() * sizeof(glm::uvec2), cluster_data.data());
+	upload(index_buffer, indices.size() * sizeof(uint16_t), indices.data());
+
+	GL_ERRORS();
+
+	bind();
+}
+
+void LightClusters::bind() const {
+	glBindBufferBase(GL_UNIFORM_BUFFER, BlockBinding, block_buffer);
+
+	glActiveTexture(GL_TEXTURE0 + LightsUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, light_texture);
+	glActiveTexture(GL_TEXTURE0 + ClustersUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, cluster_texture);
+	glActiveTexture(GL_TEXTURE0 + IndicesUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, index_texture);
+	glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+/*
+ * LightClusters sorts a scene's lights into a grid of view-space "clusters"
+ *  (screen tiles split into slices by depth) so that shaders only need to
+ *  loop over the few lights that can reach each pixel.
+ *
+ * Each frame:
+ *  - update() with the scene, camera, and viewport size (before Scene::draw),
+ *  - draw with a program that reads the "Clusters" block and light buffers
+ *    (e.g., lit_color_texture_program_clustered_pipeline; see LitColorTextureProgram.hpp).
+ *
+ * Hemisphere and directional lights reach everything, so they are kept in a
+ *  separate list that every pixel loops over.
+ *
+ */
+
+#include "GL.hpp"
+#include "Scene.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+struct LightClusters {
+	LightClusters();
+	~LightClusters();
+	LightClusters(LightClusters const &) = delete;
+	LightClusters &operator=(LightClusters const &) = delete;
+
+	//cluster grid size (tiles across, tiles down, depth slices):
+	enum : uint32_t { TilesX = 16, TilesY = 9, Slices = 24 };
+
+	//clustered programs declare (and bind "Clusters" to BlockBinding):
+	//  layout(std140) uniform Clusters { uvec4 CLUSTER_COUNTS; vec4 CLUSTER_SCALE; };
+	//  uniform samplerBuffer LIGHTS; //three texels per light, on LightsUnit
+	//  uniform usamplerBuffer CLUSTERS; //(first index, count) per cluster, on ClustersUnit
+	//  uniform usamplerBuffer LIGHT_INDICES; //light indices for all clusters, on IndicesUnit
+	// (texture units start after the ones Scene::draw binds for materials)
+	enum : GLuint { BlockBinding = 1 };
+	enum : GLuint {
+		LightsUnit = Scene::Material::TextureCount,
+		ClustersUnit = LightsUnit + 1,
+		IndicesUnit = LightsUnit + 2,
+	};
+
+	//depth slices are spaced exponentially from the camera's near plane to slice_far
+	// (the last slice also holds everything beyond slice_far):
+	float slice_far = 200.0f;
+
+	//point and spot lights are treated as reaching as far as their energy (which falls off as 1 / distance^2)
+	// stays above min_energy; the clustered shader fades them to zero at that distance:
+	float min_energy = 1.0f / 64.0f;
+
+	//bin the scene's lights for the camera and upload the results (binds buffers as bind() does):
+	// (positions and directions are transformed by world_to_light, which should match the one given to Scene::draw)
+	void update(Scene const &scene, Scene::Camera const &camera, glm::uvec2 const &viewport,
+		glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f));
+
+	//bind the uniform block and light buffers (needed again only if something else has replaced them):
+	void bind() const;
+
+	//Counts from the most recent call to update():
+	struct Stats {
+		uint32_t global_lights = 0; //hemisphere and directional lights (used everywhere)
+		uint32_t local_lights = 0; //point and spot lights sorted into clusters
+		uint32_t references = 0; //light indices stored across all clusters
+		uint32_t max_per_cluster = 0; //most lights in any one cluster
+	} stats;
+
+	//----- internals -----
+
+	//light data, three texels per light (globals first):
+	// (location, type) (direction, spot cutoff) (energy, range)
+	std::vector< glm::vec4 > light_data;
+	//(first index, count) for each cluster, x fastest, then y, then slice:
+	std::vector< glm::uvec2 > cluster_data;
+	std::vector< uint16_t > indices;
+
+	//std140 layout of the "Clusters" uniform block:
+	struct Block {
+		glm::uvec4 counts; //TilesX, TilesY, Slices, global light count
+		glm::vec4 scale; //tiles per pixel (x, y), slices per log(depth), log(near)
+	};
+	static_assert(sizeof(Block) == 32, "Block matches std140 layout.");
+
+	GLuint block_buffer = 0;
+	GLuint light_buffer = 0, light_texture = 0;
+	GLuint cluster_buffer = 0, cluster_texture = 0;
+	GLuint index_buffer = 0, index_texture = 0;
+};
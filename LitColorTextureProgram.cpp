@@ -1,9 +1,14 @@
 #include "LitColorTextureProgram.hpp"
 
 #include "gl_compile_program.hpp"
+#include "depth_program.hpp"
 #include "gl_errors.hpp"
+#include "TextureArray.hpp"
+#include "Skinning.hpp"
 
 Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
+Scene::Drawable::Pipeline lit_color_texture_program_clustered_pipeline;
+Scene::Drawable::Pipeline lit_color_texture_program_clustered_skinned_pipeline;
 
 Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
 	LitColorTextureProgram *ret = new LitColorTextureProgram();
@@ -11,9 +16,11 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	//----- build the pipeline template -----
 	lit_color_texture_program_pipeline.program = ret->program;
 
-	lit_color_texture_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
-	lit_color_texture_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
-	lit_color_texture_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
+	Scene::Material material;
+
+	//object matrices come from the "Object" uniform block:
+	material.object_uniform_block = true;
+	material.depth_program = ret->depth_program;
 
 	/* This will be used later if/when we build a light loop into the Scene:
 	lit_color_texture_program_pipeline.LIGHT_TYPE_int = ret->LIGHT_TYPE_int;
@@ -23,34 +30,91 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	lit_color_texture_program_pipeline.LIGHT_CUTOFF_float = ret->LIGHT_CUTOFF_float;
 	*/
 
-	//make a 1-pixel white texture to bind by default:
-	GLuint tex;
-	glGenTextures(1, &tex);
+	//make a 1-pixel white (one layer) array texture to bind by default:
+	// (never deallocated, like the program)
+	TextureArray *white = new TextureArray();
+	uint32_t white_id = white->add(glm::uvec2(1), std::vector< glm::u8vec4 >(1, glm::u8vec4(0xff)));
+	white->upload();
+
+	material.textures[0].texture = white->lookup(white_id).texture;
+	material.textures[0].target = GL_TEXTURE_2D_ARRAY;
+
+	lit_color_texture_program_pipeline.material = Scene::add_material(material);
+
+	return ret;
+});
+
+Load< LitColorTextureProgram > lit_color_texture_program_instanced(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	LitColorTextureProgram *ret = new LitColorTextureProgram(true);
+
+	Scene::materials()[lit_color_texture_program_pipeline.material].instanced_program = ret->program;
+	Scene::materials()[lit_color_texture_program_pipeline.material].depth_instanced_program = ret->depth_program;
+
+	return ret;
+});
+
+Load< LitColorTextureProgram > lit_color_texture_program_clustered(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	LitColorTextureProgram *ret = new LitColorTextureProgram(false, true);
+
+	//same as the plain pipeline (including its default texture), but with the clustered programs:
+	lit_color_texture_program_clustered_pipeline = lit_color_texture_program_pipeline;
+	lit_color_texture_program_clustered_pipeline.program = ret->program;
+
+	Scene::Material material = Scene::materials()[lit_color_texture_program_pipeline.material];
+	material.instanced_program = 0; //(set by lit_color_texture_program_clustered_instanced)
+	material.depth_program = ret->depth_program;
+	material.depth_instanced_program = 0;
+	lit_color_texture_program_clustered_pipeline.material = Scene::add_material(material);
+
+	return ret;
+});
+
+Load< LitColorTextureProgram > lit_color_texture_program_clustered_instanced(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	LitColorTextureProgram *ret = new LitColorTextureProgram(true, true);
 
-	glBindTexture(GL_TEXTURE_2D, tex);
-	std::vector< glm::u8vec4 > tex_data(1, glm::u8vec4(0xff));
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, tex_data.data());
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	Scene::materials()[lit_color_texture_program_clustered_pipeline.material].instanced_program = ret->program;
+	Scene::materials()[lit_color_texture_program_clustered_pipeline.material].depth_instanced_program = ret->depth_program;
 
+	return ret;
+});
+
+Load< LitColorTextureProgram > lit_color_texture_program_clustered_skinned(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	LitColorTextureProgram *ret = new LitColorTextureProgram(false, true, true);
 
-	lit_color_texture_program_pipeline.textures[0].texture = tex;
-	lit_color_texture_program_pipeline.textures[0].target = GL_TEXTURE_2D;
+	lit_color_texture_program_clustered_skinned_pipeline = lit_color_texture_program_clustered_pipeline;
+	lit_color_texture_program_clustered_skinned_pipeline.program = ret->program;
+	lit_color_texture_program_clustered_skinned_pipeline.instanced_vao = 0;
+
+	Scene::Material material = Scene::materials()[lit_color_texture_program_clustered_pipeline.material];
+	material.instanced_program = 0;
+	material.depth_program = 0;
+	material.depth_instanced_program = 0;
+	lit_color_texture_program_clustered_skinned_pipeline.material = Scene::add_material(material);
 
 	return ret;
 });
 
-LitColorTextureProgram::LitColorTextureProgram() {
+LitColorTextureProgram::LitColorTextureProgram(bool instanced, bool clustered, bool skinned) {
+	assert(!(instanced && skinned) && "There is no instanced skinned variant.");
+
 	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
 	program = gl_compile_program(
 		//vertex shader:
 		"#version 330\n"
-		"uniform mat4 OBJECT_TO_CLIP;\n"
-		"uniform mat4x3 OBJECT_TO_LIGHT;\n"
-		"uniform mat3 NORMAL_TO_LIGHT;\n"
+		"invariant gl_Position;\n" //(so depth matches the depth pre-pass exactly)
+		+ std::string(instanced
+			? "in mat4 OBJECT_TO_CLIP;\n"
+			  "in mat4x3 OBJECT_TO_LIGHT;\n"
+			  "in mat3 NORMAL_TO_LIGHT;\n"
+			  "in float TEXTURE_LAYER;\n"
+			: "layout(std140) uniform Object {\n"
+			  "	mat4 OBJECT_TO_CLIP;\n"
+			  "	mat4x3 OBJECT_TO_LIGHT;\n"
+			  "	mat3 NORMAL_TO_LIGHT;\n"
+			  "	float TEXTURE_LAYER;\n"
+			  "};\n"
+		) +
+		std::string(skinned ? Skinning::VertexShaderCode : "") +
 		"in vec4 Position;\n"
 		"in vec3 Normal;\n"
 		"in vec4 Color;\n"
@@ -59,50 +123,96 @@ LitColorTextureProgram::LitColorTextureProgram() {
 		"out vec3 normal;\n"
 		"out vec4 color;\n"
 		"out vec2 texCoord;\n"
+		"flat out float layer;\n"
 		"void main() {\n"
-		"	gl_Position = OBJECT_TO_CLIP * Position;\n"
-		"	position = OBJECT_TO_LIGHT * Position;\n"
-		"	normal = NORMAL_TO_LIGHT * Normal;\n"
+		+ std::string(skinned
+			? "	mat4x3 skin = skin_matrix();\n"
+			  "	vec4 P = vec4(skin * Position, 1.0);\n"
+			  "	vec3 N = mat3(skin) * Normal;\n"
+			: "	vec4 P = Position;\n"
+			  "	vec3 N = Normal;\n"
+		) +
+		"	gl_Position = OBJECT_TO_CLIP * P;\n"
+		"	position = OBJECT_TO_LIGHT * P;\n"
+		"	normal = NORMAL_TO_LIGHT * N;\n"
 		"	color = Color;\n"
 		"	texCoord = TexCoord;\n"
+		"	layer = TEXTURE_LAYER;\n"
 		"}\n"
 	,
 		//fragment shader:
 		"#version 330\n"
-		"uniform sampler2D TEX;\n"
-		"uniform int LIGHT_TYPE;\n"
-		"uniform vec3 LIGHT_LOCATION;\n"
-		"uniform vec3 LIGHT_DIRECTION;\n"
-		"uniform vec3 LIGHT_ENERGY;\n"
-		"uniform float LIGHT_CUTOFF;\n"
+		"uniform sampler2DArray TEX;\n"
+		+ std::string(clustered
+			? "layout(std140) uniform Clusters {\n"
+			  "	uvec4 CLUSTER_COUNTS;\n" //tiles across, tiles down, depth slices, global lights
+			  "	vec4 CLUSTER_SCALE;\n" //tiles per pixel (x, y), slices per log(depth), log(near)
+			  "};\n"
+			  "uniform samplerBuffer LIGHTS;\n"
+			  "uniform usamplerBuffer CLUSTERS;\n"
+			  "uniform usamplerBuffer LIGHT_INDICES;\n"
+			: "uniform int LIGHT_TYPE;\n"
+			  "uniform vec3 LIGHT_LOCATION;\n"
+			  "uniform vec3 LIGHT_DIRECTION;\n"
+			  "uniform vec3 LIGHT_ENERGY;\n"
+			  "uniform float LIGHT_CUTOFF;\n"
+		) +
 		"in vec3 position;\n"
 		"in vec3 normal;\n"
 		"in vec4 color;\n"
 		"in vec2 texCoord;\n"
+		"flat in float layer;\n"
 		"out vec4 fragColor;\n"
-		"void main() {\n"
-		"	vec3 n = normalize(normal);\n"
-		"	vec3 e;\n"
-		"	if (LIGHT_TYPE == 0) { //point light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
-		"		float dis2 = dot(l,l);\n"
-		"		l = normalize(l);\n"
-		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 1) { //hemi light \n"
-		"		e = (dot(n,-LIGHT_DIRECTION) * 0.5 + 0.5) * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 2) { //spot light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
+		//light arriving at 'position' with normal 'n' (point and spot lights fade to zero at 'range', if it is positive):
+		"vec3 shade(int type, vec3 location, vec3 direction, vec3 energy, float cutoff, float range, vec3 n) {\n"
+		"	if (type == 0 || type == 2) { //point or spot light \n"
+		"		vec3 l = (location - position);\n"
 		"		float dis2 = dot(l,l);\n"
 		"		l = normalize(l);\n"
 		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		float c = dot(l,-LIGHT_DIRECTION);\n"
-		"		nl *= smoothstep(LIGHT_CUTOFF,mix(LIGHT_CUTOFF,1.0,0.1), c);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else { //(LIGHT_TYPE == 3) //directional light \n"
-		"		e = max(0.0, dot(n,-LIGHT_DIRECTION)) * LIGHT_ENERGY;\n"
+		"		if (type == 2) {\n"
+		"			float c = dot(l,-direction);\n"
+		"			nl *= smoothstep(cutoff,mix(cutoff,1.0,0.1), c);\n"
+		"		}\n"
+		"		if (range > 0.0) {\n"
+		"			float fade = clamp(1.0 - dis2 / (range * range), 0.0, 1.0);\n"
+		"			nl *= fade * fade;\n"
+		"		}\n"
+		"		return nl * energy;\n"
+		"	} else if (type == 1) { //hemi light \n"
+		"		return (dot(n,-direction) * 0.5 + 0.5) * energy;\n"
+		"	} else { //(type == 3) //directional light \n"
+		"		return max(0.0, dot(n,-direction)) * energy;\n"
 		"	}\n"
-		"	vec4 albedo = texture(TEX, texCoord) * color;\n"
+		"}\n"
+		+ std::string(clustered
+			? "vec3 shade_light(uint i, vec3 n) {\n"
+			  "	vec4 a = texelFetch(LIGHTS, int(3u * i));\n" //location, type
+			  "	vec4 b = texelFetch(LIGHTS, int(3u * i + 1u));\n" //direction, cutoff
+			  "	vec4 c = texelFetch(LIGHTS, int(3u * i + 2u));\n" //energy, range
+			  "	return shade(int(a.w), a.xyz, b.xyz, c.rgb, b.w, c.w, n);\n"
+			  "}\n"
+			: ""
+		) +
+		"void main() {\n"
+		"	vec3 n = normalize(normal);\n"
+		+ std::string(clustered
+			? "	vec3 e = vec3(0.0);\n"
+			  "	for (uint i = 0u; i < CLUSTER_COUNTS.w; ++i) {\n"
+			  "		e += shade_light(i, n);\n"
+			  "	}\n"
+			  //cluster from pixel position and view depth (gl_FragCoord.w is 1 / clip w, and clip w is view depth):
+			  "	uvec3 cell = uvec3(\n"
+			  "		min(uvec2(gl_FragCoord.xy * CLUSTER_SCALE.xy), CLUSTER_COUNTS.xy - 1u),\n"
+			  "		uint(clamp((-log(gl_FragCoord.w) - CLUSTER_SCALE.w) * CLUSTER_SCALE.z, 0.0, float(CLUSTER_COUNTS.z - 1u)))\n"
+			  "	);\n"
+			  "	uvec2 cluster = texelFetch(CLUSTERS, int((cell.z * CLUSTER_COUNTS.y + cell.y) * CLUSTER_COUNTS.x + cell.x)).xy;\n"
+			  "	for (uint i = 0u; i < cluster.y; ++i) {\n"
+			  "		e += shade_light(texelFetch(LIGHT_INDICES, int(cluster.x + i)).r, n);\n"
+			  "	}\n"
+			: "	vec3 e = shade(LIGHT_TYPE, LIGHT_LOCATION, LIGHT_DIRECTION, LIGHT_ENERGY, LIGHT_CUTOFF, 0.0, n);\n"
+		) +
+		"	vec4 albedo = texture(TEX, vec3(texCoord, layer)) * color;\n"
 		"	fragColor = vec4(e*albedo.rgb, albedo.a);\n"
 		"}\n"
 	);
@@ -114,30 +224,53 @@ LitColorTextureProgram::LitColorTextureProgram() {
 	Normal_vec3 = glGetAttribLocation(program, "Normal");
 	Color_vec4 = glGetAttribLocation(program, "Color");
 	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
+	BoneIndices_vec4 = glGetAttribLocation(program, "BoneIndices");
+	BoneWeights_vec4 = glGetAttribLocation(program, "BoneWeights");
 
-	//look up the locations of uniforms:
-	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
-	OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "OBJECT_TO_LIGHT");
-	NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
+	//position-only version for the depth pre-pass (reads attributes from the same vertex arrays):
+	// (not for the skinned variant, since the depth program wouldn't skin)
+	if (!skinned) depth_program = make_depth_program(program, instanced);
 
+	//the non-instanced variant reads object matrices from a uniform block at a fixed binding:
+	if (!instanced) {
+		glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Object"), Scene::ObjectBlockBinding);
+	}
+
+	//look up the locations of uniforms:
 	LIGHT_TYPE_int = glGetUniformLocation(program, "LIGHT_TYPE");
 	LIGHT_LOCATION_vec3 = glGetUniformLocation(program, "LIGHT_LOCATION");
 	LIGHT_DIRECTION_vec3 = glGetUniformLocation(program, "LIGHT_DIRECTION");
 	LIGHT_ENERGY_vec3 = glGetUniformLocation(program, "LIGHT_ENERGY");
 	LIGHT_CUTOFF_float = glGetUniformLocation(program, "LIGHT_CUTOFF");
+	BONE_OFFSET_int = glGetUniformLocation(program, "BONE_OFFSET");
 
 
-	GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
+	GLuint TEX_sampler2DArray = glGetUniformLocation(program, "TEX");
 
 	//set TEX to always refer to texture binding zero:
 	glUseProgram(program); //bind program -- glUniform* calls refer to this program now
 
-	glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
+	glUniform1i(TEX_sampler2DArray, 0); //set TEX to sample from GL_TEXTURE0
+
+	//the clustered variant reads its lights from buffers that LightClusters binds:
+	if (clustered) {
+		glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Clusters"), LightClusters::BlockBinding);
+		glUniform1i(glGetUniformLocation(program, "LIGHTS"), LightClusters::LightsUnit);
+		glUniform1i(glGetUniformLocation(program, "CLUSTERS"), LightClusters::ClustersUnit);
+		glUniform1i(glGetUniformLocation(program, "LIGHT_INDICES"), LightClusters::IndicesUnit);
+	}
+
+	//the skinned variant reads bone matrices from the texture buffer that Skinning::make_material binds:
+	if (skinned) {
+		glUniform1i(glGetUniformLocation(program, "BONES"), Skinning::BonesUnit);
+	}
 
 	glUseProgram(0); //unbind program -- glUniform* calls refer to ??? now
 }
 
 LitColorTextureProgram::~LitColorTextureProgram() {
+	glDeleteProgram(depth_program);
+	depth_program = 0;
 	glDeleteProgram(program);
 	program = 0;
 }
@@ -3,38 +3,65 @@
 #include "GL.hpp"
 #include "Load.hpp"
 #include "Scene.hpp"
+#include "LightClusters.hpp"
 
 //Shader program that draws transformed, lit, textured vertices tinted with vertex colors:
 struct LitColorTextureProgram {
-	LitColorTextureProgram();
+	//'instanced' variant reads OBJECT_TO_CLIP, OBJECT_TO_LIGHT, and NORMAL_TO_LIGHT from per-instance attributes (see MeshInstance):
+	//'clustered' variant loops over the lights that LightClusters found near each pixel (instead of using the LIGHT_* uniforms):
+	//'skinned' variant blends its vertices with bone matrices from a Skinning (draw from the skinned MeshBuffer, with a material from Skinning::make_material):
+	// (there is no instanced skinned variant, and skinned variants have no depth_program)
+	LitColorTextureProgram(bool instanced = false, bool clustered = false, bool skinned = false);
 	~LitColorTextureProgram();
 
 	GLuint program = 0;
+	GLuint depth_program = 0; //position-only version, for Scene::depth_prepass (see make_depth_program)
 
 	//Attribute (per-vertex variable) locations:
 	GLuint Position_vec4 = -1U;
 	GLuint Normal_vec3 = -1U;
 	GLuint Color_vec4 = -1U;
 	GLuint TexCoord_vec2 = -1U;
+	GLuint BoneIndices_vec4 = -1U; //(skinned variant)
+	GLuint BoneWeights_vec4 = -1U; //(skinned variant)
+
+	//Object matrices (OBJECT_TO_CLIP, OBJECT_TO_LIGHT, NORMAL_TO_LIGHT) and TEXTURE_LAYER are read from:
+	// - the "Object" uniform block (bound to Scene::ObjectBlockBinding) in the plain variant
+	// - per-instance attributes (see MeshInstance) in the instanced variant
 
 	//Uniform (per-invocation variable) locations:
-	GLuint OBJECT_TO_CLIP_mat4 = -1U;
-	GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
-	GLuint NORMAL_TO_LIGHT_mat3 = -1U;
 
-	//lighting:
+	//lighting (not in the clustered variant):
 	GLuint LIGHT_TYPE_int = -1U;
 	GLuint LIGHT_LOCATION_vec3 = -1U;
 	GLuint LIGHT_DIRECTION_vec3 = -1U;
 	GLuint LIGHT_ENERGY_vec3 = -1U;
 	GLuint LIGHT_CUTOFF_float = -1U;
+
+	//skinning (skinned variant; set per instance by Skinning::make_material):
+	GLuint BONE_OFFSET_int = -1U;
 	
 	//Textures:
-	//TEXTURE0 - texture that is accessed by TexCoord
+	//TEXTURE0 - GL_TEXTURE_2D_ARRAY texture that is accessed by TexCoord, in layer TEXTURE_LAYER (see TextureArray)
+	//(clustered variant) LightClusters::LightsUnit, ClustersUnit, IndicesUnit - light buffers
+	//(skinned variant) Skinning::BonesUnit - bone matrices
 };
 
 extern Load< LitColorTextureProgram > lit_color_texture_program;
+extern Load< LitColorTextureProgram > lit_color_texture_program_instanced;
+extern Load< LitColorTextureProgram > lit_color_texture_program_clustered;
+extern Load< LitColorTextureProgram > lit_color_texture_program_clustered_instanced;
+extern Load< LitColorTextureProgram > lit_color_texture_program_clustered_skinned;
 
 //For convenient scene-graph setup, copy this object:
-// NOTE: by default, has texture bound to 1-pixel white texture -- so it's okay to use with vertex-color-only meshes.
+// NOTE: by default, has texture bound to 1-pixel white array texture -- so it's okay to use with vertex-color-only meshes.
+// NOTE: drawables whose textures are layers of the same TextureArray texture can share one material (set texture_layer per drawable).
+// NOTE: its material has instanced_program set, but you will need to set instanced_vao to make use of it.
 extern Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
+
+//Same as above, but drawn with the clustered programs (call LightClusters::update before drawing):
+extern Scene::Drawable::Pipeline lit_color_texture_program_clustered_pipeline;
+
+//Same as the clustered pipeline, but GPU-skinned:
+// (per skinned instance, set material to skinning.make_material(instance, material, lit_color_texture_program_clustered_skinned->BONE_OFFSET_int))
+extern Scene::Drawable::Pipeline lit_color_texture_program_clustered_skinned_pipeline;
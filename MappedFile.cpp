@@ -0,0 +1,72 @@
+#include "MappedFile.hpp"
+
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(std::string const &filename) {
+	#if defined(_WIN32)
+	HANDLE handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("Failed to open '" + filename + "' for mapping.");
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(handle, &file_size)) {
+		CloseHandle(handle);
+		throw std::runtime_error("Failed to get size of '" + filename + "'.");
+	}
+	file = handle;
+	size = size_t(file_size.QuadPart);
+	if (size == 0) return; //(empty files can't be mapped)
+
+	mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping) {
+		data = reinterpret_cast< char const * >(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	}
+	if (!data) {
+		if (mapping) CloseHandle(mapping);
+		CloseHandle(handle);
+		throw std::runtime_error("Failed to map '" + filename + "'.");
+	}
+	#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("Failed to open '" + filename + "' for mapping.");
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		throw std::runtime_error("Failed to get size of '" + filename + "'.");
+	}
+	size = size_t(info.st_size);
+	if (size != 0) {
+		void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ptr == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error("Failed to map '" + filename + "'.");
+		}
+		data = reinterpret_cast< char const * >(ptr);
+	}
+	//(the mapping stays valid after the file is closed)
+	close(fd);
+	#endif
+}
+
+MappedFile::~MappedFile() {
+	#if defined(_WIN32)
+	if (data) UnmapViewOfFile(data);
+	if (mapping) CloseHandle(mapping);
+	if (file) CloseHandle(file);
+	#else
+	if (data) munmap(const_cast< char * >(data), size);
+	#endif
+}
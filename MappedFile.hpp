@@ -0,0 +1,31 @@
+#pragma once
+
+/*
+ * A MappedFile maps a file's contents (read-only) into memory,
+ *  so that loaders can use the data in place instead of reading it into buffers.
+ *
+ * The mapping is released when the MappedFile is destroyed.
+ *
+ */
+
+#include <cstddef>
+#include <string>
+
+struct MappedFile {
+	//map 'filename'; throws on failure:
+	MappedFile(std::string const &filename);
+	~MappedFile();
+
+	//since the destructor releases the mapping, copying is not allowed:
+	MappedFile(MappedFile const &) = delete;
+	MappedFile &operator=(MappedFile const &) = delete;
+
+	char const *data = nullptr; //(nullptr if the file is empty)
+	size_t size = 0;
+
+	//os-specific handles:
+#if defined(_WIN32)
+	void *file = nullptr;
+	void *mapping = nullptr;
+#endif
+};
@@ -10,10 +10,11 @@
 #include <string>
 #include <set>
 #include <cstddef>
+#include <cstring>
+#include <tuple>
+#include <unordered_map>
 
-MeshBuffer::MeshBuffer(std::string const &filename) {
-	glGenBuffers(1, &buffer);
-
+MeshBuffer::MeshBuffer(std::string const &filename, bool upload_now) {
 	std::ifstream file(filename, std::ios::binary);
 
 	GLuint total = 0;
@@ -31,13 +32,14 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 	if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".pnct") {
 		read_chunk(file, "pnct", &data);
 
-		//upload data:
-		glBindBuffer(GL_ARRAY_BUFFER, buffer);
-		glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(Vertex), data.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-
 		total = GLuint(data.size()); //store total for later checks on index
 
+		//keep positions around for ray casts:
+		positions.reserve(data.size());
+		for (auto const &v : data) {
+			positions.emplace_back(v.Position);
+		}
+
 		//store attrib locations:
 		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
 		Normal = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Normal));
@@ -60,6 +62,9 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		std::vector< IndexEntry > index;
 		read_chunk(file, "idx0", &index);
 
+		//'<name>:lod<level>' entries are simplified versions of '<name>' (attached below):
+		std::vector< std::tuple< std::string, uint32_t, Mesh::LOD > > lod_entries;
+
 		for (auto const &entry : index) {
 			if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
 				throw std::runtime_error("index entry has out-of-range name begin/end");
@@ -76,17 +81,130 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 				mesh.min = glm::min(mesh.min, data[v].Position);
 				mesh.max = glm::max(mesh.max, data[v].Position);
 			}
+
+			//simplified versions are only drawn, not ray cast, so they don't need a BVH:
+			size_t lod_at = name.rfind(":lod");
+			bool is_lod = (lod_at != std::string::npos && lod_at + 4 < name.size()
+				&& name.find_first_not_of("0123456789", lod_at + 4) == std::string::npos);
+			if (is_lod) {
+				Mesh::LOD lod;
+				lod.start = mesh.start;
+				lod.count = mesh.count;
+				lod_entries.emplace_back(name.substr(0, lod_at), uint32_t(std::stoul(name.substr(lod_at + 4))), lod);
+			}
+
+			//build triangle BVH for ray casts:
+			mesh.positions = positions.data() + mesh.start;
+			if (!is_lod && mesh.type == GL_TRIANGLES && mesh.count >= 3) {
+				uint32_t count = mesh.count / 3;
+				std::vector< glm::vec3 > tri_min(count), tri_max(count);
+				for (uint32_t t = 0; t < count; ++t) {
+					glm::vec3 const *tri = mesh.positions + 3 * t;
+					tri_min[t] = glm::min(tri[0], glm::min(tri[1], tri[2]));
+					tri_max[t] = glm::max(tri[0], glm::max(tri[1], tri[2]));
+				}
+				auto bvh = std::make_shared< BVH >();
+				bvh->build(count, tri_min.data(), tri_max.data());
+				mesh.triangles = bvh;
+			}
 			bool inserted = meshes.insert(std::make_pair(name, mesh)).second;
 			if (!inserted) {
 				std::cerr << "WARNING: mesh name '" + name + "' in filename '" + filename + "' collides with existing mesh." << std::endl;
 			}
 		}
+
+		for (auto const &entry : lod_entries) {
+			auto f = meshes.find(std::get< 0 >(entry));
+			uint32_t level = std::get< 1 >(entry);
+			if (f == meshes.end() || level == 0 || level > 255) {
+				std::cerr << "WARNING: level-of-detail mesh " << level << " for '" << std::get< 0 >(entry) << "' in filename '" << filename << "' doesn't match any mesh (or level)." << std::endl;
+				continue;
+			}
+			Mesh &mesh = f->second;
+			if (mesh.lods.size() < level) mesh.lods.resize(level);
+			mesh.lods[level-1] = std::get< 2 >(entry);
+		}
+		//levels must be contiguous, so drop everything after a missing level:
+		for (auto &name_mesh : meshes) {
+			std::vector< Mesh::LOD > &lods = name_mesh.second.lods;
+			for (uint32_t l = 0; l < lods.size(); ++l) {
+				if (lods[l].count == 0) {
+					lods.resize(l);
+					break;
+				}
+			}
+		}
+	}
+
+	//(optional) skin chunks -- bone weights for every vertex, then the bones of each skinned mesh:
+	if (file.peek() != EOF) {
+		read_chunk(file, "skn0", &skin);
+		if (skin.size() != total) {
+			throw std::runtime_error("skin chunk has " + std::to_string(skin.size()) + " vertices, but mesh file has " + std::to_string(total));
+		}
+
+		struct BoneEntry {
+			uint32_t mesh_begin, mesh_end; //name of the mesh the bone belongs to
+			uint32_t name_begin, name_end; //name of the transform that moves the bone
+			float mesh_to_bone[12]; //(column-major 4x3 matrix)
+		};
+		static_assert(sizeof(BoneEntry) == 4*4 + 4*12, "BoneEntry is packed.");
+
+		std::vector< BoneEntry > bones;
+		read_chunk(file, "bnd0", &bones);
+		for (auto const &entry : bones) {
+			if (!(entry.mesh_begin <= entry.mesh_end && entry.mesh_end <= strings.size())
+			 || !(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
+				throw std::runtime_error("bone entry has out-of-range name begin/end");
+			}
+			std::string mesh_name(&strings[0] + entry.mesh_begin, &strings[0] + entry.mesh_end);
+			auto f = meshes.find(mesh_name);
+			if (f == meshes.end()) {
+				throw std::runtime_error("bone entry refers to mesh '" + mesh_name + "', which isn't in the index");
+			}
+			Mesh &mesh = f->second;
+			if (mesh.bones.size() >= 256) {
+				throw std::runtime_error("mesh '" + mesh_name + "' has more bones than a skin weight can index");
+			}
+			mesh.bones.emplace_back();
+			mesh.bones.back().name = std::string(&strings[0] + entry.name_begin, &strings[0] + entry.name_end);
+			float const *m = entry.mesh_to_bone;
+			mesh.bones.back().mesh_to_bone = glm::mat4x3(
+				m[0], m[1], m[2],
+				m[3], m[4], m[5],
+				m[6], m[7], m[8],
+				m[9], m[10], m[11]
+			);
+		}
+
+		//every weighted bone needs to exist:
+		for (auto const &name_mesh : meshes) {
+			Mesh const &mesh = name_mesh.second;
+			for (uint32_t v = mesh.start; v < mesh.start + mesh.count; ++v) {
+				for (uint32_t i = 0; i < 4; ++i) {
+					if (skin[v].weights[i] != 0 && skin[v].bones[i] >= mesh.bones.size()) {
+						throw std::runtime_error("vertex " + std::to_string(v) + " of mesh '" + name_mesh.first + "' is weighted to a bone it doesn't have");
+					}
+				}
+			}
+		}
+
+		//skin data is stored after the vertices:
+		size_t offset = data.size() * sizeof(Vertex);
+		BoneIndices = Attrib(4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(SkinWeights), GLsizei(offset + offsetof(SkinWeights, bones)));
+		BoneWeights = Attrib(4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(SkinWeights), GLsizei(offset + offsetof(SkinWeights, weights)));
 	}
 
 	if (file.peek() != EOF) {
 		std::cerr << "WARNING: trailing data in mesh file '" << filename << "'" << std::endl;
 	}
 
+	//hold on to vertex (and skin) data until upload():
+	pending_upload.resize(data.size() * sizeof(Vertex) + skin.size() * sizeof(SkinWeights));
+	if (!data.empty()) std::memcpy(pending_upload.data(), data.data(), data.size() * sizeof(Vertex));
+	if (!skin.empty()) std::memcpy(pending_upload.data() + data.size() * sizeof(Vertex), skin.data(), skin.size() * sizeof(SkinWeights));
+	if (upload_now) upload();
+
 	/* //DEBUG:
 	std::cout << "File '" << filename << "' contained meshes";
 	for (auto const &m : meshes) {
@@ -98,6 +216,44 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 	*/
 }
 
+void MeshBuffer::upload() {
+	if (buffer != 0) return;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, pending_upload.size(), pending_upload.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	pending_upload.clear();
+	pending_upload.shrink_to_fit();
+}
+
+bool Mesh::raycast(glm::vec3 const &origin, glm::vec3 const &direction, float *max_t, uint32_t *triangle) const {
+	if (!triangles) return false;
+	bool hit = false;
+	triangles->raycast(origin, direction, max_t, [&](uint32_t t, float *limit) {
+		//Moller-Trumbore ray/triangle intersection (hits either side):
+		glm::vec3 const *tri = positions + 3 * t;
+		glm::vec3 e1 = tri[1] - tri[0];
+		glm::vec3 e2 = tri[2] - tri[0];
+		glm::vec3 p = glm::cross(direction, e2);
+		float det = glm::dot(e1, p);
+		if (det == 0.0f) return;
+		float inv_det = 1.0f / det;
+		glm::vec3 s = origin - tri[0];
+		float u = glm::dot(s, p) * inv_det;
+		if (u < 0.0f || u > 1.0f) return;
+		glm::vec3 q = glm::cross(s, e1);
+		float v = glm::dot(direction, q) * inv_det;
+		if (v < 0.0f || u + v > 1.0f) return;
+		float dist = glm::dot(e2, q) * inv_det;
+		if (dist < 0.0f || dist > *limit) return;
+		*limit = dist;
+		if (triangle) *triangle = t;
+		hit = true;
+	});
+	return hit;
+}
+
 const Mesh &MeshBuffer::lookup(std::string const &name) const {
 	auto f = meshes.find(name);
 	if (f == meshes.end()) {
@@ -106,7 +262,25 @@ const Mesh &MeshBuffer::lookup(std::string const &name) const {
 	return f->second;
 }
 
-GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
+//per-instance attribute bindings of vertex arrays made by make_vao_for_program (used by set_first_instance):
+namespace {
+	struct InstanceBinding {
+		GLuint instance_buffer = 0;
+		struct Column {
+			GLuint location;
+			GLint rows;
+			size_t offset;
+		};
+		std::vector< Column > columns;
+		uint32_t first = 0; //instance the columns currently start at
+	};
+	std::unordered_map< GLuint, InstanceBinding > &instance_bindings() {
+		static std::unordered_map< GLuint, InstanceBinding > bindings;
+		return bindings;
+	}
+}
+
+GLuint MeshBuffer::make_vao_for_program(GLuint program, GLuint instance_buffer) const {
 	//create a new vertex array object:
 	GLuint vao = 0;
 	glGenVertexArrays(1, &vao);
@@ -127,7 +301,33 @@ GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
 	bind_attribute("Normal", Normal);
 	bind_attribute("Color", Color);
 	bind_attribute("TexCoord", TexCoord);
+	bind_attribute("BoneIndices", BoneIndices);
+	bind_attribute("BoneWeights", BoneWeights);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	//Try to bind per-instance attributes (matrices take one location per column):
+	if (instance_buffer != 0) {
+		InstanceBinding &binding = instance_bindings()[vao];
+		binding = InstanceBinding(); //(in case 'vao' is the name of a since-deleted vertex array)
+		binding.instance_buffer = instance_buffer;
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+		auto bind_instance_attribute = [&](char const *name, GLint columns, GLint rows, size_t offset) {
+			GLint location = glGetAttribLocation(program, name);
+			if (location == -1) return;
+			for (GLint c = 0; c < columns; ++c) {
+				glVertexAttribPointer(location + c, rows, GL_FLOAT, GL_FALSE, sizeof(MeshInstance), (GLbyte *)0 + offset + c * rows * sizeof(float));
+				glEnableVertexAttribArray(location + c);
+				glVertexAttribDivisor(location + c, 1);
+				binding.columns.emplace_back(InstanceBinding::Column{GLuint(location + c), rows, offset + c * rows * sizeof(float)});
+			}
+			bound.insert(location);
+		};
+		bind_instance_attribute("OBJECT_TO_CLIP", 4, 4, offsetof(MeshInstance, OBJECT_TO_CLIP));
+		bind_instance_attribute("OBJECT_TO_LIGHT", 4, 3, offsetof(MeshInstance, OBJECT_TO_LIGHT));
+		bind_instance_attribute("NORMAL_TO_LIGHT", 3, 3, offsetof(MeshInstance, NORMAL_TO_LIGHT));
+		bind_instance_attribute("TEXTURE_LAYER", 1, 1, offsetof(MeshInstance, TEXTURE_LAYER));
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 	glBindVertexArray(0);
 
 	//Check that all active attributes were bound:
@@ -148,3 +348,18 @@ GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
 
 	return vao;
 }
+
+void MeshBuffer::set_first_instance(GLuint vao, uint32_t first) {
+	auto f = instance_bindings().find(vao);
+	assert(f != instance_bindings().end() && "vertex array should have been made with an instance buffer.");
+	if (f == instance_bindings().end()) return;
+	InstanceBinding &binding = f->second;
+	if (binding.first == first) return;
+
+	glBindBuffer(GL_ARRAY_BUFFER, binding.instance_buffer);
+	for (InstanceBinding::Column const &column : binding.columns) {
+		glVertexAttribPointer(column.location, column.rows, GL_FLOAT, GL_FALSE, sizeof(MeshInstance), (GLbyte *)0 + size_t(first) * sizeof(MeshInstance) + column.offset);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	binding.first = first;
+}
@@ -10,8 +10,11 @@
  */
 
 #include "GL.hpp"
+#include "BVH.hpp"
 #include <glm/glm.hpp>
 #include <map>
+#include <memory>
+#include <vector>
 #include <limits>
 #include <string>
 
@@ -27,26 +30,93 @@ struct Mesh {
 	//useful for debug visualization and (perhaps, eventually) collision detection:
 	glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
 	glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+
+	//Simplified versions of this mesh, for drawing when it is small on screen (see Scene::level_of_detail):
+	// lods[0] is level 1 and each level has about half the triangles of the one before.
+	// (MeshBuffer fills these from the '<name>:lod<level>' meshes written by export-meshes.py)
+	struct LOD {
+		GLuint start = 0; //index of first vertex
+		GLuint count = 0; //count of vertices
+	};
+	std::vector< LOD > lods;
+
+	//For ray casts against triangle meshes (set up by MeshBuffer):
+	glm::vec3 const *positions = nullptr; //CPU copy of vertex positions [start, start+count) (owned by the MeshBuffer)
+	std::shared_ptr< BVH const > triangles; //BVH over triangles (item i is vertices 3i, 3i+1, 3i+2)
+
+	//For skinned meshes (set up by MeshBuffer from the skin chunks written by export-meshes.py; see Skinning):
+	// vertices are moved by the transforms named by these bones, as weighted by MeshBuffer::skin
+	struct Bone {
+		std::string name; //name (or path) of the transform that moves the bone
+		glm::mat4x3 mesh_to_bone = glm::mat4x3(1.0f); //takes the mesh's vertices into the bone's space, as posed when exported
+	};
+	std::vector< Bone > bones;
+
+	//nearest triangle hit by ray origin + t * direction with 0 <= t <= *max_t (in object space):
+	// on hit, sets *max_t and *triangle and returns true
+	bool raycast(glm::vec3 const &origin, glm::vec3 const &direction, float *max_t, uint32_t *triangle = nullptr) const;
+};
+
+//Per-instance attributes for instanced drawing (see Scene::draw):
+// shaders that declare these as 'in' variables read one value per instance
+struct MeshInstance {
+	glm::mat4 OBJECT_TO_CLIP;
+	glm::mat4x3 OBJECT_TO_LIGHT;
+	glm::mat3 NORMAL_TO_LIGHT;
+	float TEXTURE_LAYER; //layer of the material's array textures (see Scene::Drawable::Pipeline::texture_layer)
 };
+static_assert(sizeof(MeshInstance) == 4*16 + 4*12 + 4*9 + 4, "MeshInstance is packed.");
+
+//Bone influences on a vertex of a skinned mesh (see Mesh::bones):
+// weights are out of 255; if they sum to less than that, the rest of the vertex stays where it is
+struct SkinWeights {
+	glm::u8vec4 bones; //indices in the mesh's bones
+	glm::u8vec4 weights;
+};
+static_assert(sizeof(SkinWeights) == 8, "SkinWeights is packed.");
 
 struct MeshBuffer {
 	//construct from a file:
 	// note: will throw if file fails to read.
-	MeshBuffer(std::string const &filename);
+	// if upload_now is false, nothing touches OpenGL (so this can run on a loading thread)
+	//  and upload() must be called on the GL thread before the buffer is used.
+	MeshBuffer(std::string const &filename, bool upload_now = true);
+
+	//construct an empty buffer, for code that fills in meshes, positions, attribs, and pending_upload itself (e.g., StaticBatch):
+	MeshBuffer() = default;
+
+	//copy the vertex data read by the constructor into 'buffer' (does nothing if already uploaded):
+	void upload();
 
 	//look up a particular mesh by name:
 	// note: will throw if mesh not found.
 	const Mesh &lookup(std::string const &name) const;
 	
 	//build a vertex array object that links this vbo to attributes to a program:
+	// if instance_buffer is given, MeshInstance attributes are also bound (one per instance) from that buffer
 	// note: will throw if program defines attributes not contained in this buffer
-	GLuint make_vao_for_program(GLuint program) const;
+	GLuint make_vao_for_program(GLuint program, GLuint instance_buffer = 0) const;
+
+	//point the MeshInstance attributes of 'vao' (which must be bound, and made by make_vao_for_program with an instance buffer)
+	// at the instances starting 'first' MeshInstances into its instance buffer:
+	// (this lets several instanced draws share one upload without GL 4.2's base instance; does nothing if already there)
+	static void set_first_instance(GLuint vao, uint32_t first);
 
 	//This is the OpenGL vertex buffer object containing the mesh data:
 	GLuint buffer = 0;
 
+	//..and a CPU-side copy of the vertex positions (used by Mesh::raycast):
+	std::vector< glm::vec3 > positions;
+
+	//..and, if the file has skin data, bone weights for every vertex (used by Skinning):
+	// (they are also stored in 'buffer', after the vertices, as the BoneIndices and BoneWeights attributes)
+	std::vector< SkinWeights > skin;
+
 	//-- internals ---
 
+	//vertex data waiting for upload():
+	std::vector< uint8_t > pending_upload;
+
 	//used by the lookup() function:
 	std::map< std::string, Mesh > meshes;
 
@@ -67,4 +137,6 @@ struct MeshBuffer {
 	Attrib Normal;
 	Attrib Color;
 	Attrib TexCoord;
+	Attrib BoneIndices; //(bound as floats, not integers)
+	Attrib BoneWeights;
 };
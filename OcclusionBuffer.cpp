@@ -0,0 +1,252 @@
+#include "OcclusionBuffer.hpp"
+
+#include "Affine.hpp"
+#include "parallel_for.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_USE_SSE
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+//rows are rasterized in bands of this many, one band per parallel_for piece:
+static constexpr uint32_t BandHeight = 16;
+
+OcclusionBuffer::OcclusionBuffer(uint32_t width_, uint32_t height_) : width((std::max(width_, 4U) + 3) / 4 * 4), height(std::max(height_, 1U)) {
+}
+
+void OcclusionBuffer::clear(glm::mat4 const &world_to_clip_) {
+	world_to_clip = world_to_clip_;
+	occluders.clear();
+
+	//(pyramid is allocated on first use, so unused buffers stay small)
+	if (levels.empty()) {
+		uint32_t w = width, h = height;
+		while (true) {
+			levels.emplace_back();
+			levels.back().width = w;
+			levels.back().height = h;
+			levels.back().depth.assign(w * h, std::numeric_limits< float >::infinity());
+			if (w == 1 && h == 1) break;
+			w = (w + 1) / 2;
+			h = (h + 1) / 2;
+		}
+	}
+}
+
+void OcclusionBuffer::add_occluder(glm::mat4x3 const &object_to_world, uint32_t vertex_count, glm::vec3 const *positions) {
+	if (vertex_count < 3 || !positions) return;
+	occluders.emplace_back();
+	occluders.back().object_to_clip = Affine::compose(world_to_clip, object_to_world);
+	occluders.back().vertex_count = vertex_count;
+	occluders.back().positions = positions;
+}
+
+//add the triangle (a,b,c) -- already divided by w -- to 'out' if it covers any pixel centers:
+static void add_screen_triangle(glm::vec3 a, glm::vec3 b, glm::vec3 c, uint32_t width, uint32_t height,
+	std::vector< OcclusionBuffer::ScreenTriangle > *out) {
+	//ndc to pixels (and depth to [0,1]):
+	glm::vec3 scale = glm::vec3(0.5f * width, 0.5f * height, 0.5f);
+	a = (a + 1.0f) * scale;
+	b = (b + 1.0f) * scale;
+	c = (c + 1.0f) * scale;
+
+	//pixel x is covered if its center (x + 0.5) is in [min, max]:
+	float min_x = std::min(a.x, std::min(b.x, c.x)), max_x = std::max(a.x, std::max(b.x, c.x));
+	float min_y = std::min(a.y, std::min(b.y, c.y)), max_y = std::max(a.y, std::max(b.y, c.y));
+	OcclusionBuffer::ScreenTriangle tri;
+	tri.min_x = int32_t(std::max(0.0f, std::ceil(min_x - 0.5f)));
+	tri.max_x = int32_t(std::min(float(width) - 1.0f, std::floor(max_x - 0.5f)));
+	tri.min_y = int32_t(std::max(0.0f, std::ceil(min_y - 0.5f)));
+	tri.max_y = int32_t(std::min(float(height) - 1.0f, std::floor(max_y - 0.5f)));
+	if (tri.min_x > tri.max_x || tri.min_y > tri.max_y) return;
+
+	//counterclockwise order (triangles are drawn from both sides):
+	float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	if (!(area != 0.0f)) return;
+	if (area < 0.0f) std::swap(b, c);
+	tri.a = a; tri.b = b; tri.c = c;
+	out->emplace_back(tri);
+}
+
+void OcclusionBuffer::build() {
+	//---- set up triangles (one occluder per piece) ----
+	screen_triangles.resize(occluders.size());
+	parallel_for(uint32_t(occluders.size()), 1, [this](uint32_t begin, uint32_t end) {
+		for (uint32_t o = begin; o < end; ++o) {
+			Occluder const &occluder = occluders[o];
+			std::vector< ScreenTriangle > &out = screen_triangles[o];
+			out.clear();
+			for (uint32_t v = 0; v + 3 <= occluder.vertex_count; v += 3) {
+				glm::vec4 clip[3];
+				uint32_t behind = 0;
+				for (uint32_t i = 0; i < 3; ++i) {
+					clip[i] = occluder.object_to_clip * glm::vec4(occluder.positions[v + i], 1.0f);
+					if (clip[i].z + clip[i].w < 0.0f) behind += 1;
+				}
+				if (behind == 3) continue;
+				if (behind == 0) {
+					add_screen_triangle(glm::vec3(clip[0]) / clip[0].w, glm::vec3(clip[1]) / clip[1].w, glm::vec3(clip[2]) / clip[2].w, width, height, &out);
+					continue;
+				}
+				//clip against the near plane (z + w >= 0), giving a triangle or a quad:
+				glm::vec3 poly[4];
+				uint32_t corners = 0;
+				for (uint32_t i = 0; i < 3; ++i) {
+					glm::vec4 const &p = clip[i];
+					glm::vec4 const &q = clip[(i + 1) % 3];
+					float dp = p.z + p.w, dq = q.z + q.w;
+					if (dp >= 0.0f) poly[corners++] = glm::vec3(p) / p.w;
+					if ((dp >= 0.0f) != (dq >= 0.0f)) {
+						glm::vec4 r = p + (dp / (dp - dq)) * (q - p);
+						poly[corners++] = glm::vec3(r) / r.w;
+					}
+				}
+				for (uint32_t i = 2; i < corners; ++i) {
+					add_screen_triangle(poly[0], poly[i-1], poly[i], width, height, &out);
+				}
+			}
+		}
+	});
+
+	//---- rasterize (one band of rows per piece) ----
+	Level &base = levels[0];
+	uint32_t bands = (height + BandHeight - 1) / BandHeight;
+	parallel_for(bands, 1, [this, &base](uint32_t begin, uint32_t end) {
+		for (uint32_t band = begin; band < end; ++band) {
+			int32_t band_min_y = int32_t(band * BandHeight);
+			int32_t band_max_y = int32_t(std::min(height, (band + 1) * BandHeight)) - 1;
+			std::fill(base.depth.begin() + band_min_y * width, base.depth.begin() + (band_max_y + 1) * width, std::numeric_limits< float >::infinity());
+
+			for (auto const &list : screen_triangles) {
+				for (ScreenTriangle const &tri : list) {
+					if (tri.max_y < band_min_y || tri.min_y > band_max_y) continue;
+					glm::vec3 const &a = tri.a, &b = tri.b, &c = tri.c;
+
+					//edge functions E(x,y) = A * x + B * y + C, positive inside; E0 is zero on edge bc, etc:
+					float A0 = b.y - c.y, B0 = c.x - b.x, C0 = -A0 * b.x - B0 * b.y;
+					float A1 = c.y - a.y, B1 = a.x - c.x, C1 = -A1 * c.x - B1 * c.y;
+					float A2 = a.y - b.y, B2 = b.x - a.x, C2 = -A2 * a.x - B2 * a.y;
+					//depth is the barycentric blend of corner depths, which is also linear in x and y:
+					float inv_area = 1.0f / (A0 * a.x + B0 * a.y + C0);
+					float Az = (A0 * a.z + A1 * b.z + A2 * c.z) * inv_area;
+					float Bz = (B0 * a.z + B1 * b.z + B2 * c.z) * inv_area;
+					float Cz = (C0 * a.z + C1 * b.z + C2 * c.z) * inv_area;
+
+					int32_t y0 = std::max(tri.min_y, band_min_y), y1 = std::min(tri.max_y, band_max_y);
+					int32_t x0 = tri.min_x & ~3, x1 = tri.max_x; //(rows are a multiple of four wide)
+					for (int32_t y = y0; y <= y1; ++y) {
+						float py = y + 0.5f;
+						float *row = base.depth.data() + y * width;
+						int32_t x = x0;
+#ifdef OCCLUSION_USE_SSE
+						__m128 step = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+						__m128 zero = _mm_setzero_ps();
+						for (; x <= x1; x += 4) {
+							__m128 px = _mm_add_ps(_mm_set1_ps(float(x)), step);
+							__m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A0), px), _mm_set1_ps(B0 * py + C0));
+							__m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A1), px), _mm_set1_ps(B1 * py + C1));
+							__m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(A2), px), _mm_set1_ps(B2 * py + C2));
+							__m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+							if (_mm_movemask_ps(inside) == 0) continue;
+							__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(Az), px), _mm_set1_ps(Bz * py + Cz));
+							__m128 old = _mm_loadu_ps(row + x);
+							__m128 nearer = _mm_min_ps(old, z);
+							_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+						}
+#endif
+						for (; x <= x1; ++x) {
+							float px = x + 0.5f;
+							if (A0 * px + B0 * py + C0 < 0.0f) continue;
+							if (A1 * px + B1 * py + C1 < 0.0f) continue;
+							if (A2 * px + B2 * py + C2 < 0.0f) continue;
+							row[x] = std::min(row[x], Az * px + Bz * py + Cz);
+						}
+					}
+				}
+			}
+		}
+	});
+
+	//---- build pyramid (each texel keeps the farthest of the texels below it) ----
+	for (uint32_t l = 1; l < levels.size(); ++l) {
+		Level const &below = levels[l-1];
+		Level &level = levels[l];
+		for (uint32_t y = 0; y < level.height; ++y) {
+			uint32_t by0 = 2 * y, by1 = std::min(2 * y + 1, below.height - 1);
+			for (uint32_t x = 0; x < level.width; ++x) {
+				uint32_t bx0 = 2 * x, bx1 = std::min(2 * x + 1, below.width - 1);
+				level.depth[y * level.width + x] = std::max(
+					std::max(below.depth[by0 * below.width + bx0], below.depth[by0 * below.width + bx1]),
+					std::max(below.depth[by1 * below.width + bx0], below.depth[by1 * below.width + bx1])
+				);
+			}
+		}
+	}
+}
+
+uint32_t OcclusionBuffer::test(uint32_t count,
+	float const *center_x, float const *center_y, float const *center_z,
+	float const *extent_x, float const *extent_y, float const *extent_z,
+	uint8_t *visible) const {
+
+	if (occluders.empty()) return 0;
+
+	uint32_t hidden = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (!visible[i]) continue;
+		//boxes without usable bounds are never hidden:
+		if (!(extent_x[i] < 1e30f && extent_y[i] < 1e30f && extent_z[i] < 1e30f)) continue;
+
+		//corners are center +/- each (projected) axis extent:
+		glm::vec4 center = world_to_clip * glm::vec4(center_x[i], center_y[i], center_z[i], 1.0f);
+		glm::vec4 dx = world_to_clip[0] * extent_x[i];
+		glm::vec4 dy = world_to_clip[1] * extent_y[i];
+		glm::vec4 dz = world_to_clip[2] * extent_z[i];
+
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		bool crosses_near = false;
+		for (uint32_t corner = 0; corner < 8; ++corner) {
+			glm::vec4 p = center
+				+ (corner & 1 ? dx : -dx)
+				+ (corner & 2 ? dy : -dy)
+				+ (corner & 4 ? dz : -dz);
+			if (p.z + p.w <= 0.0f || p.w <= 0.0f) {
+				crosses_near = true;
+				break;
+			}
+			glm::vec3 ndc = glm::vec3(p) / p.w;
+			min = glm::min(min, ndc);
+			max = glm::max(max, ndc);
+		}
+		if (crosses_near) continue; //(a box around the camera is never hidden)
+
+		//pixel rectangle covered by the box:
+		int32_t x0 = std::max(0, int32_t(std::floor((min.x + 1.0f) * 0.5f * width)));
+		int32_t x1 = std::min(int32_t(width) - 1, int32_t(std::floor((max.x + 1.0f) * 0.5f * width)));
+		int32_t y0 = std::max(0, int32_t(std::floor((min.y + 1.0f) * 0.5f * height)));
+		int32_t y1 = std::min(int32_t(height) - 1, int32_t(std::floor((max.y + 1.0f) * 0.5f * height)));
+		if (x0 > x1 || y0 > y1) continue; //(off screen -- frustum culling's job)
+		float depth = (min.z + 1.0f) * 0.5f; //nearest point of the box
+
+		//coarsest level where the rectangle spans at most 2x2 texels:
+		uint32_t l = 0;
+		while (l + 1 < levels.size() && ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1)) ++l;
+		Level const &level = levels[l];
+		float farthest = 0.0f;
+		for (int32_t y = (y0 >> l); y <= (y1 >> l); ++y) {
+			for (int32_t x = (x0 >> l); x <= (x1 >> l); ++x) {
+				farthest = std::max(farthest, level.depth[y * level.width + x]);
+			}
+		}
+		if (depth > farthest) {
+			visible[i] = 0;
+			hidden += 1;
+		}
+	}
+	return hidden;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+/*
+ * An OcclusionBuffer is a small depth buffer drawn entirely on the CPU,
+ *  used to skip objects that are hidden behind big occluders.
+ *
+ * Each frame:
+ *  - clear() it with the camera's world-to-clip matrix,
+ *  - add_occluder() a few big, simple meshes,
+ *  - build() to rasterize them and make the hierarchical depth (hi-z) pyramid,
+ *  - test() world-space boxes against the pyramid.
+ *
+ * Rasterization runs in bands of rows on several threads (see parallel_for.hpp),
+ *  and its inner loop handles four pixels at a time with SSE where available (like Frustum).
+ * No OpenGL is involved, so this also works without a window.
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+struct OcclusionBuffer {
+	//(width is rounded up to a multiple of four)
+	OcclusionBuffer(uint32_t width = 256, uint32_t height = 128);
+
+	//start a new frame as seen through world_to_clip (OpenGL clip conventions):
+	// (must be called before anything else)
+	void clear(glm::mat4 const &world_to_clip);
+
+	//queue a triangle-list mesh (vertices 3i, 3i+1, 3i+2 make triangle i) to be drawn by build():
+	// (positions must stay valid until build() returns)
+	void add_occluder(glm::mat4x3 const &object_to_world, uint32_t vertex_count, glm::vec3 const *positions);
+
+	//rasterize queued occluders and build the pyramid:
+	void build();
+
+	//test 'count' world-space boxes, given as arrays of centers and half-extents (as in Frustum::test):
+	// sets visible[i] to 0 for boxes that are completely behind occluders (boxes already at 0 are skipped)
+	// returns the number of boxes that were hidden
+	uint32_t test(uint32_t count,
+		float const *center_x, float const *center_y, float const *center_z,
+		float const *extent_x, float const *extent_y, float const *extent_z,
+		uint8_t *visible) const;
+
+	uint32_t width, height;
+	glm::mat4 world_to_clip = glm::mat4(1.0f);
+
+	//occluders queued since clear():
+	struct Occluder {
+		glm::mat4 object_to_clip;
+		uint32_t vertex_count;
+		glm::vec3 const *positions;
+	};
+	std::vector< Occluder > occluders;
+
+	//occluder triangles after clipping to the near plane, in pixel coordinates
+	// (z is depth, from 0 at the near plane to 1 at the far plane):
+	struct ScreenTriangle {
+		glm::vec3 a, b, c;
+		int32_t min_x, min_y, max_x, max_y; //pixels whose centers might be covered
+	};
+	std::vector< std::vector< ScreenTriangle > > screen_triangles; //one list per occluder
+
+	//levels[0] holds the nearest occluder depth at every pixel (infinity where there are none);
+	// each level after that holds the farthest depth of the (up to) 2x2 texels below it:
+	struct Level {
+		uint32_t width = 0, height = 0;
+		std::vector< float > depth; //row-major, bottom row first
+	};
+	std::vector< Level > levels;
+};
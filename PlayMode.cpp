@@ -14,27 +14,44 @@
 #include <time.h>
 
 GLuint balance_meshes_for_lit_color_texture_program = 0;
+GLuint balance_meshes_for_lit_color_texture_program_instanced = 0;
 Load< MeshBuffer > balance_meshes(LoadTagDefault, []() -> MeshBuffer const* {
 	MeshBuffer const* ret = new MeshBuffer(data_path("balance.pnct"));
-	balance_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
+	balance_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program_clustered->program);
+	balance_meshes_for_lit_color_texture_program_instanced = ret->make_vao_for_program(lit_color_texture_program_clustered_instanced->program, Scene::instance_buffer());
 	return ret;
 	});
 
 Load< Scene > balance_scene(LoadTagDefault, []() -> Scene const* {
-	return new Scene(data_path("balance.scene"), [&](Scene& scene, Scene::Transform* transform, std::string const& mesh_name) {
+	Scene *ret = new Scene(data_path("balance.scene"), [&](Scene& scene, Scene::Transform* transform, std::string const& mesh_name) {
 		Mesh const& mesh = balance_meshes->lookup(mesh_name);
 
 		scene.drawables.emplace_back(transform);
 		Scene::Drawable& drawable = scene.drawables.back();
 
-		drawable.pipeline = lit_color_texture_program_pipeline;
+		drawable.pipeline = lit_color_texture_program_clustered_pipeline;
 
 		drawable.pipeline.vao = balance_meshes_for_lit_color_texture_program;
+		drawable.pipeline.instanced_vao = balance_meshes_for_lit_color_texture_program_instanced;
 		drawable.pipeline.type = mesh.type;
 		drawable.pipeline.start = mesh.start;
 		drawable.pipeline.count = mesh.count;
 
+		drawable.min = mesh.min;
+		drawable.max = mesh.max;
+		drawable.mesh = &mesh;
+
 		});
+
+	//light the scene with its own lights, or a default hemisphere light if it has none:
+	// (added here rather than in PlayMode, since instances must have the same transforms as this scene)
+	if (ret->lights.empty()) {
+		ret->transforms.emplace_back();
+		ret->lights.emplace_back(&ret->transforms.back()); //(pointing down -z)
+		ret->lights.back().type = Scene::Light::Hemisphere;
+		ret->lights.back().energy = glm::vec3(1.0f, 1.0f, 0.95f);
+	}
+	return ret;
 	});
 
 Load< Sound::Sample > chime_sample(LoadTagDefault, []() -> Sound::Sample const* {
@@ -47,11 +64,12 @@ Load< Sound::Sample > chime_sample_high(LoadTagDefault, []() -> Sound::Sample co
 	return new Sound::Sample(data_path("chime_high.wav"));
 	});
 
-PlayMode::PlayMode() : scene(*balance_scene) {
-	for (auto& transform : scene.transforms) {
-		if (transform.name == "board") board = &transform;
-		else if (transform.name == "ball") ball = &transform;
-	}
+PlayMode::PlayMode() {
+	//copy transforms, but share (read-only) drawables with the loaded scene:
+	scene.instance(*balance_scene);
+
+	board = scene.find("board");
+	ball = scene.find("ball");
 
 	if (board == nullptr) throw std::runtime_error("board not found.");
 	if (ball == nullptr) throw std::runtime_error("ball not found.");
@@ -59,6 +77,18 @@ PlayMode::PlayMode() : scene(*balance_scene) {
 	//get pointer to camera for convenience:
 	if (scene.cameras.size() != 1) throw std::runtime_error("Expecting scene to have exactly one camera, but it has " + std::to_string(scene.cameras.size()));
 	camera = &scene.cameras.front();
+
+	//everything update() changes (besides transforms) is captured with each snapshot:
+	snapshots.add(&board_rotation);
+	snapshots.add(&ball_acc);
+	snapshots.add(&ball_vel);
+	snapshots.add(&ball_rot);
+	snapshots.add(&ball_drot);
+	snapshots.add(&old_dist);
+	snapshots.add(&old_norm);
+	snapshots.add(&wind);
+	snapshots.add(&counter);
+	snapshots.add(&wind_counter);
 }
 
 PlayMode::~PlayMode() {
@@ -91,6 +121,11 @@ bool PlayMode::handle_event(SDL_Event const& evt, glm::uvec2 const& window_size)
 			down.pressed = true;
 			return true;
 		}
+		else if (evt.key.keysym.sym == SDLK_BACKSPACE) {
+			rewind.downs += 1;
+			rewind.pressed = true;
+			return true;
+		}
 		else if (evt.key.keysym.sym == SDLK_r) {
 			restart = true;
 			return true;
@@ -117,12 +152,28 @@ bool PlayMode::handle_event(SDL_Event const& evt, glm::uvec2 const& window_size)
 			down.pressed = false;
 			return true;
 		}
+		else if (evt.key.keysym.sym == SDLK_BACKSPACE) {
+			rewind.pressed = false;
+			return true;
+		}
 	}
 
 	return false;
 }
 
 void PlayMode::update(float elapsed) {
+	//while rewind is held, step back one snapshot per update instead of simulating:
+	if (rewind.pressed) {
+		if (snapshots.restore(scene, rewound + 1)) rewound += 1;
+		left.downs = right.downs = up.downs = down.downs = rewind.downs = 0;
+		return;
+	}
+	//..and once it is released, play on from the snapshot that was reached:
+	if (rewound) {
+		snapshots.discard_newer(rewound);
+		rewound = 0;
+	}
+
 	if (restart) {
 		board_rotation = glm::vec3(0.0f, 0.0f, 0.0f);
 		ball->position = glm::vec3(0.0f, 0.0f, 2.0f);
@@ -271,27 +322,23 @@ void PlayMode::update(float elapsed) {
 	ball_rot = ball_drot * ball_rot;
 	ball->rotation = ball_rot;
 
+	//remember this state for rewinding:
+	snapshots.capture(scene);
+
 	//reset button press counters:
 	left.downs = 0;
 	right.downs = 0;
 	up.downs = 0;
 	down.downs = 0;
+	rewind.downs = 0;
 }
 
 void PlayMode::draw(glm::uvec2 const& drawable_size) {
 	//update camera aspect ratio for drawable:
 	camera->aspect = float(drawable_size.x) / float(drawable_size.y);
 
-	//set up light type and position for lit_color_texture_program:
-	// TODO: consider using the Light(s) in the scene to do this
-	glUseProgram(lit_color_texture_program->program);
-	glUniform1i(lit_color_texture_program->LIGHT_TYPE_int, 1);
-	GL_ERRORS();
-	glUniform3fv(lit_color_texture_program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f, -1.0f)));
-	GL_ERRORS();
-	glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.95f)));
-	GL_ERRORS();
-	glUseProgram(0);
+	//sort the scene's lights into clusters for lit_color_texture_program_clustered (and its instanced variant):
+	light_clusters.update(scene, *camera, drawable_size);
 
 	glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
 	glClearDepth(1.0f); //1.0 is actually the default value to clear the depth buffer to, but FYI you can change it.
@@ -1,6 +1,8 @@
 #include "Mode.hpp"
 
 #include "Scene.hpp"
+#include "LightClusters.hpp"
+#include "SceneSnapshots.hpp"
 #include "Sound.hpp"
 
 #include <glm/glm.hpp>
@@ -23,7 +25,7 @@ struct PlayMode : Mode {
 	struct Button {
 		uint8_t downs = 0;
 		uint8_t pressed = 0;
-	} left, right, down, up;
+	} left, right, down, up, rewind;
 
 	//local copy of the game scene (so code can change it during gameplay):
 	Scene scene;
@@ -52,7 +54,14 @@ struct PlayMode : Mode {
 	float counter = 0.0f;
 	float wind_counter = 0.0f;
 
+	//recent states of the scene and the fields above (captured every update), for rewinding:
+	SceneSnapshots snapshots;
+	uint32_t rewound = 0; //snapshots stepped back while rewind is held
+
 	//camera:
 	Scene::Camera* camera = nullptr;
 
+	//lights near each part of the view (updated every draw):
+	LightClusters light_clusters;
+
 };
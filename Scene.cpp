@@ -1,11 +1,22 @@
 #include "Scene.hpp"
 
+#include "Affine.hpp"
+#include "Frustum.hpp"
+#include "MappedFile.hpp"
+#include "parallel_for.hpp"
 #include "gl_errors.hpp"
 #include "read_write_chunk.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/packing.hpp>
 
-#include <fstream>
+#include <istream>
+#include <streambuf>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <chrono>
 
 //-------------------------
 
@@ -60,19 +71,390 @@ glm::mat4x3 Scene::Transform::make_local_to_world() const {
 	if (!parent) {
 		return make_local_to_parent();
 	} else {
-		return parent->make_local_to_world() * glm::mat4(make_local_to_parent()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		return Affine::compose(parent->make_local_to_world(), make_local_to_parent());
 	}
 }
 glm::mat4x3 Scene::Transform::make_world_to_local() const {
 	if (!parent) {
 		return make_parent_to_local();
 	} else {
-		return make_parent_to_local() * glm::mat4(parent->make_world_to_local()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		return Affine::compose(make_parent_to_local(), parent->make_world_to_local());
 	}
 }
 
 //-------------------------
 
+Scene::TransformHandle Scene::handle(Transform const *transform) const {
+	TransformHandle ret;
+	uint32_t index = transforms.index_of(transform);
+	if (index < transforms.size()) {
+		ret.index = index;
+		ret.generation = generation;
+	}
+	return ret;
+}
+
+Scene::Transform *Scene::lookup(TransformHandle const &handle) {
+	if (handle.generation != generation || handle.index >= transforms.size()) return nullptr;
+	return &transforms[handle.index];
+}
+
+Scene::Transform const *Scene::lookup(TransformHandle const &handle) const {
+	if (handle.generation != generation || handle.index >= transforms.size()) return nullptr;
+	return &transforms[handle.index];
+}
+
+//-------------------------
+
+uint32_t Scene::intern(std::string_view str) {
+	if (str.empty()) return 0;
+	uint32_t hash = HashIndex::hash(str);
+	uint32_t id = names.index.find(hash, [&](uint32_t id){ return name(id) == str; });
+	if (id != HashIndex::Empty) return id;
+
+	NameTable::Span span;
+	span.begin = uint32_t(names.chars.size());
+	names.chars.insert(names.chars.end(), str.begin(), str.end());
+	span.end = uint32_t(names.chars.size());
+
+	id = uint32_t(names.spans.size());
+	names.spans.emplace_back(span);
+	names.index.insert(hash, id);
+	return id;
+}
+
+std::string_view Scene::name(uint32_t id) const {
+	if (id >= names.spans.size()) return std::string_view();
+	NameTable::Span const &span = names.spans[id];
+	return std::string_view(names.chars.data() + span.begin, span.end - span.begin);
+}
+
+void Scene::rename(Transform &transform, std::string_view name) {
+	transform.name = intern(name);
+	transform_index.transforms = -1U; //force index rebuild
+}
+
+void Scene::update_transform_index() const {
+	//rebuild only if transforms were added or renamed, or parents have changed:
+	if (transform_index.transforms == transforms.size() && transform_index.hierarchy_serial == hierarchy.serial) return;
+
+	update_hierarchy_indices();
+
+	uint32_t count = transforms.size();
+	transform_index.by_name.clear();
+	transform_index.by_path.clear();
+	transform_index.by_name.reserve(count);
+	transform_index.by_path.reserve(count);
+
+	//path hashes are computed parents-first by continuing the parent's hash with "/name":
+	std::vector< uint32_t > path_hashes(count, HashIndex::HashStart);
+	auto add = [&](uint32_t i) {
+		std::string_view str = name(transforms[i]);
+		uint32_t parent = hierarchy.parents[i];
+		if (parent < count) {
+			path_hashes[i] = HashIndex::hash(str, HashIndex::hash("/", path_hashes[parent]));
+		} else {
+			path_hashes[i] = HashIndex::hash(str);
+		}
+		//(only the first transform with a given name or path goes in the index)
+		uint32_t name_hash = HashIndex::hash(str);
+		if (transform_index.by_name.find(name_hash, [&](uint32_t t){ return transforms[t].name == transforms[i].name; }) == HashIndex::Empty) {
+			transform_index.by_name.insert(name_hash, i);
+		}
+		transform_index.by_path.insert(path_hashes[i], i);
+	};
+	if (hierarchy.order.empty()) {
+		for (uint32_t i = 0; i < count; ++i) {
+			add(i);
+		}
+	} else {
+		for (uint32_t i : hierarchy.order) {
+			add(i);
+		}
+	}
+
+	transform_index.transforms = count;
+	transform_index.hierarchy_serial = hierarchy.serial;
+}
+
+Scene::Transform const *Scene::find(std::string_view name_or_path) const {
+	update_transform_index();
+
+	uint32_t found = HashIndex::Empty;
+	if (name_or_path.find('/') == std::string_view::npos) {
+		found = transform_index.by_name.find(HashIndex::hash(name_or_path), [&](uint32_t t) {
+			return name(transforms[t]) == name_or_path;
+		});
+	} else {
+		//check candidates by walking up their parents, matching path components from the end:
+		found = transform_index.by_path.find(HashIndex::hash(name_or_path), [&](uint32_t t) {
+			std::string_view rest = name_or_path;
+			uint32_t at = t;
+			while (true) {
+				size_t slash = rest.rfind('/');
+				std::string_view last = (slash == std::string_view::npos ? rest : rest.substr(slash + 1));
+				if (name(transforms[at]) != last) return false;
+				uint32_t parent = hierarchy.parents[at];
+				if (slash == std::string_view::npos) return !(parent < transforms.size());
+				if (!(parent < transforms.size())) return false;
+				rest = rest.substr(0, slash);
+				at = parent;
+			}
+		});
+	}
+
+	if (found == HashIndex::Empty) return nullptr;
+	return &transforms[found];
+}
+
+Scene::Transform *Scene::find(std::string_view name_or_path) {
+	return const_cast< Transform * >(static_cast< Scene const & >(*this).find(name_or_path));
+}
+
+void Scene::update_hierarchy_indices() const {
+	uint32_t count = transforms.size();
+
+	//check for added or re-parented transforms:
+	bool rebuild = (hierarchy.parent_pointers.size() != count);
+	if (!rebuild) {
+		uint32_t i = 0;
+		for (auto const &t : transforms) {
+			if (hierarchy.parent_pointers[i] != t.parent) {
+				rebuild = true;
+				break;
+			}
+			++i;
+		}
+	}
+
+	//rebuild parent indices (and, if needed, a parents-before-children update order):
+	if (rebuild) {
+		hierarchy.serial += 1;
+		hierarchy.parent_pointers.clear();
+		hierarchy.parents.clear();
+		hierarchy.order.clear();
+		hierarchy.parent_pointers.reserve(count);
+		hierarchy.parents.reserve(count);
+
+		bool in_order = true;
+		uint32_t i = 0;
+		for (auto const &t : transforms) {
+			uint32_t parent = Hierarchy::Root;
+			if (t.parent) {
+				parent = transforms.index_of(t.parent);
+				if (parent == count) parent = Hierarchy::External;
+				else if (parent >= i) in_order = false;
+			}
+			hierarchy.parent_pointers.emplace_back(t.parent);
+			hierarchy.parents.emplace_back(parent);
+			++i;
+		}
+
+		if (!in_order) {
+			//compute depth of every transform:
+			std::vector< uint32_t > depth(count, -1U);
+			std::vector< uint32_t > chain;
+			uint32_t max_depth = 0;
+			for (uint32_t t = 0; t < count; ++t) {
+				//walk up until reaching a root or a transform with known depth:
+				uint32_t at = t;
+				while (at < count && depth[at] == -1U) {
+					chain.emplace_back(at);
+					if (chain.size() > count) throw std::runtime_error("Scene transform hierarchy contains a cycle.");
+					at = hierarchy.parents[at];
+				}
+				uint32_t d = (at < count ? depth[at] + 1 : 0);
+				while (!chain.empty()) {
+					depth[chain.back()] = d;
+					max_depth = std::max(max_depth, d);
+					d += 1;
+					chain.pop_back();
+				}
+			}
+
+			//counting sort by depth:
+			std::vector< uint32_t > first(max_depth + 2, 0);
+			for (uint32_t t = 0; t < count; ++t) {
+				first[depth[t] + 1] += 1;
+			}
+			for (uint32_t d = 1; d < first.size(); ++d) {
+				first[d] += first[d-1];
+			}
+			hierarchy.order.resize(count);
+			for (uint32_t t = 0; t < count; ++t) {
+				hierarchy.order[first[depth[t]]++] = t;
+			}
+		}
+	}
+
+	//make sure drawable -> transform indices are current:
+	// (shared drawables are attached to the prototype's transforms, which have the same indices as ours)
+	ChunkedArray< Transform > const &drawable_owners = (drawables_from ? drawables_from->transforms : transforms);
+	assert(drawable_owners.size() == count);
+	hierarchy.drawable_transforms.resize(drawables_to_draw().size(), Hierarchy::External);
+	uint32_t d = 0;
+	for (auto const &drawable : drawables_to_draw()) {
+		uint32_t &index = hierarchy.drawable_transforms[d];
+		if (!(index < count && &drawable_owners[index] == drawable.transform)) {
+			index = drawable_owners.index_of(drawable.transform);
+			if (index == count) index = Hierarchy::External;
+		}
+		++d;
+	}
+}
+
+void Scene::update_hierarchy() const {
+	uint32_t count = transforms.size();
+
+	update_hierarchy_indices();
+
+	//compute local matrices in batches, reading straight out of each chunk of transforms:
+	// (local matrices don't depend on each other, so groups of chunks are handled on several threads)
+	hierarchy.local_to_parent.resize(count);
+	parallel_for(count, 8 * 64, [this](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ) {
+			uint32_t run = transforms.run_length(i);
+			Transform const &first = transforms[i];
+			Affine::make_local_to_parent(run, &first.position, &first.rotation, &first.scale, sizeof(Transform), &hierarchy.local_to_parent[i]);
+			i += run;
+		}
+	});
+
+	//compute world matrices:
+	hierarchy.updates += 1;
+	hierarchy.local_to_world.resize(count);
+	auto compute = [this](uint32_t i) {
+		uint32_t parent = hierarchy.parents[i];
+		if (parent == Hierarchy::Root) {
+			hierarchy.local_to_world[i] = hierarchy.local_to_parent[i];
+		} else if (parent == Hierarchy::External) {
+			hierarchy.local_to_world[i] = Affine::compose(hierarchy.parent_pointers[i]->make_local_to_world(), hierarchy.local_to_parent[i]);
+		} else {
+			hierarchy.local_to_world[i] = Affine::compose(hierarchy.local_to_world[parent], hierarchy.local_to_parent[i]);
+		}
+	};
+	if (hierarchy.order.empty()) {
+		for (uint32_t i = 0; i < count; ++i) {
+			compute(i);
+		}
+	} else {
+		for (uint32_t i : hierarchy.order) {
+			compute(i);
+		}
+	}
+}
+
+//-------------------------
+
+void Scene::update_raycast_index() const {
+	//world matrices come from the hierarchy (which draw() keeps up to date):
+	ChunkedArray< Drawable > const &to_draw = drawables_to_draw();
+	if (hierarchy.local_to_world.size() != transforms.size() || hierarchy.drawable_transforms.size() != to_draw.size()) {
+		update_hierarchy();
+	}
+
+	uint32_t count = to_draw.size();
+	bool rebuild = (raycast_index.bvh.items.size() != count);
+	if (!rebuild && raycast_index.hierarchy_updates == hierarchy.updates) return;
+	raycast_index.hierarchy_updates = hierarchy.updates;
+
+	//world-space bounds and inverse matrices for every drawable:
+	raycast_index.mins.resize(count);
+	raycast_index.maxs.resize(count);
+	raycast_index.world_to_object.resize(count);
+	parallel_for(count, 256, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i) {
+			Drawable const &drawable = to_draw[i];
+			glm::vec3 &min = raycast_index.mins[i];
+			glm::vec3 &max = raycast_index.maxs[i];
+			min = glm::vec3( std::numeric_limits< float >::infinity());
+			max = glm::vec3(-std::numeric_limits< float >::infinity());
+
+			glm::vec3 object_min = drawable.min;
+			glm::vec3 object_max = drawable.max;
+			if (!(object_min.x <= object_max.x) && drawable.mesh) {
+				object_min = drawable.mesh->min;
+				object_max = drawable.mesh->max;
+			}
+			if (!(object_min.x <= object_max.x && object_min.y <= object_max.y && object_min.z <= object_max.z)) continue; //no bounds, never hit
+
+			uint32_t transform_index = hierarchy.drawable_transforms[i];
+			glm::mat4x3 object_to_world = (transform_index == Hierarchy::External
+				? drawable.transform->make_local_to_world()
+				: hierarchy.local_to_world[transform_index]);
+			glm::mat3 linear = glm::mat3(object_to_world);
+			if (glm::determinant(linear) == 0.0f) continue; //degenerate (e.g., zero scale), never hit
+
+			glm::vec3 c = 0.5f * (object_max + object_min);
+			glm::vec3 e = 0.5f * (object_max - object_min);
+			glm::vec3 center = object_to_world * glm::vec4(c, 1.0f);
+			glm::vec3 extent = glm::abs(object_to_world[0]) * e.x + glm::abs(object_to_world[1]) * e.y + glm::abs(object_to_world[2]) * e.z;
+			min = center - extent;
+			max = center + extent;
+
+			glm::mat3 inv = glm::inverse(linear);
+			raycast_index.world_to_object[i] = glm::mat4x3(inv[0], inv[1], inv[2], -(inv * object_to_world[3]));
+		}
+	});
+
+	//refit the existing tree if it's still reasonably tight, otherwise rebuild:
+	if (!rebuild) {
+		raycast_index.bvh.refit(raycast_index.mins.data(), raycast_index.maxs.data());
+		if (raycast_index.bvh.root_area() > 2.0f * raycast_index.built_area) rebuild = true;
+	}
+	if (rebuild) {
+		raycast_index.bvh.build(count, raycast_index.mins.data(), raycast_index.maxs.data());
+		raycast_index.built_area = raycast_index.bvh.root_area();
+	}
+}
+
+//ray cast against the raycast_index (which must be up to date):
+static Scene::RayHit raycast_drawables(Scene const &scene, Scene::Ray const &ray) {
+	Scene::RaycastIndex const &index = scene.raycast_index;
+	ChunkedArray< Scene::Drawable > const &to_draw = scene.drawables_to_draw();
+	glm::vec3 inv_direction = 1.0f / ray.direction;
+
+	Scene::RayHit hit;
+	float max_t = ray.max_t;
+	index.bvh.raycast(ray.origin, ray.direction, &max_t, [&](uint32_t d, float *limit) {
+		Scene::Drawable const &drawable = to_draw[d];
+		float t;
+		if (!BVH::hit_box(index.mins[d], index.maxs[d], ray.origin, inv_direction, *limit, &t)) return;
+		if (drawable.mesh && drawable.mesh->triangles) {
+			//test triangles in object space (t is the same there, since the direction isn't normalized):
+			glm::mat4x3 const &world_to_object = index.world_to_object[d];
+			glm::vec3 origin = world_to_object * glm::vec4(ray.origin, 1.0f);
+			glm::vec3 direction = world_to_object * glm::vec4(ray.direction, 0.0f);
+			uint32_t triangle = -1U;
+			t = *limit;
+			if (!drawable.mesh->raycast(origin, direction, &t, &triangle)) return;
+			hit.triangle = triangle;
+		} else {
+			hit.triangle = -1U;
+		}
+		*limit = t;
+		hit.t = t;
+		hit.drawable = d;
+	});
+	return hit;
+}
+
+Scene::RayHit Scene::raycast(Ray const &ray) const {
+	update_raycast_index();
+	return raycast_drawables(*this, ray);
+}
+
+void Scene::raycast(uint32_t count, Ray const *rays, RayHit *hits) const {
+	update_raycast_index();
+	parallel_for(count, 256, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i) {
+			hits[i] = raycast_drawables(*this, rays[i]);
+		}
+	});
+}
+
+//-------------------------
+
 glm::mat4 Scene::Camera::make_projection() const {
 	return glm::infinitePerspective( fovy, aspect, near );
 }
@@ -80,6 +462,37 @@ glm::mat4 Scene::Camera::make_projection() const {
 //-------------------------
 
 
+std::vector< Scene::Material > &Scene::materials() {
+	static std::vector< Material > all(1); //(starts with the default material)
+	return all;
+}
+
+uint32_t Scene::add_material(Material const &material) {
+	materials().emplace_back(material);
+	return uint32_t(materials().size() - 1);
+}
+
+void Scene::Material::apply_uniform_values() const {
+	for (uint32_t i = 0; i < ints.locations.size(); ++i) {
+		glUniform1i(ints.locations[i], ints.values[i]);
+	}
+	for (uint32_t i = 0; i < floats.locations.size(); ++i) {
+		glUniform1f(floats.locations[i], floats.values[i]);
+	}
+	for (uint32_t i = 0; i < vec2s.locations.size(); ++i) {
+		glUniform2fv(vec2s.locations[i], 1, glm::value_ptr(vec2s.values[i]));
+	}
+	for (uint32_t i = 0; i < vec3s.locations.size(); ++i) {
+		glUniform3fv(vec3s.locations[i], 1, glm::value_ptr(vec3s.values[i]));
+	}
+	for (uint32_t i = 0; i < vec4s.locations.size(); ++i) {
+		glUniform4fv(vec4s.locations[i], 1, glm::value_ptr(vec4s.values[i]));
+	}
+	for (uint32_t i = 0; i < mat4s.locations.size(); ++i) {
+		glUniformMatrix4fv(mat4s.locations[i], 1, GL_FALSE, glm::value_ptr(mat4s.values[i]));
+	}
+}
+
 void Scene::draw(Camera const &camera) const {
 	assert(camera.transform);
 	glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(camera.transform->make_world_to_local());
@@ -87,78 +500,629 @@ void Scene::draw(Camera const &camera) const {
 	draw(world_to_clip, world_to_light);
 }
 
+//Sort key for a queued draw; most-significant bits are the most expensive state to change:
+//  [63:52] program | [51:40] vertex array | [39:28] material | [27:16] first vertex | [15:0] depth
+// ..or, with front_to_back, depth comes first:
+//  [63:48] depth | [47:36] program | [35:24] vertex array | [23:12] material | [11:0] first vertex
+// (values are truncated, so collisions only affect order, not correctness)
+// (first vertex is included so that copies of the same mesh end up next to each other for instancing)
+static uint64_t make_draw_key(Scene::Drawable::Pipeline const &pipeline, GLuint start, float depth, bool front_to_back) {
+	//bit patterns of non-negative floats sort in the same order as their values:
+	uint32_t depth_bits = 0;
+	if (depth > 0.0f) std::memcpy(&depth_bits, &depth, sizeof(depth_bits));
+	if (front_to_back) {
+		return (uint64_t(depth_bits >> 16) << 48)
+		     | (uint64_t(pipeline.program & 0xfff) << 36)
+		     | (uint64_t(pipeline.vao & 0xfff) << 24)
+		     | (uint64_t(pipeline.material & 0xfff) << 12)
+		     | uint64_t(start & 0xfff);
+	}
+	return (uint64_t(pipeline.program & 0xfff) << 52)
+	     | (uint64_t(pipeline.vao & 0xfff) << 40)
+	     | (uint64_t(pipeline.material & 0xfff) << 28)
+	     | (uint64_t(start & 0xfff) << 16)
+	     | uint64_t(depth_bits >> 16);
+}
+
+//(truncated) depth part of a sort key, which orders draws the same way as their depths:
+static uint32_t draw_key_depth(uint64_t key, bool front_to_back) {
+	return uint32_t(front_to_back ? (key >> 48) : (key & 0xffff));
+}
+
+//vertex range drawn for a drawable at a level of detail (level 0 is the pipeline's own range):
+static Mesh::LOD lod_range(Scene::Drawable const &drawable, uint8_t lod) {
+	if (lod == 0) return Mesh::LOD{drawable.pipeline.start, drawable.pipeline.count};
+	assert(drawable.mesh && lod <= drawable.mesh->lods.size());
+	return drawable.mesh->lods[lod - 1];
+}
+
+//level of detail for a drawable covering 'size' of the screen height that was last drawn at level 'lod':
+// (stays at 'lod' unless the size is more than 'hysteresis' past the switch point)
+static uint8_t select_lod(float size, uint8_t lod, uint32_t levels, float lod_size, float hysteresis) {
+	auto level_for = [&](float s) -> uint32_t {
+		if (!(s < lod_size)) return 0;
+		if (!(s > 0.0f)) return levels;
+		float level = 1.0f + std::floor(std::log2(lod_size / s));
+		return (level < float(levels) ? uint32_t(level) : levels);
+	};
+	uint32_t finest = level_for(size * (1.0f + hysteresis));
+	uint32_t coarsest = level_for(size / (1.0f + hysteresis));
+	return uint8_t(std::min(std::max(uint32_t(lod), finest), coarsest));
+}
+
+//order of the draw queue (ties broken by drawable index, so the order doesn't depend on how slices were split):
+static bool draw_item_before(Scene::DrawItem const &a, Scene::DrawItem const &b) {
+	if (a.key != b.key) return a.key < b.key;
+	else return a.drawable < b.drawable;
+}
+
+//draw() splits drawables into slices of this many for its parallel phase:
+static constexpr uint32_t DrawSliceSize = 256;
+
+//normals transform by the inverse transpose, but when a matrix is just rotation and uniform scale
+// the matrix itself points normals the same way (shaders re-normalize), so the inverse can be skipped:
+static bool is_rotation_and_uniform_scale(glm::mat4x3 const &object_to_light) {
+	glm::vec3 const &x = object_to_light[0];
+	glm::vec3 const &y = object_to_light[1];
+	glm::vec3 const &z = object_to_light[2];
+	float xx = glm::dot(x,x);
+	float tolerance = 1e-4f * xx;
+	return std::abs(glm::dot(y,y) - xx) <= tolerance
+	    && std::abs(glm::dot(z,z) - xx) <= tolerance
+	    && std::abs(glm::dot(x,y)) <= tolerance
+	    && std::abs(glm::dot(x,z)) <= tolerance
+	    && std::abs(glm::dot(y,z)) <= tolerance
+	    && xx > 0.0f;
+}
+
+//ObjectBlock data is written to a small ring of buffers (one per draw() call),
+// so that filling a buffer doesn't have to wait for draws still reading the previous ones:
+static GLuint next_object_block_buffer() {
+	static GLuint buffers[3] = {0, 0, 0};
+	static uint32_t next = 0;
+	if (buffers[0] == 0) {
+		glGenBuffers(3, buffers);
+	}
+	GLuint ret = buffers[next];
+	next = (next + 1) % 3;
+	return ret;
+}
+
+GLuint Scene::instance_buffer() {
+	static GLuint buffer = 0;
+	if (buffer == 0) {
+		glGenBuffers(1, &buffer);
+	}
+	return buffer;
+}
+
 void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
 
-	//Iterate through all drawables, sending each one to OpenGL:
-	for (auto const &drawable : drawables) {
-		//Reference to drawable's pipeline for convenience:
-		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+	//compute world matrices for all transforms in one pass:
+	update_hierarchy();
 
-		//skip any drawables without a shader program set:
-		if (pipeline.program == 0) continue;
-		//skip any drawables that don't reference any vertex array:
-		if (pipeline.vao == 0) continue;
-		//skip any drawables that don't contain any vertices:
-		if (pipeline.count == 0) continue;
+	//(drawables may be shared with a prototype scene; see instance())
+	ChunkedArray< Drawable > const &to_draw = drawables_to_draw();
 
+	std::vector< Material > const &all_materials = materials();
+	auto get_material = [&all_materials](Drawable::Pipeline const &pipeline) -> Material const & {
+		return all_materials[pipeline.material < all_materials.size() ? pipeline.material : 0];
+	};
 
-		//Set shader program:
-		glUseProgram(pipeline.program);
+	auto get_object_to_world = [this](uint32_t drawable_index, Drawable const &drawable) -> glm::mat4x3 {
+		uint32_t transform_index = hierarchy.drawable_transforms[drawable_index];
+		if (transform_index == Hierarchy::External) return drawable.transform->make_local_to_world();
+		else return hierarchy.local_to_world[transform_index];
+	};
 
-		//Set attribute sources:
-		glBindVertexArray(pipeline.vao);
+	//world-space bounding box (center and half-extent) of a drawable; returns false if its bounds are unknown:
+	auto get_world_box = [&get_object_to_world](uint32_t drawable_index, Drawable const &drawable, glm::vec3 *center, glm::vec3 *extent) -> bool {
+		if (!(drawable.min.x <= drawable.max.x && drawable.min.y <= drawable.max.y && drawable.min.z <= drawable.max.z)) return false;
+		glm::mat4x3 object_to_world = get_object_to_world(drawable_index, drawable);
+		glm::vec3 c = 0.5f * (drawable.max + drawable.min);
+		glm::vec3 e = 0.5f * (drawable.max - drawable.min);
+		*center = object_to_world[0] * c.x + object_to_world[1] * c.y + object_to_world[2] * c.z + object_to_world[3];
+		*extent = glm::abs(object_to_world[0]) * e.x + glm::abs(object_to_world[1]) * e.y + glm::abs(object_to_world[2]) * e.z;
+		return true;
+	};
 
-		//Configure program uniforms:
+	//a world-space length at clip w = 1 covers this much of the screen height:
+	float projection_scale = glm::length(glm::vec3(world_to_clip[0][1], world_to_clip[1][1], world_to_clip[2][1]));
 
-		//the object-to-world matrix is used in all three of these uniforms:
-		assert(drawable.transform); //drawables *must* have a transform
-		glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
+	//fraction of the screen height covered by the bounding sphere of a world-space box:
+	auto get_screen_size = [&world_to_clip, projection_scale](glm::vec3 const &center, glm::vec3 const &extent) -> float {
+		float w = world_to_clip[0][3] * center.x + world_to_clip[1][3] * center.y + world_to_clip[2][3] * center.z + world_to_clip[3][3];
+		return (w > 0.0f ? glm::length(extent) * projection_scale / w : std::numeric_limits< float >::infinity());
+	};
 
-		//OBJECT_TO_CLIP takes vertices from object space to clip space:
-		if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
-			glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
-			glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+	stats = DrawStats();
+
+	uint32_t count = to_draw.size();
+	Frustum frustum(world_to_clip);
+
+	//---- occlusion: draw big occluders into a small CPU depth buffer ----
+	if (occlusion_culling) {
+		auto before = std::chrono::high_resolution_clock::now();
+		occlusion.clear(world_to_clip);
+		for (uint32_t i = 0; i < count; ++i) {
+			Drawable const &drawable = to_draw[i];
+			if (!drawable.occluder || !drawable.occluder->positions || drawable.occluder->type != GL_TRIANGLES) continue;
+			glm::vec3 center, extent;
+			if (!get_world_box(i, drawable, &center, &extent)) continue;
+			if (get_screen_size(center, extent) < occluder_size) continue;
+			uint8_t visible = 1;
+			frustum.test(1, &center.x, &center.y, &center.z, &extent.x, &extent.y, &extent.z, &visible);
+			if (!visible) continue;
+			occlusion.add_occluder(get_object_to_world(i, drawable), drawable.occluder->count, drawable.occluder->positions);
 		}
+		occlusion.build();
+		stats.occluders = uint32_t(occlusion.occluders.size());
+		stats.occlusion_ms = std::chrono::duration< float, std::milli >(std::chrono::high_resolution_clock::now() - before).count();
+	}
 
-		//the object-to-light matrix is used in the next two uniforms:
-		glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
+	//---- parallel phase: matrices, culling, and sort keys (no OpenGL calls here) ----
 
-		//OBJECT_TO_CLIP takes vertices from object space to light space:
-		if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
-			glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+	culling.visible.assign(count, 1);
+	if (frustum_culling || occlusion_culling) {
+		culling.center_x.resize(count); culling.center_y.resize(count); culling.center_z.resize(count);
+		culling.extent_x.resize(count); culling.extent_y.resize(count); culling.extent_z.resize(count);
+	}
+
+	//levels of detail are kept from the previous draw (new drawables start at full detail):
+	draw_lods.resize(count, 0);
+
+	draw_slices.resize((count + DrawSliceSize - 1) / DrawSliceSize);
+	parallel_for(count, DrawSliceSize, [&](uint32_t begin, uint32_t end) {
+		DrawSlice &slice = draw_slices[begin / DrawSliceSize];
+		slice.queue.clear();
+		slice.culled = 0;
+		slice.occluded = 0;
+
+		//compute world-space bounding boxes and test them against the view frustum (and occluders):
+		if (frustum_culling || occlusion_culling) {
+			for (uint32_t i = begin; i < end; ++i) {
+				Drawable const &drawable = to_draw[i];
+				glm::vec3 center, extent;
+				if (!get_world_box(i, drawable, &center, &extent)) {
+					//no bounds, so make sure the box is always visible:
+					center = glm::vec3(0.0f);
+					extent = glm::vec3(std::numeric_limits< float >::max());
+				}
+				culling.center_x[i] = center.x; culling.center_y[i] = center.y; culling.center_z[i] = center.z;
+				culling.extent_x[i] = extent.x; culling.extent_y[i] = extent.y; culling.extent_z[i] = extent.z;
+			}
+
+			if (frustum_culling) {
+				frustum.test(end - begin,
+					&culling.center_x[begin], &culling.center_y[begin], &culling.center_z[begin],
+					&culling.extent_x[begin], &culling.extent_y[begin], &culling.extent_z[begin],
+					&culling.visible[begin]
+				);
+			}
+			if (occlusion_culling) {
+				slice.occluded = occlusion.test(end - begin,
+					&culling.center_x[begin], &culling.center_y[begin], &culling.center_z[begin],
+					&culling.extent_x[begin], &culling.extent_y[begin], &culling.extent_z[begin],
+					&culling.visible[begin]
+				);
+			}
 		}
 
-		//NORMAL_TO_CLIP takes normals from object space to light space:
-		if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
-			glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
-			glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+		//queue visible drawables, keyed by the pipeline state they need:
+		for (uint32_t i = begin; i < end; ++i) {
+			Drawable const &drawable = to_draw[i];
+
+			//Reference to drawable's pipeline for convenience:
+			Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+
+			//skip any drawables without a shader program set:
+			if (pipeline.program == 0) continue;
+			//skip any drawables that don't reference any vertex array:
+			if (pipeline.vao == 0) continue;
+			//skip any drawables that don't contain any vertices:
+			if (pipeline.count == 0) continue;
+
+			//skip any drawables outside the view frustum (or behind occluders):
+			if (!culling.visible[i]) {
+				slice.culled += 1;
+				continue;
+			}
+
+			//view depth (clip w) of the drawable's origin, used to order draws that share state:
+			glm::vec3 origin = get_object_to_world(i, drawable)[3];
+			float depth = world_to_clip[0][3] * origin.x + world_to_clip[1][3] * origin.y + world_to_clip[2][3] * origin.z + world_to_clip[3][3];
+
+			//pick a level of detail from the size of the drawable's bounding sphere on screen:
+			uint8_t &lod = draw_lods[i];
+			glm::vec3 center, extent;
+			if (level_of_detail && drawable.mesh && !drawable.mesh->lods.empty() && get_world_box(i, drawable, &center, &extent)) {
+				lod = select_lod(get_screen_size(center, extent), lod, uint32_t(drawable.mesh->lods.size()), lod_size, lod_hysteresis);
+			} else {
+				lod = 0;
+			}
+
+			slice.queue.emplace_back();
+			slice.queue.back().key = make_draw_key(pipeline, lod_range(drawable, lod).start, depth, front_to_back);
+			slice.queue.back().drawable = i;
 		}
 
-		//set any requested custom uniforms:
-		if (pipeline.set_uniforms) pipeline.set_uniforms();
+		std::sort(slice.queue.begin(), slice.queue.end(), draw_item_before);
+	});
+
+	//gather the sorted slices into one queue:
+	draw_queue.clear();
+	std::vector< uint32_t > runs; //start of each sorted run in draw_queue, plus the end
+	for (DrawSlice const &slice : draw_slices) {
+		runs.emplace_back(uint32_t(draw_queue.size()));
+		draw_queue.insert(draw_queue.end(), slice.queue.begin(), slice.queue.end());
+		stats.culled += slice.culled;
+		stats.occluded += slice.occluded;
+	}
+	runs.emplace_back(uint32_t(draw_queue.size()));
+
+	//..and merge neighboring runs (in parallel) until the whole queue is sorted:
+	for (uint32_t width = 1; width + 1 < runs.size(); width *= 2) {
+		uint32_t run_count = uint32_t(runs.size()) - 1;
+		uint32_t pairs = (run_count + 2 * width - 1) / (2 * width);
+		parallel_for(pairs, 1, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t p = begin; p < end; ++p) {
+				uint32_t first = runs[std::min(run_count, 2 * p * width)];
+				uint32_t middle = runs[std::min(run_count, (2 * p + 1) * width)];
+				uint32_t last = runs[std::min(run_count, (2 * p + 2) * width)];
+				std::inplace_merge(draw_queue.begin() + first, draw_queue.begin() + middle, draw_queue.begin() + last, draw_item_before);
+			}
+		});
+	}
+
+	//Track current OpenGL state so that only changes need to be sent:
+	GLuint current_program = 0;
+	GLuint current_vao = 0;
+	uint32_t current_material = -1U;
+	GLuint current_material_program = 0; //program that current_material's uniform values were set on
+	GLenum current_unit = GL_TEXTURE0;
+	Material::TextureInfo current_textures[Material::TextureCount];
+	glActiveTexture(GL_TEXTURE0);
+
+	auto set_program = [&](GLuint program) {
+		if (program != current_program) {
+			glUseProgram(program);
+			current_program = program;
+			stats.program_binds += 1;
+		}
+	};
+
+	auto set_vao = [&](GLuint vao) {
+		if (vao != current_vao) {
+			glBindVertexArray(vao);
+			current_vao = vao;
+			stats.vertex_array_binds += 1;
+		}
+	};
 
-		//set up textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, pipeline.textures[i].texture);
+	// (units this material doesn't use are cleared, matching the old bind/draw/unbind behavior)
+	auto set_textures = [&](Material const &material) {
+		for (uint32_t i = 0; i < Material::TextureCount; ++i) {
+			Material::TextureInfo const &want = material.textures[i];
+			Material::TextureInfo &have = current_textures[i];
+			if (want.texture == have.texture && (want.texture == 0 || want.target == have.target)) continue;
+			if (current_unit != GL_TEXTURE0 + i) {
+				current_unit = GL_TEXTURE0 + i;
+				glActiveTexture(current_unit);
 			}
+			if (want.texture != 0) {
+				if (have.texture != 0 && have.target != want.target) {
+					glBindTexture(have.target, 0);
+				}
+				glBindTexture(want.target, want.texture);
+				have = want;
+			} else {
+				glBindTexture(have.target, 0);
+				have.texture = 0;
+			}
+			stats.texture_binds += 1;
 		}
+	};
 
-		//draw the object:
-		glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+	//textures and uniform values only need to be sent when the material (or program) changes:
+	auto set_material = [&](uint32_t index, Material const &material) {
+		if (index == current_material && current_program == current_material_program) return;
+		set_textures(material);
+		material.apply_uniform_values();
+		current_material = index;
+		current_material_program = current_program;
+		stats.material_changes += 1;
+	};
+
+	//can drawables 'a' and 'b' (indices in to_draw) be drawn as instances of one draw?
+	auto same_instanced_draw = [&to_draw,this](uint32_t a, uint32_t b) {
+		Drawable::Pipeline const &pa = to_draw[a].pipeline;
+		Drawable::Pipeline const &pb = to_draw[b].pipeline;
+		Mesh::LOD ra = lod_range(to_draw[a], draw_lods[a]);
+		Mesh::LOD rb = lod_range(to_draw[b], draw_lods[b]);
+		return pa.material == pb.material && pa.instanced_vao == pb.instanced_vao
+		    && pa.type == pb.type && ra.start == rb.start && ra.count == rb.count;
+	};
+
+	//Group the queue into batches; a run of drawables that can share an instanced draw becomes one batch:
+	draw_batches.clear();
+	for (uint32_t q = 0; q < draw_queue.size(); /* later */) {
+		Drawable::Pipeline const &pipeline = to_draw[draw_queue[q].drawable].pipeline;
+		Material const &material = get_material(pipeline);
+		uint32_t q_end = q + 1;
+		if (instancing && material.instanced_program != 0 && pipeline.instanced_vao != 0 && !material.has_uniform_values()) {
+			while (q_end < draw_queue.size()
+			 && same_instanced_draw(draw_queue[q].drawable, draw_queue[q_end].drawable)) {
+				++q_end;
+			}
+		}
+		draw_batches.emplace_back();
+		draw_batches.back().begin = q;
+		draw_batches.back().end = q_end;
+		q = q_end;
+	}
+
+	//Lay out uniform blocks for all single draws, so that they can be filled in parallel and uploaded together:
+	static GLint block_alignment = 0;
+	if (block_alignment == 0) {
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &block_alignment);
+		if (block_alignment <= 0) block_alignment = 256;
+	}
+	size_t block_stride = (sizeof(ObjectBlock) + block_alignment - 1) / block_alignment * block_alignment;
+
+	//(the depth pre-pass's programs always read the block, even if the material's own program doesn't)
+	size_t block_bytes = 0;
+	for (DrawBatch &batch : draw_batches) {
+		if (batch.end - batch.begin != 1) continue;
+		Material const &material = get_material(to_draw[draw_queue[batch.begin].drawable].pipeline);
+		if (!(material.object_uniform_block || (depth_prepass && material.depth_program != 0))) continue;
+		batch.object_block_offset = uint32_t(block_bytes);
+		block_bytes += block_stride;
+	}
+	object_blocks.resize(block_bytes);
+
+	//---- parallel phase: per-draw matrices (and uniform blocks) ----
+	draw_matrices.resize(draw_queue.size());
+	parallel_for(uint32_t(draw_batches.size()), 64, [&](uint32_t begin, uint32_t end) {
+		//(batches cover draw_queue in order, so this piece's draws are contiguous)
+		uint32_t q_begin = draw_batches[begin].begin;
+		uint32_t q_end = draw_batches[end - 1].end;
+
+		for (uint32_t q = q_begin; q < q_end; ++q) {
+			uint32_t index = draw_queue[q].drawable;
+			Drawable const &drawable = to_draw[index];
+			assert(drawable.transform); //drawables *must* have a transform
+			glm::mat4x3 object_to_world = get_object_to_world(index, drawable);
+			MeshInstance &data = draw_matrices[q];
+			data.OBJECT_TO_CLIP = Affine::compose(world_to_clip, object_to_world);
+			data.OBJECT_TO_LIGHT = Affine::compose(world_to_light, object_to_world);
+			data.TEXTURE_LAYER = float(drawable.pipeline.texture_layer);
+		}
 
-		//un-bind textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, 0);
+		//normal matrices: gather the ones that need a real inverse and do those in groups (with SSE, four at a time):
+		constexpr uint32_t Group = 64;
+		glm::mat4x3 general[Group];
+		glm::mat3 normals[Group];
+		uint32_t general_q[Group];
+		uint32_t general_count = 0;
+		auto flush_general = [&]() {
+			Affine::make_normal_matrices(general_count, general, normals);
+			for (uint32_t i = 0; i < general_count; ++i) {
+				draw_matrices[general_q[i]].NORMAL_TO_LIGHT = normals[i];
 			}
+			general_count = 0;
+		};
+		for (uint32_t q = q_begin; q < q_end; ++q) {
+			MeshInstance &data = draw_matrices[q];
+			if (is_rotation_and_uniform_scale(data.OBJECT_TO_LIGHT)) {
+				data.NORMAL_TO_LIGHT = glm::mat3(data.OBJECT_TO_LIGHT);
+			} else {
+				general[general_count] = data.OBJECT_TO_LIGHT;
+				general_q[general_count] = q;
+				general_count += 1;
+				if (general_count == Group) flush_general();
+			}
+		}
+		if (general_count != 0) flush_general();
+
+		for (uint32_t b = begin; b < end; ++b) {
+			DrawBatch const &batch = draw_batches[b];
+			if (batch.object_block_offset != -1U) {
+				MeshInstance const &data = draw_matrices[batch.begin];
+				ObjectBlock &block = *reinterpret_cast< ObjectBlock * >(&object_blocks[batch.object_block_offset]);
+				block.OBJECT_TO_CLIP = data.OBJECT_TO_CLIP;
+				for (uint32_t c = 0; c < 4; ++c) {
+					block.OBJECT_TO_LIGHT[c] = glm::vec4(data.OBJECT_TO_LIGHT[c], 0.0f);
+				}
+				for (uint32_t c = 0; c < 3; ++c) {
+					block.NORMAL_TO_LIGHT[c] = glm::vec4(data.NORMAL_TO_LIGHT[c], 0.0f);
+				}
+				block.TEXTURE_LAYER = data.TEXTURE_LAYER;
+			}
+		}
+	});
+
+	//---- serial phase: send everything to OpenGL ----
+
+	GLuint block_buffer = 0;
+	if (!object_blocks.empty()) {
+		block_buffer = next_object_block_buffer();
+		glBindBuffer(GL_UNIFORM_BUFFER, block_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, object_blocks.size(), object_blocks.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	//upload the instance data of every instanced batch once (orphaning the previous contents),
+	// so the depth pre-pass and the shading pass both draw from the same ranges:
+	uint32_t instances = 0;
+	for (DrawBatch &batch : draw_batches) {
+		if (batch.end - batch.begin == 1) continue;
+		batch.first_instance = instances;
+		instances += batch.end - batch.begin;
+	}
+	if (instances != 0) {
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer());
+		glBufferData(GL_ARRAY_BUFFER, instances * sizeof(MeshInstance), nullptr, GL_STREAM_DRAW);
+		for (DrawBatch const &batch : draw_batches) {
+			if (batch.first_instance == -1U) continue;
+			glBufferSubData(GL_ARRAY_BUFFER, batch.first_instance * sizeof(MeshInstance), (batch.end - batch.begin) * sizeof(MeshInstance), &draw_matrices[batch.begin]);
 		}
-		glActiveTexture(GL_TEXTURE0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	//will this batch be drawn in the depth pre-pass?
+	auto in_prepass = [&](DrawBatch const &batch, Material const &material) {
+		if (!depth_prepass) return false;
+		if (batch.end - batch.begin > 1) return material.depth_instanced_program != 0;
+		else return material.depth_program != 0;
+	};
+
+	GLint shading_depth_func = GL_LESS;
+	if (depth_prepass) {
+		//---- depth pre-pass: opaque batches to depth only, nearest first ----
+		glGetIntegerv(GL_DEPTH_FUNC, &shading_depth_func);
+
+		prepass_order.clear();
+		for (uint32_t b = 0; b < draw_batches.size(); ++b) {
+			DrawBatch const &batch = draw_batches[b];
+			if (in_prepass(batch, get_material(to_draw[draw_queue[batch.begin].drawable].pipeline))) {
+				prepass_order.emplace_back(b);
+			}
+		}
+		//(the first item in a batch is its nearest, since items with the same state are sorted by depth)
+		std::stable_sort(prepass_order.begin(), prepass_order.end(), [&](uint32_t a, uint32_t b) {
+			return draw_key_depth(draw_queue[draw_batches[a].begin].key, front_to_back)
+			     < draw_key_depth(draw_queue[draw_batches[b].begin].key, front_to_back);
+		});
+
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		for (uint32_t b : prepass_order) {
+			DrawBatch const &batch = draw_batches[b];
+			Drawable const &drawable = to_draw[draw_queue[batch.begin].drawable];
+			Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+			Mesh::LOD range = lod_range(drawable, draw_lods[draw_queue[batch.begin].drawable]);
+			Material const &material = get_material(pipeline);
+
+			if (batch.end - batch.begin > 1) {
+				set_program(material.depth_instanced_program);
+				set_vao(pipeline.instanced_vao);
+				MeshBuffer::set_first_instance(pipeline.instanced_vao, batch.first_instance);
+				glDrawArraysInstanced(pipeline.type, range.start, range.count, GLsizei(batch.end - batch.begin));
+			} else {
+				set_program(material.depth_program);
+				set_vao(pipeline.vao);
+				glBindBufferRange(GL_UNIFORM_BUFFER, ObjectBlockBinding, block_buffer, batch.object_block_offset, sizeof(ObjectBlock));
+				glDrawArrays(pipeline.type, range.start, range.count);
+			}
+			stats.depth_draw_calls += 1;
+		}
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	}
+
+	//pre-passed batches are shaded only where their depth is already the nearest (and don't need to write depth again):
+	bool current_prepassed = false;
+	auto set_prepassed = [&](bool prepassed) {
+		if (prepassed == current_prepassed) return;
+		glDepthFunc(GLenum(prepassed ? GL_EQUAL : shading_depth_func));
+		glDepthMask(prepassed ? GL_FALSE : GL_TRUE);
+		current_prepassed = prepassed;
+	};
+
+	static GLuint samples_query = 0;
+	if (count_samples) {
+		if (samples_query == 0) glGenQueries(1, &samples_query);
+		glBeginQuery(GL_SAMPLES_PASSED, samples_query);
+	}
+
+	//Send batches to OpenGL:
+	for (DrawBatch const &batch : draw_batches) {
+		Drawable const &drawable = to_draw[draw_queue[batch.begin].drawable];
+		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+		Mesh::LOD range = lod_range(drawable, draw_lods[draw_queue[batch.begin].drawable]);
+		uint32_t material_index = (pipeline.material < all_materials.size() ? pipeline.material : 0);
+		Material const &material = all_materials[material_index];
+
+		if (batch.end - batch.begin > 1) {
+			//--- instanced draw ---
+			uint32_t instance_count = batch.end - batch.begin;
+
+			set_prepassed(in_prepass(batch, material));
+			set_program(material.instanced_program);
+			set_vao(pipeline.instanced_vao);
+			MeshBuffer::set_first_instance(pipeline.instanced_vao, batch.first_instance);
+			set_material(material_index, material);
+
+			glDrawArraysInstanced(pipeline.type, range.start, range.count, GLsizei(instance_count));
+			stats.drawn += instance_count;
+			stats.vertices += range.count * instance_count;
+			stats.draw_calls += 1;
+			stats.instanced_draws += 1;
+			continue;
+		}
+
+		//--- single draw ---
+		MeshInstance const &data = draw_matrices[batch.begin];
+
+		//Set shader program:
+		set_prepassed(in_prepass(batch, material));
+		set_program(pipeline.program);
+
+		//Set attribute sources:
+		set_vao(pipeline.vao);
+
+		//Configure program uniforms:
+		if (material.object_uniform_block) {
+			//matrices were already computed and uploaded; just point the block at them:
+			glBindBufferRange(GL_UNIFORM_BUFFER, ObjectBlockBinding, block_buffer, batch.object_block_offset, sizeof(ObjectBlock));
+		} else {
+			//OBJECT_TO_CLIP takes vertices from object space to clip space:
+			if (material.OBJECT_TO_CLIP_mat4 != -1U) {
+				glUniformMatrix4fv(material.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(data.OBJECT_TO_CLIP));
+			}
+
+			//OBJECT_TO_CLIP takes vertices from object space to light space:
+			if (material.OBJECT_TO_LIGHT_mat4x3 != -1U) {
+				glUniformMatrix4x3fv(material.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(data.OBJECT_TO_LIGHT));
+			}
+
+			//NORMAL_TO_CLIP takes normals from object space to light space:
+			if (material.NORMAL_TO_LIGHT_mat3 != -1U) {
+				glUniformMatrix3fv(material.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(data.NORMAL_TO_LIGHT));
+			}
+
+			//TEXTURE_LAYER picks the layer of the material's array textures:
+			if (material.TEXTURE_LAYER_float != -1U) {
+				glUniform1f(material.TEXTURE_LAYER_float, data.TEXTURE_LAYER);
+			}
+		}
+
+		//set up textures and other uniforms (if the material changed):
+		set_material(material_index, material);
+
+		//draw the object:
+		glDrawArrays(pipeline.type, range.start, range.count);
+		stats.drawn += 1;
+		stats.vertices += range.count;
+		stats.draw_calls += 1;
+	}
+
+	set_prepassed(false);
 
+	if (count_samples) {
+		glEndQuery(GL_SAMPLES_PASSED);
+		GLuint samples = 0;
+		glGetQueryObjectuiv(samples_query, GL_QUERY_RESULT, &samples);
+		stats.shaded_samples = samples;
 	}
 
+	//un-bind textures:
+	for (uint32_t i = 0; i < Material::TextureCount; ++i) {
+		if (current_textures[i].texture != 0) {
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(current_textures[i].target, 0);
+		}
+	}
+	glActiveTexture(GL_TEXTURE0);
+
 	glUseProgram(0);
 	glBindVertexArray(0);
 
@@ -166,14 +1130,36 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 }
 
 
+//rotation stored as the "smallest three" components of a unit quaternion in 48 bits:
+//  [46:45] index of the dropped (largest) component, in x,y,z,w order | [44:30] [29:15] [14:0] the others, in order
+// (each maps 0 .. 32767 to -1/sqrt(2) .. 1/sqrt(2); the dropped component is the positive one that makes the length one)
+static glm::quat unpack_smallest_three(uint16_t const bits[3]) {
+	uint64_t packed = uint64_t(bits[0]) | (uint64_t(bits[1]) << 16) | (uint64_t(bits[2]) << 32);
+	uint32_t largest = uint32_t(packed >> 45) & 3;
+	float c[4];
+	float sum = 0.0f;
+	for (uint32_t i = 0, shift = 30; i < 4; ++i) {
+		if (i == largest) continue;
+		c[i] = (float((packed >> shift) & 0x7fff) / 32767.0f * 2.0f - 1.0f) * 0.70710678f;
+		sum += c[i] * c[i];
+		shift -= 15;
+	}
+	c[largest] = std::sqrt(std::max(0.0f, 1.0f - sum));
+	return glm::quat(c[3], c[0], c[1], c[2]); //(w,x,y,z order)
+}
+
 void Scene::load(std::string const &filename,
 	std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
 
-	std::ifstream file(filename, std::ios::binary);
+	//map the file and use its chunks in place (rather than reading copies of them):
+	MappedFile file(filename);
+	char const *at = file.data;
+	char const *end = file.data + file.size;
 
-	std::vector< char > names;
-	read_chunk(file, "str0", &names);
+	ChunkView< char > names;
+	view_chunk(&at, end, "str0", &names);
 
+	//the hierarchy is stored either at full precision (v0):
 	struct HierarchyEntry {
 		uint32_t parent;
 		uint32_t name_begin;
@@ -183,8 +1169,35 @@ void Scene::load(std::string const &filename,
 		glm::vec3 scale;
 	};
 	static_assert(sizeof(HierarchyEntry) == 4 + 4 + 4 + 4*3 + 4*4 + 4*3, "HierarchyEntry is packed.");
-	std::vector< HierarchyEntry > hierarchy;
-	read_chunk(file, "xfh0", &hierarchy);
+	ChunkView< HierarchyEntry > hierarchy;
+	//..or quantized (v1), with position bounds in a one-entry chunk before the entries:
+	struct HierarchyBounds {
+		glm::vec3 position_min;
+		glm::vec3 position_max;
+	};
+	static_assert(sizeof(HierarchyBounds) == 4*3 + 4*3, "HierarchyBounds is packed.");
+	ChunkView< HierarchyBounds > hierarchy_bounds;
+	struct QuantizedHierarchyEntry {
+		uint16_t parent_delta; //entry index minus parent index (0 for no parent)
+		uint16_t name_begin[2]; //low, high halves
+		uint16_t name_length;
+		uint16_t position[3]; //fixed point, 0 .. 65535 spanning position_min .. position_max
+		uint16_t rotation[3]; //smallest three, see unpack_smallest_three
+		uint16_t scale[3]; //half floats
+	};
+	static_assert(sizeof(QuantizedHierarchyEntry) == 2 * 13, "QuantizedHierarchyEntry is packed.");
+	ChunkView< QuantizedHierarchyEntry > quantized_hierarchy;
+
+	if (peek_chunk_magic(at, end) == "xfq1") {
+		view_chunk(&at, end, "xfq1", &hierarchy_bounds);
+		if (hierarchy_bounds.size != 1) {
+			throw std::runtime_error("scene file '" + filename + "' has " + std::to_string(hierarchy_bounds.size) + " hierarchy bounds entries (expecting one)");
+		}
+		view_chunk(&at, end, "xfh1", &quantized_hierarchy);
+	} else {
+		view_chunk(&at, end, "xfh0", &hierarchy);
+	}
+	size_t hierarchy_size = hierarchy.size + quantized_hierarchy.size;
 
 	struct MeshEntry {
 		uint32_t transform;
@@ -192,8 +1205,8 @@ void Scene::load(std::string const &filename,
 		uint32_t name_end;
 	};
 	static_assert(sizeof(MeshEntry) == 4 + 4 + 4, "MeshEntry is packed.");
-	std::vector< MeshEntry > meshes;
-	read_chunk(file, "msh0", &meshes);
+	ChunkView< MeshEntry > meshes;
+	view_chunk(&at, end, "msh0", &meshes);
 
 	struct CameraEntry {
 		uint32_t transform;
@@ -202,8 +1215,8 @@ void Scene::load(std::string const &filename,
 		float clip_near, clip_far;
 	};
 	static_assert(sizeof(CameraEntry) == 4 + 4 + 4 + 4 + 4, "CameraEntry is packed.");
-	std::vector< CameraEntry > cameras;
-	read_chunk(file, "cam0", &cameras);
+	ChunkView< CameraEntry > cameras;
+	view_chunk(&at, end, "cam0", &cameras);
 
 	struct LightEntry {
 		uint32_t transform;
@@ -214,64 +1227,104 @@ void Scene::load(std::string const &filename,
 		float fov;
 	};
 	static_assert(sizeof(LightEntry) == 4 + 1 + 3 + 4 + 4 + 4, "LightEntry is packed.");
-	std::vector< LightEntry > lights;
-	read_chunk(file, "lmp0", &lights);
+	ChunkView< LightEntry > lights;
+	view_chunk(&at, end, "lmp0", &lights);
 
 
 	//--------------------------------
-	//Now that file is loaded, create transforms for hierarchy entries:
+	//Now that file is mapped, create transforms for hierarchy entries:
+
+	//the string chunk becomes part of the name table, so names can refer to it directly:
+	uint32_t names_base = uint32_t(this->names.chars.size());
+	this->names.chars.insert(this->names.chars.end(), names.bytes, names.bytes + names.size);
+	auto intern_span = [&](uint32_t begin, uint32_t end) -> uint32_t {
+		if (begin == end) return 0;
+		std::string_view str(this->names.chars.data() + names_base + begin, end - begin);
+		uint32_t hash = HashIndex::hash(str);
+		uint32_t id = this->names.index.find(hash, [&](uint32_t id){ return name(id) == str; });
+		if (id != HashIndex::Empty) return id;
+		id = uint32_t(this->names.spans.size());
+		this->names.spans.emplace_back(NameTable::Span{names_base + begin, names_base + end});
+		this->names.index.insert(hash, id);
+		return id;
+	};
 
-	std::vector< Transform * > hierarchy_transforms;
-	hierarchy_transforms.reserve(hierarchy.size());
+	//(transforms never move, and the new ones will be stored at indices first_transform + h)
+	uint32_t first_transform = transforms.size();
+	auto hierarchy_transform = [&](uint32_t h) -> Transform * {
+		return &transforms[first_transform + h];
+	};
 
-	for (auto const &h : hierarchy) {
+	auto add_transform = [&](uint32_t h, uint32_t parent, uint32_t name_begin, uint32_t name_end) -> Transform * {
 		transforms.emplace_back();
 		Transform *t = &transforms.back();
-		if (h.parent != -1U) {
-			if (h.parent >= hierarchy_transforms.size()) {
+		if (parent != -1U) {
+			if (parent >= h) {
 				throw std::runtime_error("scene file '" + filename + "' did not contain transforms in topological-sort order.");
 			}
-			t->parent = hierarchy_transforms[h.parent];
+			t->parent = hierarchy_transform(parent);
 		}
 
-		if (h.name_begin <= h.name_end && h.name_end <= names.size()) {
-			t->name = std::string(names.begin() + h.name_begin, names.begin() + h.name_end);
+		if (name_begin <= name_end && name_end <= names.size) {
+			t->name = intern_span(name_begin, name_end);
 		} else {
 				throw std::runtime_error("scene file '" + filename + "' contains hierarchy entry with invalid name indices");
 		}
+		return t;
+	};
 
-		t->position = h.position;
-		t->rotation = h.rotation;
-		t->scale = h.scale;
+	for (uint32_t h = 0; h < hierarchy.size; ++h) {
+		HierarchyEntry entry = hierarchy[h];
+		Transform *t = add_transform(h, entry.parent, entry.name_begin, entry.name_end);
+		t->position = entry.position;
+		t->rotation = entry.rotation;
+		t->scale = entry.scale;
+	}
 
-		hierarchy_transforms.emplace_back(t);
+	if (quantized_hierarchy.size) {
+		HierarchyBounds bounds = hierarchy_bounds[0];
+		glm::vec3 position_min = bounds.position_min;
+		glm::vec3 position_step = (bounds.position_max - position_min) / 65535.0f;
+		for (uint32_t h = 0; h < quantized_hierarchy.size; ++h) {
+			QuantizedHierarchyEntry entry = quantized_hierarchy[h];
+			uint32_t parent = (entry.parent_delta == 0 ? -1U : h - entry.parent_delta); //(wraps past zero to a too-large index)
+			uint32_t name_begin = uint32_t(entry.name_begin[0]) | (uint32_t(entry.name_begin[1]) << 16);
+			Transform *t = add_transform(h, parent, name_begin, name_begin + entry.name_length);
+			t->position = position_min + glm::vec3(entry.position[0], entry.position[1], entry.position[2]) * position_step;
+			t->rotation = unpack_smallest_three(entry.rotation);
+			t->scale = glm::vec3(
+				glm::unpackHalf1x16(entry.scale[0]),
+				glm::unpackHalf1x16(entry.scale[1]),
+				glm::unpackHalf1x16(entry.scale[2])
+			);
+		}
 	}
-	assert(hierarchy_transforms.size() == hierarchy.size());
 
+	std::string name; //(reused for each mesh name)
 	for (auto const &m : meshes) {
-		if (m.transform >= hierarchy_transforms.size()) {
+		if (m.transform >= hierarchy_size) {
 			throw std::runtime_error("scene file '" + filename + "' contains mesh entry with invalid transform index (" + std::to_string(m.transform) + ")");
 		}
-		if (!(m.name_begin <= m.name_end && m.name_end <= names.size())) {
+		if (!(m.name_begin <= m.name_end && m.name_end <= names.size)) {
 			throw std::runtime_error("scene file '" + filename + "' contains mesh entry with invalid name indices");
 		}
-		std::string name = std::string(names.begin() + m.name_begin, names.begin() + m.name_end);
+		name.assign(names.bytes + m.name_begin, m.name_end - m.name_begin);
 
 		if (on_drawable) {
-			on_drawable(*this, hierarchy_transforms[m.transform], name);
+			on_drawable(*this, hierarchy_transform(m.transform), name);
 		}
 
 	}
 
 	for (auto const &c : cameras) {
-		if (c.transform >= hierarchy_transforms.size()) {
+		if (c.transform >= hierarchy_size) {
 			throw std::runtime_error("scene file '" + filename + "' contains camera entry with invalid transform index (" + std::to_string(c.transform) + ")");
 		}
 		if (std::string(c.type, 4) != "pers") {
 			std::cout << "Ignoring non-perspective camera (" + std::string(c.type, 4) + ") stored in file." << std::endl;
 			continue;
 		}
-		this->cameras.emplace_back(hierarchy_transforms[c.transform]);
+		this->cameras.emplace_back(hierarchy_transform(c.transform));
 		Camera *camera = &this->cameras.back();
 		camera->fovy = c.data / 180.0f * 3.1415926f; //FOV is stored in degrees; convert to radians.
 		camera->near = c.clip_near;
@@ -279,7 +1332,7 @@ void Scene::load(std::string const &filename,
 	}
 
 	for (auto const &l : lights) {
-		if (l.transform >= hierarchy_transforms.size()) {
+		if (l.transform >= hierarchy_size) {
 			throw std::runtime_error("scene file '" + filename + "' contains lamp entry with invalid transform index (" + std::to_string(l.transform) + ")");
 		}
 		if (l.type == 'p') {
@@ -294,7 +1347,7 @@ void Scene::load(std::string const &filename,
 			std::cout << "Ignoring unrecognized lamp type (" + std::string(&l.type, 1) + ") stored in file." << std::endl;
 			continue;
 		}
-		this->lights.emplace_back(hierarchy_transforms[l.transform]);
+		this->lights.emplace_back(hierarchy_transform(l.transform));
 		Light *light = &this->lights.back();
 		light->type = static_cast<Light::Type>(l.type);
 		light->energy = glm::vec3(l.color) / 255.0f * l.energy;
@@ -302,9 +1355,24 @@ void Scene::load(std::string const &filename,
 	}
 
 	//load any extra that a subclass wants:
-	load_extra(file, names, hierarchy_transforms);
+	// (load_extra takes a stream and vectors, so wrap the rest of the mapping and copy the small index arrays)
+	struct MemoryBuffer : std::streambuf {
+		MemoryBuffer(char const *begin, char const *end) {
+			setg(const_cast< char * >(begin), const_cast< char * >(begin), const_cast< char * >(end));
+		}
+	} rest(at, end);
+	std::istream rest_stream(&rest);
+
+	std::vector< char > names_copy(names.bytes, names.bytes + names.size);
+	std::vector< Transform * > hierarchy_transforms;
+	hierarchy_transforms.reserve(hierarchy_size);
+	for (uint32_t h = 0; h < hierarchy_size; ++h) {
+		hierarchy_transforms.emplace_back(hierarchy_transform(h));
+	}
+
+	load_extra(rest_stream, names_copy, hierarchy_transforms);
 
-	if (file.peek() != EOF) {
+	if (rest_stream.peek() != EOF) {
 		std::cerr << "WARNING: trailing data in scene file '" << filename << "'" << std::endl;
 	}
 
@@ -314,7 +1382,16 @@ void Scene::load(std::string const &filename,
 
 //-------------------------
 
-Scene::Scene(std::string const &filename, std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
+//every scene starts with its own generation, so handles from other scenes don't resolve:
+static uint32_t next_generation() {
+	static std::atomic< uint32_t > generation(0);
+	return ++generation;
+}
+
+Scene::Scene() : generation(next_generation()) {
+}
+
+Scene::Scene(std::string const &filename, std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) : generation(next_generation()) {
 	load(filename, on_drawable);
 }
 
@@ -327,51 +1404,106 @@ Scene &Scene::operator=(Scene const &other) {
 	return *this;
 }
 
-void Scene::set(Scene const &other, std::unordered_map< Transform const *, Transform * > *transform_map_) {
+void Scene::set(Scene const &other, std::unordered_map< Transform const *, Transform * > *transform_map) {
+	copy_transforms(other, transform_map);
+
+	//transform pointers in 'other' map to the transform with the same index here:
+	auto remap = [this,&other](Transform *transform) -> Transform * {
+		uint32_t index = other.transforms.index_of(transform);
+		return (index < transforms.size() ? &transforms[index] : transform);
+	};
+
+	//copy other's drawables (or share the same prototype), updating transform pointers:
+	drawables = other.drawables;
+	for (auto &d : drawables) {
+		d.transform = remap(d.transform);
+	}
+	drawables_from = other.drawables_from;
+
+	//copy other's cameras, updating transform pointers:
+	cameras = other.cameras;
+	for (auto &c : cameras) {
+		c.transform = remap(c.transform);
+	}
+
+	//copy other's lights, updating transform pointers:
+	lights = other.lights;
+	for (auto &l : lights) {
+		l.transform = remap(l.transform);
+	}
+}
+
+void Scene::instance(Scene const &prototype) {
+	copy_transforms(prototype, nullptr);
 
-	std::unordered_map< Transform const *, Transform * > t2t_temp;
-	std::unordered_map< Transform const *, Transform * > &transform_to_transform = *(transform_map_ ? transform_map_ : &t2t_temp);
+	//share drawables with the scene that actually owns them:
+	// (the copied hierarchy.drawable_transforms is still valid, since it refers to those same drawables)
+	drawables.clear();
+	drawables_from = (prototype.drawables_from ? prototype.drawables_from : &prototype);
+	assert(drawables_from->transforms.size() == transforms.size());
 
-	transform_to_transform.clear();
+	//cameras and lights are small, so just copy them:
+	cameras = prototype.cameras;
+	for (auto &c : cameras) {
+		uint32_t index = prototype.transforms.index_of(c.transform);
+		if (index < transforms.size()) c.transform = &transforms[index];
+	}
+	lights = prototype.lights;
+	for (auto &l : lights) {
+		uint32_t index = prototype.transforms.index_of(l.transform);
+		if (index < transforms.size()) l.transform = &transforms[index];
+	}
+}
 
-	//null transform maps to itself:
-	transform_to_transform.insert(std::make_pair(nullptr, nullptr));
+void Scene::unshare_drawables() {
+	if (!drawables_from) return;
+	Scene const &owner = *drawables_from;
+	drawables_from = nullptr;
 
-	//Copy transforms and store mapping:
+	drawables = owner.drawables;
+	for (auto &d : drawables) {
+		uint32_t index = owner.transforms.index_of(d.transform);
+		if (index < transforms.size()) d.transform = &transforms[index];
+	}
+}
+
+void Scene::copy_transforms(Scene const &other, std::unordered_map< Transform const *, Transform * > *transform_map) {
+	//other's flattened hierarchy gives parents as indices, so no pointer lookups are needed:
+	other.update_hierarchy_indices();
+
+	//names are ids in the name table, so copy the table as a whole:
+	names = other.names;
+	transform_index = other.transform_index;
+
+	//Copy transforms (in order, so handles from 'other' work here):
 	transforms.clear();
+	generation = other.generation;
 	for (auto const &t : other.transforms) {
 		transforms.emplace_back();
 		transforms.back().name = t.name;
 		transforms.back().position = t.position;
 		transforms.back().rotation = t.rotation;
 		transforms.back().scale = t.scale;
-		transforms.back().parent = t.parent; //will update later
-
-		//store mapping between transforms old and new:
-		auto ret = transform_to_transform.insert(std::make_pair(&t, &transforms.back()));
-		assert(ret.second);
+		transforms.back().is_static = t.is_static;
 	}
 
-	//update transform parents:
-	for (auto &t : transforms) {
-		t.parent = transform_to_transform.at(t.parent);
+	//the flattened hierarchy is index-based, so other's copy is valid here once parent pointers are updated:
+	hierarchy = other.hierarchy;
+	for (uint32_t i = 0; i < transforms.size(); ++i) {
+		uint32_t parent = hierarchy.parents[i];
+		Transform *&to = transforms[i].parent;
+		if (parent == Hierarchy::Root) to = nullptr;
+		else if (parent == Hierarchy::External) to = other.transforms[i].parent; //(parent is outside of both scenes)
+		else to = &transforms[parent];
+		hierarchy.parent_pointers[i] = to;
 	}
 
-	//copy other's drawables, updating transform pointers:
-	drawables = other.drawables;
-	for (auto &d : drawables) {
-		d.transform = transform_to_transform.at(d.transform);
-	}
-
-	//copy other's cameras, updating transform pointers:
-	cameras = other.cameras;
-	for (auto &c : cameras) {
-		c.transform = transform_to_transform.at(c.transform);
-	}
-
-	//copy other's lights, updating transform pointers:
-	lights = other.lights;
-	for (auto &l : lights) {
-		l.transform = transform_to_transform.at(l.transform);
+	//store mapping between transforms old and new (if requested):
+	if (transform_map) {
+		transform_map->clear();
+		transform_map->insert(std::make_pair(nullptr, nullptr));
+		for (uint32_t i = 0; i < transforms.size(); ++i) {
+			transform_map->insert(std::make_pair(&other.transforms[i], &transforms[i]));
+		}
 	}
 }
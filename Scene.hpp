@@ -11,21 +11,28 @@
  */
 
 #include "GL.hpp"
+#include "ChunkedArray.hpp"
+#include "HashIndex.hpp"
+#include "BVH.hpp"
+#include "Mesh.hpp"
+#include "OcclusionBuffer.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
-#include <list>
 #include <memory>
 #include <functional>
+#include <limits>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 
 struct Scene {
 	struct Transform {
 		//Transform names are useful for debugging and looking up locations in a loaded scene:
-		std::string name;
+		// (names are stored in the scene's name table; use Scene::name() to get the string and Scene::rename() to change it)
+		uint32_t name = 0;
 
 		//The core function of a transform is to store a transformation in the world:
 		glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
@@ -35,6 +42,9 @@ struct Scene {
 		//The transform above may be relative to some parent transform:
 		Transform *parent = nullptr;
 
+		//Set if this transform (and everything below it) never moves, which lets StaticBatch merge its drawables:
+		bool is_static = false;
+
 		//It is often convenient to construct matrices representing this transformation:
 		// ..relative to its parent:
 		glm::mat4x3 make_local_to_parent() const;
@@ -54,33 +64,105 @@ struct Scene {
 		Drawable(Transform *transform_) : transform(transform_) { assert(transform); }
 		Transform * transform;
 
-		//Contains all the data needed to run the OpenGL pipeline:
+		//Bounding box of the drawable's vertices in object space (usually copied from Mesh::min/max),
+		// used by draw() to skip drawables that are outside the view:
+		// (the default, empty box means "bounds unknown" -- such drawables are never culled)
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+
+		//(optional) mesh being drawn, which lets raycast() test its triangles instead of just the bounding box,
+		// and lets draw() use the mesh's simplified versions (Mesh::lods) when it is small on screen:
+		Mesh const *mesh = nullptr;
+
+		//(optional) simple mesh that fits inside this drawable, drawn into the occlusion buffer (see occlusion_culling):
+		// (only its positions are used, so it doesn't need to be the same mesh -- or even from the same MeshBuffer)
+		Mesh const *occluder = nullptr;
+
+		//Contains the per-drawable data needed to run the OpenGL pipeline:
+		// (everything else -- textures, uniforms -- lives in the Material it refers to)
 		struct Pipeline {
 			GLuint program = 0; //shader program; passed to glUseProgram
 
 			//attributes:
 			GLuint vao = 0; //attrib->buffer mapping; passed to glBindVertexArray
+			GLuint instanced_vao = 0; //(optional) vao for the material's instanced_program, made with make_vao_for_program(..., Scene::instance_buffer())
 
 			GLenum type = GL_TRIANGLES; //what sort of primitive to draw; passed to glDrawArrays
 			GLuint start = 0; //first vertex to draw; passed to glDrawArrays
 			GLuint count = 0; //number of vertices to draw; passed to glDrawArrays
 
-			//uniforms:
-			GLuint OBJECT_TO_CLIP_mat4 = -1U; //uniform location for object to clip space matrix
-			GLuint OBJECT_TO_LIGHT_mat4x3 = -1U; //uniform location for object to light space (== world space) matrix
-			GLuint NORMAL_TO_LIGHT_mat3 = -1U; //uniform location for normal to light space (== world space) matrix
+			uint32_t material = 0; //index in Scene::materials() (0 is the default material)
 
-			std::function< void() > set_uniforms; //(optional) function to set any other useful uniforms
-
-			//texture objects to bind for the first TextureCount textures:
-			enum : uint32_t { TextureCount = 4 };
-			struct TextureInfo {
-				GLuint texture = 0;
-				GLenum target = GL_TEXTURE_2D;
-			} textures[TextureCount];
+			//layer to sample from the material's array textures (see TextureArray), passed to programs as TEXTURE_LAYER:
+			// (since this isn't part of the material, drawables with different layers can share a material and be instanced together)
+			uint32_t texture_layer = 0;
 		} pipeline;
 	};
 
+	//Materials hold the rarely-changing parts of drawing (uniform locations, textures, uniform values):
+	// draw() only applies a material when it changes, so drawables that share one should share an index.
+	struct Material {
+		//uniforms that draw() sets per-object:
+		GLuint OBJECT_TO_CLIP_mat4 = -1U; //uniform location for object to clip space matrix
+		GLuint OBJECT_TO_LIGHT_mat4x3 = -1U; //uniform location for object to light space (== world space) matrix
+		GLuint NORMAL_TO_LIGHT_mat3 = -1U; //uniform location for normal to light space (== world space) matrix
+		GLuint TEXTURE_LAYER_float = -1U; //uniform location for the drawable's texture_layer
+		//..or, instead of the uniforms above, the program can read them from the "Object" uniform block:
+		bool object_uniform_block = false; //program binds its "Object" block (see Scene::ObjectBlock) to Scene::ObjectBlockBinding
+
+		//(optional) instanced version of the program:
+		// draw() batches drawables with the same material and mesh into one instanced draw if this (and the drawables' instanced_vao) is set
+		// and the material has no uniform values (since those are set on the non-instanced program).
+		GLuint instanced_program = 0; //program that reads OBJECT_TO_CLIP/OBJECT_TO_LIGHT/NORMAL_TO_LIGHT as per-instance attributes
+
+		//(optional) position-only versions of the programs, used by the depth pre-pass (see depth_prepass and make_depth_program):
+		// only opaque materials should set these, since drawables drawn in the pre-pass hide everything behind them.
+		GLuint depth_program = 0; //reads OBJECT_TO_CLIP from the "Object" uniform block
+		GLuint depth_instanced_program = 0; //reads OBJECT_TO_CLIP as a per-instance attribute
+
+		//texture objects to bind for the first TextureCount textures:
+		enum : uint32_t { TextureCount = 4 };
+		struct TextureInfo {
+			GLuint texture = 0;
+			GLenum target = GL_TEXTURE_2D;
+		} textures[TextureCount];
+
+		//other uniform values, set (with glUniform*) whenever the material is applied:
+		template< typename T >
+		struct UniformValues {
+			std::vector< GLint > locations;
+			std::vector< T > values;
+			void set(GLint location, T const &value) {
+				for (uint32_t i = 0; i < locations.size(); ++i) {
+					if (locations[i] == location) {
+						values[i] = value;
+						return;
+					}
+				}
+				locations.emplace_back(location);
+				values.emplace_back(value);
+			}
+		};
+		UniformValues< int > ints;
+		UniformValues< float > floats;
+		UniformValues< glm::vec2 > vec2s;
+		UniformValues< glm::vec3 > vec3s;
+		UniformValues< glm::vec4 > vec4s;
+		UniformValues< glm::mat4 > mat4s;
+		bool has_uniform_values() const {
+			return !(ints.locations.empty() && floats.locations.empty() && vec2s.locations.empty()
+			      && vec3s.locations.empty() && vec4s.locations.empty() && mat4s.locations.empty());
+		}
+		//glUniform* all of the values above (for the currently bound program):
+		void apply_uniform_values() const;
+	};
+
+	//Materials are shared by all scenes (like the GL objects they refer to):
+	// (materials()[0] is a default material with no textures or uniforms)
+	static std::vector< Material > &materials();
+	//add a material and return its index:
+	static uint32_t add_material(Material const &material);
+
 	struct Camera {
 		//a 'Camera' attaches camera data to a transform:
 		Camera(Transform *transform_) : transform(transform_) { assert(transform); }
@@ -117,10 +199,212 @@ struct Scene {
 	};
 
 	//Scenes, of course, may have many of the above objects:
-	std::list< Transform > transforms;
-	std::list< Drawable > drawables;
-	std::list< Camera > cameras;
-	std::list< Light > lights;
+	// (ChunkedArray keeps element pointers stable, like std::list, but stores elements contiguously)
+	ChunkedArray< Transform > transforms;
+	ChunkedArray< Drawable > drawables;
+	ChunkedArray< Camera > cameras;
+	ChunkedArray< Light > lights;
+
+	//All names are interned in one table per scene (filled from the scene file's string chunk on load):
+	struct NameTable {
+		std::vector< char > chars; //characters of all names, back-to-back
+		struct Span {
+			uint32_t begin, end;
+		};
+		std::vector< Span > spans = { Span{0, 0} }; //range of chars for each name id (id 0 is the empty name)
+		HashIndex index; //name -> id
+	} names;
+
+	//id of a name in the name table (adding it if needed):
+	uint32_t intern(std::string_view name);
+	//string for a name id (valid until the next name is added):
+	std::string_view name(uint32_t id) const;
+	std::string_view name(Transform const &transform) const { return name(transform.name); }
+	//change a transform's name:
+	void rename(Transform &transform, std::string_view name);
+
+	//look up a transform by name, or by a '/'-separated path of names starting at a root (e.g., "board/ball"):
+	// returns nullptr if nothing matches (or the first transform, in order, if several do)
+	// (lookups use hash indices that are rebuilt after transforms are added or renamed, or the hierarchy is updated)
+	Transform *find(std::string_view name_or_path);
+	Transform const *find(std::string_view name_or_path) const;
+
+	struct TransformIndex {
+		HashIndex by_name; //hash of name -> transform index
+		HashIndex by_path; //hash of path -> transform index
+		uint32_t transforms = -1U; //transforms.size() when built
+		uint32_t hierarchy_serial = -1U; //hierarchy.serial when built
+	};
+	mutable TransformIndex transform_index;
+	void update_transform_index() const;
+
+	//Handles refer to a transform by index instead of by pointer:
+	// (since Scene copies preserve transform order, a handle from one scene also works in its copies)
+	struct TransformHandle {
+		uint32_t index = -1U;
+		uint32_t generation = 0;
+	};
+	//handle for a transform in this scene (or an invalid handle if transform isn't in this scene):
+	TransformHandle handle(Transform const *transform) const;
+	//transform referenced by a handle (or nullptr if the handle is invalid or stale):
+	Transform *lookup(TransformHandle const &handle);
+	Transform const *lookup(TransformHandle const &handle) const;
+
+	//generation changes whenever the set of transforms is replaced (e.g., by set()), which makes old handles stale:
+	uint32_t generation = 0;
+
+	//The hierarchy is also kept in flattened form so that world matrices can be computed in a single linear pass:
+	// (this is derived data; update_hierarchy() rebuilds it when transforms are added or re-parented)
+	struct Hierarchy {
+		enum : uint32_t {
+			Root = -1U, //transform has no parent
+			External = -2U //transform's parent (or drawable's transform) isn't in this scene
+		};
+		std::vector< Transform const * > parent_pointers; //Transform::parent values as of last rebuild
+		std::vector< uint32_t > parents; //parent index for each transform (or Root/External)
+		std::vector< uint32_t > order; //update order with parents before children (empty if transforms are already in that order)
+		std::vector< glm::mat4x3 > local_to_parent; //local matrix for each transform (computed by update_hierarchy())
+		std::vector< glm::mat4x3 > local_to_world; //world matrix for each transform (computed by update_hierarchy())
+		std::vector< uint32_t > drawable_transforms; //transform index for each drawable (or External)
+		uint32_t serial = 0; //incremented whenever parents are rebuilt
+		uint32_t updates = 0; //incremented whenever world matrices are recomputed
+	};
+	mutable Hierarchy hierarchy;
+
+	//recompute hierarchy.local_to_world for every transform (called by draw()):
+	void update_hierarchy() const;
+	//..or just the index parts of the hierarchy (parents, order, drawable_transforms):
+	void update_hierarchy_indices() const;
+
+	//If set, draw() skips drawables whose bounding boxes are outside the view frustum:
+	bool frustum_culling = true;
+
+	//If set, draw() uses instanced draws for drawables that share a mesh and a material with an instanced version:
+	bool instancing = true;
+
+	//If set, draw() uses simplified versions (Mesh::lods) of drawables that are small on screen:
+	// level 1 is used once a drawable's bounding sphere covers less than lod_size of the screen height,
+	// level 2 below lod_size / 2, and so on. To avoid flickering between levels, a drawable only
+	// switches once its size is past the switch point by the fraction lod_hysteresis.
+	bool level_of_detail = true;
+	float lod_size = 0.2f;
+	float lod_hysteresis = 0.2f;
+
+	//If set, draw() also skips drawables that are hidden behind occluders (see Drawable::occluder):
+	// occluders that cover at least occluder_size of the screen height are drawn into 'occlusion',
+	// a small depth buffer on the CPU, and other drawables' bounding boxes are tested against it.
+	bool occlusion_culling = false;
+	float occluder_size = 0.1f;
+	mutable OcclusionBuffer occlusion;
+
+	//If set, draw() sorts by depth first (nearest first) instead of by pipeline state first,
+	// so that hidden fragments are more often rejected before shading; costs more state changes and fewer instanced draws:
+	bool front_to_back = false;
+
+	//If set, draw() first draws opaque drawables (those whose materials have depth programs) to the depth buffer only,
+	// nearest first, and then shades them with glDepthFunc(GL_EQUAL), so that each pixel is shaded about once:
+	bool depth_prepass = false;
+
+	//If set, draw() counts the samples that pass the depth test while shading (stats.shaded_samples);
+	// this waits for the GPU to finish drawing, so it is only meant for measuring overdraw:
+	bool count_samples = false;
+
+	//Per-draw matrices in std140 layout, for materials with object_uniform_block, whose programs declare:
+	//  layout(std140) uniform Object { mat4 OBJECT_TO_CLIP; mat4x3 OBJECT_TO_LIGHT; mat3 NORMAL_TO_LIGHT; float TEXTURE_LAYER; };
+	// (programs may leave off trailing members they don't use)
+	// draw() fills these for all drawables at once, then uses glBindBufferRange per draw.
+	struct ObjectBlock {
+		glm::mat4 OBJECT_TO_CLIP;
+		glm::vec4 OBJECT_TO_LIGHT[4]; //(std140 pads matrix columns to vec4)
+		glm::vec4 NORMAL_TO_LIGHT[3];
+		float TEXTURE_LAYER;
+		float padding[3];
+	};
+	static_assert(sizeof(ObjectBlock) == 4*16 + 4*16 + 4*12 + 4*4, "ObjectBlock matches std140 layout.");
+	enum : GLuint { ObjectBlockBinding = 0 }; //uniform buffer binding point for the "Object" block
+
+	//Buffer that draw() streams per-instance data (MeshInstance) into; shared by all scenes:
+	// (created on first call; needs an OpenGL context)
+	static GLuint instance_buffer();
+
+	//Counts from the most recent call to draw():
+	struct DrawStats {
+		uint32_t drawn = 0; //drawables sent to OpenGL
+		uint32_t culled = 0; //drawables skipped because they were outside the view frustum (or occluded)
+		uint32_t occluded = 0; //drawables skipped because they were hidden behind occluders
+		uint32_t occluders = 0; //occluders drawn into the occlusion buffer
+		float occlusion_ms = 0.0f; //time spent drawing occluders and building the occlusion pyramid
+		uint32_t draw_calls = 0; //glDraw* calls
+		uint32_t instanced_draws = 0; //glDrawArraysInstanced calls (included in draw_calls)
+		uint32_t program_binds = 0; //glUseProgram calls
+		uint32_t vertex_array_binds = 0; //glBindVertexArray calls
+		uint32_t texture_binds = 0; //texture unit changes
+		uint32_t material_changes = 0; //times a material's textures and uniform values were applied
+		uint32_t vertices = 0; //vertices sent to OpenGL (over all instances)
+		uint32_t depth_draw_calls = 0; //glDraw* calls in the depth pre-pass (not included in draw_calls)
+		uint32_t shaded_samples = 0; //samples that passed the depth test while shading (if count_samples is set)
+	};
+	mutable DrawStats stats;
+
+	//draw() sorts visible drawables by pipeline state (then depth) so that redundant state changes can be skipped:
+	// (or by depth, then pipeline state, if front_to_back is set)
+	struct DrawItem {
+		uint64_t key; //packed program / vertex array / material / first vertex / depth (see make_draw_key in Scene.cpp)
+		uint32_t drawable; //index in drawables
+	};
+	mutable std::vector< DrawItem > draw_queue;
+	mutable std::vector< uint32_t > prepass_order; //indices in draw_batches, nearest first
+	//draw() builds the queue in slices of drawables on several threads (see parallel_for.hpp):
+	struct DrawSlice {
+		std::vector< DrawItem > queue; //visible drawables in this slice, sorted
+		uint32_t culled = 0; //drawables in this slice skipped by frustum (or occlusion) culling
+		uint32_t occluded = 0; //drawables in this slice hidden behind occluders
+	};
+	mutable std::vector< DrawSlice > draw_slices;
+	struct DrawBatch {
+		uint32_t begin, end; //range of draw_queue drawn together (more than one means an instanced draw)
+		uint32_t object_block_offset = -1U; //byte offset of this draw's ObjectBlock in object_blocks (if used)
+		uint32_t first_instance = -1U; //this batch's first MeshInstance in instance_buffer() (instanced draws)
+	};
+	mutable std::vector< DrawBatch > draw_batches;
+	mutable std::vector< uint8_t > object_blocks; //ObjectBlock data for this draw() call, at uniform buffer offset alignment
+	mutable std::vector< MeshInstance > draw_matrices; //matrices for each draw_queue entry (also the per-instance data for instanced draws)
+	mutable std::vector< uint8_t > draw_lods; //level of detail each drawable was last drawn at (kept between draws for hysteresis)
+
+	//Scratch space used by draw() to test drawables' world-space bounding boxes several at a time:
+	struct Culling {
+		std::vector< float > center_x, center_y, center_z;
+		std::vector< float > extent_x, extent_y, extent_z;
+		std::vector< uint8_t > visible;
+	};
+	mutable Culling culling;
+
+	//Ray casts find the nearest drawable along a ray:
+	// (they use world matrices from the most recent draw() or update_hierarchy() call)
+	struct Ray {
+		glm::vec3 origin = glm::vec3(0.0f);
+		glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f); //(need not be normalized; t is measured in multiples of it)
+		float max_t = std::numeric_limits< float >::infinity(); //ignore hits past origin + max_t * direction
+	};
+	struct RayHit {
+		float t = std::numeric_limits< float >::infinity(); //hit is at origin + t * direction
+		uint32_t drawable = -1U; //index in drawables_to_draw() (-1U if nothing was hit)
+		uint32_t triangle = -1U; //triangle in the drawable's mesh (-1U if the drawable has no mesh and its bounding box was hit)
+	};
+	RayHit raycast(Ray const &ray) const;
+	//..many rays at once (split across threads):
+	void raycast(uint32_t count, Ray const *rays, RayHit *hits) const;
+
+	//BVH over drawables' world-space bounding boxes (refit when world matrices change, rebuilt when it gets too loose):
+	struct RaycastIndex {
+		BVH bvh;
+		std::vector< glm::vec3 > mins, maxs; //world-space bounds of each drawable
+		std::vector< glm::mat4x3 > world_to_object; //takes rays into each drawable's object space
+		float built_area = 0.0f; //bvh.root_area() when last built
+		uint32_t hierarchy_updates = -1U; //hierarchy.updates when bounds were last computed
+	};
+	mutable RaycastIndex raycast_index;
+	void update_raycast_index() const;
 
 	//The "draw" function provides a convenient way to pass all the things in a scene to OpenGL:
 	void draw(Camera const &camera) const;
@@ -136,11 +420,12 @@ struct Scene {
 	);
 
 	//this function is called to read extra chunks from the scene file after the main chunks are read:
+	// (xfh0 holds the transforms made for hierarchy entries, whether the file stored them as xfh0 or quantized as xfh1)
 	// this is useful if you, e.g., subclassing scene to represent a game level/area
 	virtual void load_extra(std::istream &from, std::vector< char > const &str0, std::vector< Transform * > const &xfh0) { }
 
 	//empty scene:
-	Scene() = default;
+	Scene();
 
 	//load a scene:
 	Scene(std::string const &filename, std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable);
@@ -149,5 +434,21 @@ struct Scene {
 	Scene(Scene const &); //...as a constructor
 	Scene &operator=(Scene const &); //...as scene = scene
 	//... as a set() function that optionally returns the transform->transform mapping:
+	// (copies are index-based -- transform i of the copy corresponds to transform i of the original)
 	void set(Scene const &, std::unordered_map< Transform const *, Transform * > *transform_map = nullptr);
+
+	//make this scene a lightweight instance of 'prototype':
+	// transforms, cameras, and lights are copied (as with set()), but drawables are shared with the prototype,
+	// so draw() draws the prototype's drawables attached to this scene's transforms.
+	// (the prototype must outlive this scene, and must not add transforms or drawables while shared)
+	void instance(Scene const &prototype);
+	//copy shared drawables into 'drawables' (e.g., before changing one of them):
+	void unshare_drawables();
+
+	//scene that owns the drawables this scene draws (nullptr if this scene draws its own 'drawables'):
+	Scene const *drawables_from = nullptr;
+	ChunkedArray< Drawable > const &drawables_to_draw() const { return drawables_from ? drawables_from->drawables : drawables; }
+
+	//helper for set() and instance():
+	void copy_transforms(Scene const &other, std::unordered_map< Transform const *, Transform * > *transform_map);
 };
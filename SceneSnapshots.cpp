@@ -0,0 +1,195 @@
+#include "SceneSnapshots.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+//encode a XOR b as (skipped words, literal words) pairs, each followed by the literal words:
+static void encode_delta(std::vector< uint32_t > const &a, std::vector< uint32_t > const &b, std::vector< uint32_t > *delta_) {
+	assert(delta_);
+	auto &delta = *delta_;
+	assert(a.size() == b.size());
+
+	delta.clear();
+	uint32_t count = uint32_t(a.size());
+	uint32_t i = 0;
+	while (i < count) {
+		uint32_t skip_begin = i;
+		while (i < count && a[i] == b[i]) ++i;
+		uint32_t literal_begin = i;
+		while (i < count && a[i] != b[i]) ++i;
+		if (literal_begin == count) break; //(no need to record trailing unchanged words)
+		delta.emplace_back(literal_begin - skip_begin);
+		delta.emplace_back(i - literal_begin);
+		for (uint32_t w = literal_begin; w < i; ++w) {
+			delta.emplace_back(a[w] ^ b[w]);
+		}
+	}
+}
+
+//XOR a delta into an image (which turns either side of the delta into the other):
+static void apply_delta(std::vector< uint32_t > const &delta, std::vector< uint32_t > *image_) {
+	assert(image_);
+	auto &image = *image_;
+
+	uint32_t at = 0;
+	for (uint32_t d = 0; d + 2 <= delta.size(); ) {
+		at += delta[d];
+		uint32_t literals = delta[d+1];
+		d += 2;
+		assert(at + literals <= image.size() && d + literals <= delta.size());
+		for (uint32_t w = 0; w < literals; ++w) {
+			image[at + w] ^= delta[d + w];
+		}
+		at += literals;
+		d += literals;
+	}
+}
+
+SceneSnapshots::SceneSnapshots(uint32_t capacity_) : capacity(std::max(1U, capacity_)) {
+	deltas.resize(capacity - 1);
+}
+
+void SceneSnapshots::add_state(void *data, size_t size) {
+	assert(data);
+	states.emplace_back(State{data, size});
+	clear(); //(old snapshots don't have room for the new state)
+}
+
+void SceneSnapshots::write(Scene const &scene, std::vector< uint32_t > *image_) const {
+	assert(image_);
+	auto &image = *image_;
+
+	size_t words = 1 + size_t(scene.transforms.size()) * TransformWords;
+	for (State const &state : states) {
+		words += (state.size + 3) / 4;
+	}
+	image.resize(words);
+
+	uint32_t *at = image.data();
+	*(at++) = scene.transforms.size();
+	for (Scene::Transform const &t : scene.transforms) {
+		float f[TransformWords] = {
+			t.position.x, t.position.y, t.position.z,
+			t.rotation.w, t.rotation.x, t.rotation.y, t.rotation.z,
+			t.scale.x, t.scale.y, t.scale.z
+		};
+		std::memcpy(at, f, sizeof(f));
+		at += TransformWords;
+	}
+	for (State const &state : states) {
+		if (state.size == 0) continue;
+		at[(state.size + 3) / 4 - 1] = 0; //(so padding bytes don't make spurious deltas)
+		std::memcpy(at, state.data, state.size);
+		at += (state.size + 3) / 4;
+	}
+	assert(at == image.data() + image.size());
+}
+
+void SceneSnapshots::read(std::vector< uint32_t > const &image, Scene &scene) const {
+	assert(!image.empty());
+	if (image[0] != scene.transforms.size()) {
+		throw std::runtime_error("Snapshot has " + std::to_string(image[0]) + " transforms, but scene has " + std::to_string(scene.transforms.size()) + ".");
+	}
+
+	uint32_t const *at = image.data() + 1;
+	for (Scene::Transform &t : scene.transforms) {
+		float f[TransformWords];
+		std::memcpy(f, at, sizeof(f));
+		at += TransformWords;
+		t.position = glm::vec3(f[0], f[1], f[2]);
+		t.rotation = glm::quat(f[3], f[4], f[5], f[6]);
+		t.scale = glm::vec3(f[7], f[8], f[9]);
+	}
+	for (State const &state : states) {
+		std::memcpy(state.data, at, state.size);
+		at += (state.size + 3) / 4;
+	}
+	assert(at == image.data() + image.size());
+}
+
+std::vector< uint32_t > const &SceneSnapshots::delta(uint32_t i) const {
+	assert(i < delta_count);
+	return deltas[(delta_begin + delta_count - 1 - i) % deltas.size()];
+}
+
+void SceneSnapshots::capture(Scene const &scene) {
+	write(scene, &scratch);
+
+	//first snapshot (or the set of transforms changed, so deltas can't be taken):
+	if (newest.size() != scratch.size() || newest.empty() || newest[0] != scratch[0]) {
+		clear();
+		newest.swap(scratch);
+		return;
+	}
+
+	if (!deltas.empty()) {
+		if (delta_count == deltas.size()) {
+			//drop the oldest snapshot:
+			delta_begin = (delta_begin + 1) % deltas.size();
+			delta_count -= 1;
+		}
+		//(reuses the storage of whatever delta used to be in this slot)
+		encode_delta(newest, scratch, &deltas[(delta_begin + delta_count) % deltas.size()]);
+		delta_count += 1;
+	}
+	newest.swap(scratch);
+
+	//the cursor's snapshot is now one further back (and may have been dropped):
+	if (cursor_back != -1U) {
+		cursor_back += 1;
+		if (cursor_back >= size()) cursor_back = -1U;
+	}
+}
+
+void SceneSnapshots::seek(uint32_t back) {
+	assert(back < size());
+	//start from the newest snapshot if it is closer than the cursor:
+	if (cursor_back == -1U || back < (cursor_back > back ? cursor_back - back : back - cursor_back)) {
+		cursor = newest;
+		cursor_back = 0;
+	}
+	while (cursor_back < back) {
+		apply_delta(delta(cursor_back), &cursor);
+		cursor_back += 1;
+	}
+	while (cursor_back > back) {
+		cursor_back -= 1;
+		apply_delta(delta(cursor_back), &cursor);
+	}
+}
+
+bool SceneSnapshots::restore(Scene &scene, uint32_t back) {
+	if (back >= size()) return false;
+	seek(back);
+	read(cursor, scene);
+	return true;
+}
+
+void SceneSnapshots::discard_newer(uint32_t back) {
+	if (back == 0) return;
+	if (back >= size()) {
+		clear();
+		return;
+	}
+	seek(back);
+	newest.swap(cursor);
+	delta_count -= back;
+	cursor_back = -1U;
+}
+
+void SceneSnapshots::clear() {
+	newest.clear();
+	delta_begin = 0;
+	delta_count = 0;
+	cursor_back = -1U;
+}
+
+size_t SceneSnapshots::memory_bytes() const {
+	size_t bytes = newest.size() * 4;
+	for (uint32_t i = 0; i < delta_count; ++i) {
+		bytes += delta(i).size() * 4;
+	}
+	return bytes;
+}
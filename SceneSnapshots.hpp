@@ -0,0 +1,87 @@
+#pragma once
+
+/*
+ * SceneSnapshots keeps a ring buffer of recent Scene states, for rewind and replay:
+ *  - add() any gameplay state (plain-old-data) that should be captured along with the scene,
+ *  - capture() the scene once per tick,
+ *  - restore() the scene (and added state) as it was some number of snapshots back,
+ *  - discard_newer() to continue playing from a restored snapshot.
+ *
+ * A snapshot holds the position, rotation, and scale of every transform (so the set of
+ *  transforms shouldn't change while capturing; if their count does change, older snapshots are dropped).
+ *
+ * Only the newest snapshot is stored whole. Older snapshots are stored as the XOR of
+ *  neighboring snapshots, with runs of unchanged words skipped, so things that don't
+ *  move cost almost nothing. Since XOR works in both directions, stepping one snapshot
+ *  back or forward (as rewinding or scrubbing does) costs a single delta.
+ *
+ */
+
+#include "Scene.hpp"
+
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+struct SceneSnapshots {
+	//keep (up to) this many snapshots:
+	SceneSnapshots(uint32_t capacity = 600);
+
+	//capture 'size' bytes at 'data' with every snapshot (and write them back on restore):
+	void add_state(void *data, size_t size);
+	template< typename T >
+	void add(T *value) {
+		static_assert(std::is_trivially_copyable< T >::value, "snapshot state must be plain-old-data.");
+		add_state(value, sizeof(T));
+	}
+
+	//add a snapshot of the scene (and added state), dropping the oldest if full:
+	void capture(Scene const &scene);
+
+	//number of snapshots held:
+	uint32_t size() const { return newest.empty() ? 0 : delta_count + 1; }
+
+	//set the scene (and added state) to the snapshot 'back' steps before the newest (0 is the newest):
+	// returns false (and changes nothing) if there is no such snapshot
+	// throws if the scene's transforms don't match the snapshot's
+	bool restore(Scene &scene, uint32_t back);
+
+	//forget the 'back' newest snapshots, so that the next capture() follows snapshot 'back':
+	void discard_newer(uint32_t back);
+
+	//forget everything:
+	void clear();
+
+	//bytes used by snapshot data:
+	size_t memory_bytes() const;
+
+	//----- internals -----
+
+	uint32_t capacity;
+
+	struct State {
+		void *data;
+		size_t size;
+	};
+	std::vector< State > states;
+
+	//a snapshot is a list of words: transform count, then position/rotation/scale per transform, then added state:
+	enum : uint32_t { TransformWords = (3 + 4 + 3) };
+	void write(Scene const &scene, std::vector< uint32_t > *image) const;
+	void read(std::vector< uint32_t > const &image, Scene &scene) const;
+
+	std::vector< uint32_t > newest; //newest snapshot, stored whole
+	std::vector< uint32_t > scratch; //the snapshot being captured
+
+	//deltas[(delta_begin + delta_count - 1 - i) % (capacity - 1)] is snapshot i XOR snapshot i+1 (counting back from the newest):
+	// stored as (skipped words, literal words) pairs, each followed by the literal words
+	std::vector< std::vector< uint32_t > > deltas;
+	uint32_t delta_begin = 0;
+	uint32_t delta_count = 0;
+	std::vector< uint32_t > const &delta(uint32_t i) const;
+
+	//the most recently restored snapshot (kept so that stepping from it only takes one delta):
+	std::vector< uint32_t > cursor;
+	uint32_t cursor_back = -1U; //(-1U if cursor isn't valid)
+	void seek(uint32_t back);
+};
@@ -10,9 +10,11 @@ Load< ShowMeshesProgram > show_meshes_program(LoadTagEarly, []() -> ShowMeshesPr
 
 	show_meshes_program_pipeline.program = ret->program;
 
-	show_meshes_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
-	show_meshes_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
-	show_meshes_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
+	Scene::Material material;
+	material.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
+	material.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
+	material.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
+	show_meshes_program_pipeline.material = Scene::add_material(material);
 
 	return ret;
 });
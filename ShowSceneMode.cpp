@@ -2,8 +2,9 @@
 #include "DrawLines.hpp"
 
 #include <iostream>
+#include <cstdio>
 
-ShowSceneMode::ShowSceneMode(Scene const &scene_) : scene(scene_) {
+ShowSceneMode::ShowSceneMode(Scene const &scene_, TileStreamer *streamer_, Animation::Player *animation_, Skinning *skinning_) : scene(scene_), streamer(streamer_), animation(animation_), skinning(skinning_) {
 
 	//Set up camera-only scene:
 	{ //create a single camera:
@@ -22,6 +23,27 @@ ShowSceneMode::~ShowSceneMode() {
 bool ShowSceneMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size) {
 	//----- trackball-style camera controls -----
 	if (evt.type == SDL_MOUSEBUTTONDOWN) {
+		if (evt.button.button == SDL_BUTTON_RIGHT) {
+			//----- click-picking -----
+			//ray from the camera through the clicked pixel:
+			glm::vec2 ndc = glm::vec2(
+				(evt.button.x + 0.5f) / float(window_size.x) * 2.0f - 1.0f,
+				(evt.button.y + 0.5f) / float(window_size.y) *-2.0f + 1.0f
+			);
+			float tan_half_fovy = std::tan(0.5f * scene_camera->fovy);
+			glm::mat4x3 camera_to_world = scene_camera->transform->make_local_to_world();
+			Scene::Ray ray;
+			ray.origin = camera_to_world[3];
+			ray.direction = camera_to_world * glm::vec4(ndc.x * tan_half_fovy * scene_camera->aspect, ndc.y * tan_half_fovy, -1.0f, 0.0f);
+
+			picked = scene.raycast(ray);
+			picked_position = ray.origin + picked.t * ray.direction;
+			if (picked.drawable != -1U) {
+				Scene::Drawable const &drawable = scene.drawables_to_draw()[picked.drawable];
+				std::cout << "Picked '" << scene.name(*drawable.transform) << "' at " << picked_position.x << ", " << picked_position.y << ", " << picked_position.z << std::endl;
+			}
+			return true;
+		}
 		if (evt.button.button == SDL_BUTTON_LEFT) {
 			//when camera is upside-down at rotation start, azimuth rotation should be reversed:
 			// (this ends up feeling more intuitive)
@@ -72,6 +94,11 @@ bool ShowSceneMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_
 	return false;
 }
 
+void ShowSceneMode::update(float elapsed) {
+	if (animation) animation->update(elapsed);
+	if (skinning) skinning->update();
+}
+
 void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 	//--- use camera structure to set up scene camera ---
 
@@ -93,10 +120,19 @@ void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 
 	scene.draw(*scene_camera);
 
+	if (streamer) {
+		streamer->update(*scene_camera);
+		streamer->draw(*scene_camera);
+	}
+
 	{ //decorate with some lines:
 		DrawLines draw_lines(scene_camera->make_projection() * glm::mat4(scene_camera->transform->make_world_to_local()));
+		//(scene.draw() just updated the hierarchy's world matrices)
+		uint32_t index = 0;
 		for (auto &transform : scene.transforms) {
-			glm::mat4 local_to_world = transform.make_local_to_world();
+			glm::mat4 local_to_world = scene.hierarchy.local_to_world[index];
+			uint32_t parent = scene.hierarchy.parents[index];
+			++index;
 			auto xf = [&local_to_world](glm::vec3 const &vec) {
 				return glm::vec3(local_to_world * glm::vec4(vec, 1.0f));
 			};
@@ -106,7 +142,9 @@ void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 
 			if (transform.parent) {
 				//connect to parent:
-				glm::vec3 p = glm::vec3(transform.parent->make_local_to_world()[3]);
+				glm::vec3 p = (parent < scene.transforms.size()
+					? scene.hierarchy.local_to_world[parent][3]
+					: glm::vec3(transform.parent->make_local_to_world()[3]));
 				draw_lines.draw(p, xf(glm::vec3(0.0f)), glm::u8vec4(0xff, 0xff, 0x00, 0xff));
 			}
 
@@ -121,13 +159,89 @@ void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 			draw_lines.draw(xf(glm::vec3(0.0f)), xf(glm::vec3(0.0f, 0.0f, -len)), glm::u8vec4(0x00, 0x00, 0x88, 0xff));
 
 			//transform name:
-			draw_lines.draw_text("'" + transform.name + "'",
+			draw_lines.draw_text("'" + std::string(scene.name(transform)) + "'",
 				xf(glm::vec3(0.05f, 0.0f, 0.05f)),
 				0.15f * xfd(glm::vec3(1.0f, 0.0f, 0.0f)),
 				0.15f * xfd(glm::vec3(0.0f, 0.0f, 1.0f)),
 				glm::u8vec4(0xff, 0xff, 0xff, 0xff)
 			);
 		}
+	}
+
+	if (picked.drawable < scene.raycast_index.mins.size()) { //outline the picked drawable:
+		DrawLines draw_lines(scene_camera->make_projection() * glm::mat4(scene_camera->transform->make_world_to_local()));
+		glDisable(GL_DEPTH_TEST);
+		glm::vec3 const &min = scene.raycast_index.mins[picked.drawable];
+		glm::vec3 const &max = scene.raycast_index.maxs[picked.drawable];
+		glm::u8vec4 color = glm::u8vec4(0xff, 0x88, 0x00, 0xff);
+		for (uint32_t a = 0; a < 3; ++a) {
+			//the four box edges along axis 'a':
+			uint32_t b = (a + 1) % 3, c = (a + 2) % 3;
+			for (uint32_t corner = 0; corner < 4; ++corner) {
+				glm::vec3 from, to;
+				from[a] = min[a]; to[a] = max[a];
+				from[b] = to[b] = (corner & 1 ? max[b] : min[b]);
+				from[c] = to[c] = (corner & 2 ? max[c] : min[c]);
+				draw_lines.draw(from, to, color);
+			}
+		}
+		//..and mark the hit point:
+		float r = 0.02f * camera.radius;
+		draw_lines.draw(picked_position - glm::vec3(r, 0.0f, 0.0f), picked_position + glm::vec3(r, 0.0f, 0.0f), color);
+		draw_lines.draw(picked_position - glm::vec3(0.0f, r, 0.0f), picked_position + glm::vec3(0.0f, r, 0.0f), color);
+		draw_lines.draw(picked_position - glm::vec3(0.0f, 0.0f, r), picked_position + glm::vec3(0.0f, 0.0f, r), color);
+	}
+
+	{ //overlay drawing statistics in screen space:
+		glDisable(GL_DEPTH_TEST);
+		float aspect = float(drawable_size.x) / float(drawable_size.y);
+		DrawLines overlay(glm::mat4(
+			1.0f / aspect, 0.0f, 0.0f, 0.0f,
+			0.0f, 1.0f, 0.0f, 0.0f,
+			0.0f, 0.0f, 1.0f, 0.0f,
+			0.0f, 0.0f, 0.0f, 1.0f
+		));
+		constexpr float H = 0.06f;
+		float row = 0.5f * H;
+		overlay.draw_text("drawn: " + std::to_string(scene.stats.drawn) + "  culled: " + std::to_string(scene.stats.culled) + "  vertices: " + std::to_string(scene.stats.vertices),
+			glm::vec3(-aspect + 0.5f * H, -1.0f + row, 0.0f),
+			glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
+			glm::u8vec4(0xff, 0xff, 0xff, 0xff));
+		row += 1.5f * H;
+		if (scene.occlusion_culling) {
+			char ms[16];
+			std::snprintf(ms, sizeof(ms), "%.2f", scene.stats.occlusion_ms);
+			overlay.draw_text("occluded: " + std::to_string(scene.stats.occluded) + "  occluders: " + std::to_string(scene.stats.occluders) + "  (" + ms + " ms)",
+				glm::vec3(-aspect + 0.5f * H, -1.0f + row, 0.0f),
+				glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
+				glm::u8vec4(0xff, 0xff, 0xff, 0xff));
+			row += 1.5f * H;
+		}
+		if (streamer) {
+			overlay.draw_text("tiles: " + std::to_string(streamer->resident.size()) + " / " + std::to_string(streamer->tiles.size()),
+				glm::vec3(-aspect + 0.5f * H, -1.0f + row, 0.0f),
+				glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
+				glm::u8vec4(0xff, 0xff, 0xff, 0xff));
+			row += 1.5f * H;
+		}
+		if (animation) {
+			char ms[16];
+			std::snprintf(ms, sizeof(ms), "%.3f", animation->stats.sample_ms);
+			overlay.draw_text("animated: " + std::to_string(animation->stats.transforms) + "  (" + ms + " ms)",
+				glm::vec3(-aspect + 0.5f * H, -1.0f + row, 0.0f),
+				glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
+				glm::u8vec4(0xff, 0xff, 0xff, 0xff));
+			row += 1.5f * H;
+		}
+		if (skinning) {
+			char ms[16];
+			std::snprintf(ms, sizeof(ms), "%.3f", skinning->stats.bones_ms + skinning->stats.skin_ms);
+			overlay.draw_text("skinned: " + std::to_string(skinning->stats.vertices) + " vertices  " + std::to_string(skinning->stats.bones) + " bones  (" + ms + " ms)",
+				glm::vec3(-aspect + 0.5f * H, -1.0f + row, 0.0f),
+				glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
+				glm::u8vec4(0xff, 0xff, 0xff, 0xff));
+			row += 1.5f * H;
+		}
 		/*
 		glEnable(GL_LINE_SMOOTH);
 		glEnable(GL_BLEND);
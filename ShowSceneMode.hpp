@@ -10,12 +10,19 @@
 #include "Mode.hpp"
 #include "Scene.hpp"
 #include "Mesh.hpp"
+#include "TileStreamer.hpp"
+#include "Animation.hpp"
+#include "Skinning.hpp"
 
 struct ShowSceneMode : Mode {
-	ShowSceneMode(Scene const &scene);
+	//if 'streamer' is given, its tiles are streamed around the camera and drawn along with 'scene':
+	//if 'animation' is given, it is played (it should be bound to 'scene'):
+	//if 'skinning' is given, it is updated every frame (after the animation):
+	ShowSceneMode(Scene const &scene, TileStreamer *streamer = nullptr, Animation::Player *animation = nullptr, Skinning *skinning = nullptr);
 	virtual ~ShowSceneMode();
 
 	virtual bool handle_event(SDL_Event const &, glm::uvec2 const &window_size) override;
+	virtual void update(float elapsed) override;
 	virtual void draw(glm::uvec2 const &drawable_size) override;
 
 	//z-up trackball-style camera controls:
@@ -30,6 +37,19 @@ struct ShowSceneMode : Mode {
 	//Scene being viewed:
 	Scene const &scene;
 
+	//Tiled world being viewed (if any):
+	TileStreamer *streamer = nullptr;
+
+	//Animation being played (if any):
+	Animation::Player *animation = nullptr;
+
+	//Skinned meshes being posed (if any):
+	Skinning *skinning = nullptr;
+
+	//right-click picks a drawable (by ray cast):
+	Scene::RayHit picked;
+	glm::vec3 picked_position = glm::vec3(0.0f);
+
 	//mode uses a secondary Scene to hold a camera:
 	Scene camera_scene;
 	Scene::Camera *scene_camera = nullptr;
@@ -1,30 +1,52 @@
 #include "ShowSceneProgram.hpp"
 
 #include "gl_compile_program.hpp"
+#include "depth_program.hpp"
 #include "gl_errors.hpp"
+#include "Skinning.hpp"
 
 Scene::Drawable::Pipeline show_scene_program_pipeline;
+Scene::Drawable::Pipeline show_scene_program_skinned_pipeline;
 
 Load< ShowSceneProgram > show_scene_program(LoadTagEarly, []() -> ShowSceneProgram * {
 	auto *ret = new ShowSceneProgram();
 
 	show_scene_program_pipeline.program = ret->program;
 
-	show_scene_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
-	show_scene_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
-	show_scene_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
+	Scene::Material material;
+	material.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
+	material.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
+	material.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
+	material.depth_program = ret->depth_program;
+	show_scene_program_pipeline.material = Scene::add_material(material);
 
 	return ret;
 });
 
-ShowSceneProgram::ShowSceneProgram() {
+Load< ShowSceneProgram > show_scene_program_skinned(LoadTagEarly, []() -> ShowSceneProgram * {
+	auto *ret = new ShowSceneProgram(true);
+
+	show_scene_program_skinned_pipeline.program = ret->program;
+
+	Scene::Material material;
+	material.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
+	material.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
+	material.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
+	show_scene_program_skinned_pipeline.material = Scene::add_material(material);
+
+	return ret;
+});
+
+ShowSceneProgram::ShowSceneProgram(bool skinned) {
 	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
 	program = gl_compile_program(
 		//vertex shader:
 		"#version 330\n"
+		"invariant gl_Position;\n" //(so depth matches the depth pre-pass exactly)
 		"uniform mat4 OBJECT_TO_CLIP;\n"
 		"uniform mat4x3 OBJECT_TO_LIGHT;\n"
 		"uniform mat3 NORMAL_TO_LIGHT;\n"
+		+ std::string(skinned ? Skinning::VertexShaderCode : "") +
 		"in vec4 Position;\n"
 		"in vec3 Normal;\n"
 		"in vec4 Color;\n"
@@ -34,9 +56,16 @@ ShowSceneProgram::ShowSceneProgram() {
 		"out vec4 color;\n"
 		"out vec2 texCoord;\n"
 		"void main() {\n"
-		"	gl_Position = OBJECT_TO_CLIP * Position;\n"
-		"	position = OBJECT_TO_LIGHT * Position;\n"
-		"	normal = NORMAL_TO_LIGHT * Normal;\n"
+		+ std::string(skinned
+			? "	mat4x3 skin = skin_matrix();\n"
+			  "	vec4 P = vec4(skin * Position, 1.0);\n"
+			  "	vec3 N = mat3(skin) * Normal;\n"
+			: "	vec4 P = Position;\n"
+			  "	vec3 N = Normal;\n"
+		) +
+		"	gl_Position = OBJECT_TO_CLIP * P;\n"
+		"	position = OBJECT_TO_LIGHT * P;\n"
+		"	normal = NORMAL_TO_LIGHT * N;\n"
 		"	color = Color;\n"
 		"	texCoord = TexCoord;\n"
 		"}\n"
@@ -78,6 +107,8 @@ ShowSceneProgram::ShowSceneProgram() {
 	Normal_vec3 = glGetAttribLocation(program, "Normal");
 	Color_vec4 = glGetAttribLocation(program, "Color");
 	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
+	BoneIndices_vec4 = glGetAttribLocation(program, "BoneIndices");
+	BoneWeights_vec4 = glGetAttribLocation(program, "BoneWeights");
 
 	//look up the locations of uniforms:
 	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
@@ -85,9 +116,23 @@ ShowSceneProgram::ShowSceneProgram() {
 	NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
 
 	INSPECT_MODE_int = glGetUniformLocation(program, "INSPECT_MODE");
+	BONE_OFFSET_int = glGetUniformLocation(program, "BONE_OFFSET");
+
+	//position-only version for the depth pre-pass (reads attributes from the same vertex arrays):
+	// (not for the skinned variant, since the depth program wouldn't skin)
+	if (!skinned) depth_program = make_depth_program(program, false);
+
+	//the skinned variant reads bone matrices from the texture buffer that Skinning::make_material binds:
+	if (skinned) {
+		glUseProgram(program);
+		glUniform1i(glGetUniformLocation(program, "BONES"), Skinning::BonesUnit);
+		glUseProgram(0);
+	}
 }
 
 ShowSceneProgram::~ShowSceneProgram() {
+	glDeleteProgram(depth_program);
+	depth_program = 0;
 	glDeleteProgram(program);
 	program = 0;
 }
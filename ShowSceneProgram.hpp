@@ -8,16 +8,21 @@
 //Shader program that provides various modes for visualizing positions,
 // colors, normals, and texture coordinates; mostly useful for debugging.
 struct ShowSceneProgram {
-	ShowSceneProgram();
+	//'skinned' variant blends its vertices with bone matrices from a Skinning (draw from the skinned MeshBuffer, with a material from Skinning::make_material):
+	// (and has no depth_program)
+	ShowSceneProgram(bool skinned = false);
 	~ShowSceneProgram();
 
 	GLuint program = 0;
+	GLuint depth_program = 0; //position-only version, for Scene::depth_prepass (see make_depth_program)
 
 	//Attribute (per-vertex variable) locations:
 	GLuint Position_vec4 = -1U;
 	GLuint Normal_vec3 = -1U;
 	GLuint Color_vec4 = -1U;
 	GLuint TexCoord_vec2 = -1U;
+	GLuint BoneIndices_vec4 = -1U; //(skinned variant)
+	GLuint BoneWeights_vec4 = -1U; //(skinned variant)
 
 	//Uniform (per-invocation variable) locations:
 	GLuint OBJECT_TO_CLIP_mat4 = -1U;
@@ -26,9 +31,14 @@ struct ShowSceneProgram {
 
 	GLuint INSPECT_MODE_int = -1U; //0: basic lighting; 1: position only; 2: normal only; 3: color only; 4: texcoord only
 
+	GLuint BONE_OFFSET_int = -1U; //(skinned variant; set per instance by Skinning::make_material)
+
 	//Textures:
-	//no textures used
+	//(skinned variant) Skinning::BonesUnit - bone matrices
 };
 
 extern Load< ShowSceneProgram > show_scene_program;
-extern Scene::Drawable::Pipeline show_scene_program_pipeline; //Drawable::Pipeline already initialized with proper uniform locations for this program.
+extern Scene::Drawable::Pipeline show_scene_program_pipeline; //Drawable::Pipeline already initialized with this program and a material with its uniform locations.
+
+extern Load< ShowSceneProgram > show_scene_program_skinned;
+extern Scene::Drawable::Pipeline show_scene_program_skinned_pipeline; //(per skinned instance, set material with Skinning::make_material)
@@ -0,0 +1,297 @@
+#include "Skinning.hpp"
+
+#include "Affine.hpp"
+#include "parallel_for.hpp"
+#include "gl_errors.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SKINNING_USE_SSE
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+//vertices are built on the stack before being written to the (write-only) output buffer:
+static constexpr uint32_t MaxStride = 256;
+
+char const *Skinning::VertexShaderCode =
+	"uniform samplerBuffer BONES;\n"
+	"uniform int BONE_OFFSET;\n"
+	"in vec4 BoneIndices;\n"
+	"in vec4 BoneWeights;\n"
+	"mat4x3 bone_matrix(float index) {\n"
+	"	int i = 3 * (BONE_OFFSET + int(index));\n"
+	"	return transpose(mat3x4(texelFetch(BONES, i), texelFetch(BONES, i + 1), texelFetch(BONES, i + 2)));\n"
+	"}\n"
+	"mat4x3 skin_matrix() {\n"
+	"	float rest = 1.0 - dot(BoneWeights, vec4(1.0));\n" //(unweighted part of the vertex stays put)
+	"	return BoneWeights.x * bone_matrix(BoneIndices.x) + BoneWeights.y * bone_matrix(BoneIndices.y)\n"
+	"	     + BoneWeights.z * bone_matrix(BoneIndices.z) + BoneWeights.w * bone_matrix(BoneIndices.w)\n"
+	"	     + rest * mat4x3(1.0);\n"
+	"}\n"
+;
+
+Skinning::Skinning(MeshBuffer const &source_) : source(source_) {
+	//vertices are copied whole, then positions and normals are overwritten, so those need to be plain floats:
+	MeshBuffer::Attrib const &Position = source.Position;
+	MeshBuffer::Attrib const &Normal = source.Normal;
+	if (!(Position.size == 3 && Position.type == GL_FLOAT && Position.stride > 0 && uint32_t(Position.stride) <= MaxStride)) {
+		throw std::runtime_error("Skinning needs three-float positions.");
+	}
+	if (!(Normal.size == 3 && Normal.type == GL_FLOAT && Normal.stride == Position.stride)) {
+		throw std::runtime_error("Skinning needs three-float normals.");
+	}
+	if (source.skin.size() != source.positions.size()) {
+		throw std::runtime_error("Skinning needs a mesh buffer with skin data.");
+	}
+	stride = uint32_t(Position.stride);
+
+	//source vertex data (read back from the buffer if it was already uploaded):
+	size_t size = source.positions.size() * stride;
+	if (source.pending_upload.size() >= size) {
+		source_vertices.assign(source.pending_upload.begin(), source.pending_upload.begin() + size);
+	} else if (source.buffer != 0) {
+		source_vertices.resize(size);
+		glBindBuffer(GL_ARRAY_BUFFER, source.buffer);
+		if (size) glGetBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(size), source_vertices.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	} else {
+		throw std::runtime_error("Skinning's mesh buffer has no vertex data.");
+	}
+
+	//output has the same attributes as the source (except for skin data):
+	output.Position = source.Position;
+	output.Normal = source.Normal;
+	output.Color = source.Color;
+	output.TexCoord = source.TexCoord;
+	glGenBuffers(1, &output.buffer);
+
+	//bone matrices for GPU skinning:
+	glGenBuffers(1, &bones_buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, bones_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4) * 3, nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	glGenTextures(1, &bones_texture);
+	glBindTexture(GL_TEXTURE_BUFFER, bones_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, bones_buffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+	GL_ERRORS();
+}
+
+Skinning::~Skinning() {
+	glDeleteTextures(1, &bones_texture);
+	glDeleteBuffers(1, &bones_buffer);
+	glDeleteBuffers(1, &output.buffer);
+	output.buffer = 0;
+}
+
+uint32_t Skinning::add(Scene &scene, Scene::Transform *transform, Mesh const &mesh) {
+	assert(transform);
+	if (mesh.bones.empty()) {
+		throw std::runtime_error("Skinning can't add a mesh without bones.");
+	}
+	if (!(source.positions.data() <= mesh.positions && mesh.positions < source.positions.data() + source.positions.size()
+		&& mesh.start + mesh.count <= source.positions.size())) {
+		throw std::runtime_error("Skinning can only add meshes from its source mesh buffer.");
+	}
+
+	instances.emplace_back();
+	Instance &instance = instances.back();
+	instance.transform = transform;
+	instance.mesh = &mesh;
+	instance.bones.reserve(mesh.bones.size());
+	for (Mesh::Bone const &bone : mesh.bones) {
+		Scene::Transform *found = scene.find(bone.name);
+		if (!found) {
+			std::cerr << "WARNING: bone '" << bone.name << "' doesn't match any transform." << std::endl;
+		}
+		instance.bones.emplace_back(found);
+	}
+	instance.output_start = total_vertices;
+	instance.bone_offset = total_bones;
+	total_vertices += mesh.count;
+	total_bones += uint32_t(mesh.bones.size());
+
+	return uint32_t(instances.size() - 1);
+}
+
+void Skinning::update() {
+	auto before = std::chrono::high_resolution_clock::now();
+
+	//bone matrices take vertices from the mesh's space (as exported) to its current space:
+	// world_to_mesh * bone_to_world * mesh_to_bone
+	// (missing bones don't move their vertices)
+	bone_columns.resize(size_t(total_bones) * 4);
+	bone_rows.resize(size_t(total_bones) * 3);
+	for (Instance const &instance : instances) {
+		glm::mat4x3 world_to_mesh = instance.transform->make_world_to_local();
+		for (uint32_t b = 0; b < instance.bones.size(); ++b) {
+			glm::mat4x3 m = glm::mat4x3(1.0f);
+			if (instance.bones[b]) {
+				m = Affine::compose(world_to_mesh, Affine::compose(instance.bones[b]->make_local_to_world(), instance.mesh->bones[b].mesh_to_bone));
+			}
+			glm::vec4 *columns = &bone_columns[size_t(instance.bone_offset + b) * 4];
+			glm::vec4 *rows = &bone_rows[size_t(instance.bone_offset + b) * 3];
+			for (uint32_t c = 0; c < 4; ++c) {
+				columns[c] = glm::vec4(m[c], 0.0f);
+			}
+			for (uint32_t r = 0; r < 3; ++r) {
+				rows[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+			}
+		}
+	}
+	stats.bones = total_bones;
+
+	if (!cpu && total_bones) {
+		glBindBuffer(GL_TEXTURE_BUFFER, bones_buffer);
+		glBufferData(GL_TEXTURE_BUFFER, bone_rows.size() * sizeof(glm::vec4), bone_rows.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	auto after_bones = std::chrono::high_resolution_clock::now();
+	stats.bones_ms = std::chrono::duration< float, std::milli >(after_bones - before).count();
+
+	stats.vertices = 0;
+	if (cpu && total_vertices) {
+		//orphan last frame's vertices and write this frame's straight into the buffer:
+		size_t size = size_t(total_vertices) * stride;
+		glBindBuffer(GL_ARRAY_BUFFER, output.buffer);
+		glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(size), nullptr, GL_STREAM_DRAW);
+		uint8_t *out = reinterpret_cast< uint8_t * >(glMapBufferRange(GL_ARRAY_BUFFER, 0, GLsizeiptr(size), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+		if (!out) {
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			throw std::runtime_error("Skinning failed to map its output buffer.");
+		}
+
+		//split all instances' vertices into pieces (so big meshes are spread across threads, and small ones share a piece):
+		parallel_for(total_vertices, 1024, [this, out](uint32_t begin, uint32_t end) {
+			uint32_t i = uint32_t(std::upper_bound(instances.begin(), instances.end(), begin, [](uint32_t v, Instance const &instance) {
+				return v < instance.output_start;
+			}) - instances.begin()) - 1;
+			while (begin < end) {
+				Instance const &instance = instances[i];
+				uint32_t piece_end = std::min(end, instance.output_start + instance.mesh->count);
+				if (begin < piece_end) {
+					skin_vertices(i, begin - instance.output_start, piece_end - instance.output_start, out + size_t(begin) * stride);
+					begin = piece_end;
+				}
+				++i;
+			}
+		});
+
+		//(if the buffer's contents were lost while mapped, this frame's skinned vertices are garbage; the next update rewrites them)
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		stats.vertices = total_vertices;
+	}
+
+	stats.skin_ms = std::chrono::duration< float, std::milli >(std::chrono::high_resolution_clock::now() - after_bones).count();
+
+	GL_ERRORS();
+}
+
+void Skinning::skin_vertices(uint32_t index, uint32_t begin, uint32_t end, uint8_t *out) const {
+	Instance const &instance = instances[index];
+	Mesh const &mesh = *instance.mesh;
+	float const *columns = &bone_columns[size_t(instance.bone_offset) * 4].x;
+	uint32_t position_offset = uint32_t(source.Position.offset);
+	uint32_t normal_offset = uint32_t(source.Normal.offset);
+
+	alignas(16) uint8_t vertex[MaxStride];
+	for (uint32_t v = begin; v < end; ++v) {
+		uint32_t s = mesh.start + v;
+		std::memcpy(vertex, source_vertices.data() + size_t(s) * stride, stride);
+
+		SkinWeights const &skin = source.skin[s];
+		uint32_t total = uint32_t(skin.weights.x) + skin.weights.y + skin.weights.z + skin.weights.w;
+		if (total != 0) {
+			float p[3], n[3];
+			std::memcpy(p, vertex + position_offset, sizeof(p));
+			std::memcpy(n, vertex + normal_offset, sizeof(n));
+			float rest = float(255 - std::min(255U, total)) / 255.0f;
+
+			//blend bone matrices (plus 'rest' times the identity), then transform position and normal:
+			// (normals use the blended matrix itself, rather than its inverse transpose, which is exact for rotations and uniform scales)
+#ifdef SKINNING_USE_SSE
+			__m128 c0 = _mm_set_ps(0.0f, 0.0f, 0.0f, rest);
+			__m128 c1 = _mm_set_ps(0.0f, 0.0f, rest, 0.0f);
+			__m128 c2 = _mm_set_ps(0.0f, rest, 0.0f, 0.0f);
+			__m128 c3 = _mm_setzero_ps();
+			for (uint32_t i = 0; i < 4; ++i) {
+				if (skin.weights[i] == 0) continue;
+				__m128 w = _mm_set1_ps(skin.weights[i] / 255.0f);
+				float const *bone = columns + 16 * skin.bones[i];
+				c0 = _mm_add_ps(c0, _mm_mul_ps(w, _mm_loadu_ps(bone + 0)));
+				c1 = _mm_add_ps(c1, _mm_mul_ps(w, _mm_loadu_ps(bone + 4)));
+				c2 = _mm_add_ps(c2, _mm_mul_ps(w, _mm_loadu_ps(bone + 8)));
+				c3 = _mm_add_ps(c3, _mm_mul_ps(w, _mm_loadu_ps(bone + 12)));
+			}
+			__m128 P = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])), _mm_mul_ps(c1, _mm_set1_ps(p[1]))),
+				_mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p[2])), c3)
+			);
+			__m128 N = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n[0])), _mm_mul_ps(c1, _mm_set1_ps(n[1]))),
+				_mm_mul_ps(c2, _mm_set1_ps(n[2]))
+			);
+			float P4[4], N4[4];
+			_mm_storeu_ps(P4, P);
+			_mm_storeu_ps(N4, N);
+			p[0] = P4[0]; p[1] = P4[1]; p[2] = P4[2];
+			n[0] = N4[0]; n[1] = N4[1]; n[2] = N4[2];
+#else
+			float m[16] = {
+				rest, 0.0f, 0.0f, 0.0f,
+				0.0f, rest, 0.0f, 0.0f,
+				0.0f, 0.0f, rest, 0.0f,
+				0.0f, 0.0f, 0.0f, 0.0f
+			};
+			for (uint32_t i = 0; i < 4; ++i) {
+				if (skin.weights[i] == 0) continue;
+				float w = skin.weights[i] / 255.0f;
+				float const *bone = columns + 16 * skin.bones[i];
+				for (uint32_t e = 0; e < 16; ++e) {
+					m[e] += w * bone[e];
+				}
+			}
+			float P3[3], N3[3];
+			for (uint32_t r = 0; r < 3; ++r) {
+				P3[r] = m[r] * p[0] + m[4 + r] * p[1] + m[8 + r] * p[2] + m[12 + r];
+				N3[r] = m[r] * n[0] + m[4 + r] * n[1] + m[8 + r] * n[2];
+			}
+			std::memcpy(p, P3, sizeof(p));
+			std::memcpy(n, N3, sizeof(n));
+#endif
+			float length2 = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+			if (length2 > 0.0f) {
+				float inv = 1.0f / std::sqrt(length2);
+				n[0] *= inv; n[1] *= inv; n[2] *= inv;
+			}
+			std::memcpy(vertex + position_offset, p, sizeof(p));
+			std::memcpy(vertex + normal_offset, n, sizeof(n));
+		}
+
+		std::memcpy(out + size_t(v - begin) * stride, vertex, stride);
+	}
+}
+
+uint32_t Skinning::make_material(uint32_t instance, uint32_t material, GLint BONE_OFFSET_int) const {
+	assert(instance < instances.size());
+	assert(material < Scene::materials().size());
+	Scene::Material copy = Scene::materials()[material];
+	copy.textures[BonesUnit].texture = bones_texture;
+	copy.textures[BonesUnit].target = GL_TEXTURE_BUFFER;
+	copy.ints.set(BONE_OFFSET_int, int(instances[instance].bone_offset));
+	//(instanced and depth-only programs don't skin, so can't draw this material)
+	copy.instanced_program = 0;
+	copy.depth_program = 0;
+	copy.depth_instanced_program = 0;
+	return Scene::add_material(copy);
+}
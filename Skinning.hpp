@@ -0,0 +1,93 @@
+#pragma once
+
+/*
+ * Skinning moves the vertices of skinned meshes (see Mesh::bones) with their bones' transforms.
+ *
+ * Each frame, update() computes a matrix for every bone of every added instance. Then either:
+ *  - (cpu) every instance's vertices are blended on the CPU (with SSE, split across threads) and
+ *    written straight into 'output', a streamed vertex buffer drawn with any program, or
+ *  - (!cpu) the bone matrices are uploaded to a texture buffer, and vertices are blended on the GPU
+ *    by programs that include VertexShaderCode (e.g., the skinned LitColorTextureProgram)
+ *    and draw from the source buffer, with a material from make_material().
+ *
+ * Bones are transforms in the scene (named by Mesh::Bone::name), so anything that moves
+ *  transforms (e.g., an Animation::Player) poses skinned meshes.
+ *
+ */
+
+#include "Scene.hpp"
+#include "Mesh.hpp"
+#include "GL.hpp"
+
+#include <cstdint>
+#include <vector>
+
+struct Skinning {
+	//skins meshes from 'source' (which needs three-float positions and normals):
+	Skinning(MeshBuffer const &source);
+	~Skinning();
+	Skinning(Skinning const &) = delete;
+	Skinning &operator=(Skinning const &) = delete;
+
+	MeshBuffer const &source;
+
+	//add an instance of 'mesh' (which must be from source and have bones) drawn with 'transform',
+	// with bones looked up by name in 'scene' (missing bones stay as posed when exported):
+	// returns the instance's index
+	uint32_t add(Scene &scene, Scene::Transform *transform, Mesh const &mesh);
+
+	struct Instance {
+		Scene::Transform *transform = nullptr;
+		Mesh const *mesh = nullptr;
+		std::vector< Scene::Transform * > bones; //per Mesh::bones entry (nullptr if not found)
+		GLuint output_start = 0; //first vertex of this instance in 'output' (draw 'mesh->count' vertices from here)
+		uint32_t bone_offset = 0; //first bone of this instance in the bone matrices (BONE_OFFSET for GPU skinning)
+	};
+	std::vector< Instance > instances;
+
+	//skin vertices on the CPU (otherwise, only upload bone matrices for GPU skinning):
+	bool cpu = true;
+
+	//pose every instance from its bones' current transforms:
+	void update();
+
+	//CPU-skinned vertices of every instance, in the same format as the source (without skin data):
+	// (output.buffer is rewritten by each update(); make vertex arrays with output.make_vao_for_program)
+	MeshBuffer output;
+
+	//GPU skinning reads bone matrices (three vec4 rows per bone) from a GL_RGBA32F texture buffer:
+	GLuint bones_buffer = 0;
+	GLuint bones_texture = 0;
+	enum : GLuint { BonesUnit = Scene::Material::TextureCount - 1 }; //texture unit for bones_texture
+
+	//GLSL for the vertex shaders of GPU skinning programs; declares:
+	//  uniform samplerBuffer BONES; uniform int BONE_OFFSET; in vec4 BoneIndices; in vec4 BoneWeights;
+	//  mat4x3 skin_matrix(); //blended bone matrix for this vertex (mesh space to mesh space)
+	// (programs should set BONES to BonesUnit)
+	static char const *VertexShaderCode;
+
+	//copy of 'material' that also binds bones_texture and sets BONE_OFFSET (at uniform location 'BONE_OFFSET_int') for 'instance':
+	// returns the new material's index (see Scene::add_material)
+	uint32_t make_material(uint32_t instance, uint32_t material, GLint BONE_OFFSET_int) const;
+
+	//Measurements (from the most recent update):
+	struct {
+		uint32_t vertices = 0; //vertices skinned on the CPU
+		uint32_t bones = 0; //bone matrices computed
+		float bones_ms = 0.0f; //time computing (and, for GPU skinning, uploading) bone matrices
+		float skin_ms = 0.0f; //time skinning vertices (including writing them to output)
+	} stats;
+
+	//----- internals -----
+	//source vertex data (read back from source.buffer if it was already uploaded):
+	std::vector< uint8_t > source_vertices;
+	uint32_t stride = 0;
+	uint32_t total_vertices = 0; //output vertices (over all instances)
+
+	//bone matrices as four columns (xyz, padded to vec4) for CPU skinning, and as three rows for GPU skinning:
+	std::vector< glm::vec4 > bone_columns;
+	std::vector< glm::vec4 > bone_rows;
+	uint32_t total_bones = 0;
+
+	void skin_vertices(uint32_t instance, uint32_t begin, uint32_t end, uint8_t *out) const;
+};
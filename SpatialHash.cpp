@@ -0,0 +1,160 @@
+#include "SpatialHash.hpp"
+
+#include "parallel_for.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+SpatialHash::SpatialHash(float cell_size_) : cell_size(cell_size_) {
+	assert(cell_size > 0.0f);
+}
+
+uint32_t SpatialHash::add(Scene const &scene, Scene::Transform const *transform, float radius) {
+	assert(transform);
+	Object object;
+	object.transform = scene.handle(transform);
+	object.radius = radius;
+	assert(object.transform.index != -1U && "transform should be in scene");
+	objects.emplace_back(object);
+	return uint32_t(objects.size() - 1);
+}
+
+void SpatialHash::update(Scene const &scene) {
+	auto before = std::chrono::high_resolution_clock::now();
+
+	scene.update_hierarchy();
+
+	uint32_t count = uint32_t(objects.size());
+	centers.resize(count);
+	radii.resize(count);
+	parallel_for(count, 4096, [this, &scene](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i) {
+			Object const &object = objects[i];
+			if (object.transform.generation == scene.generation && object.transform.index < scene.hierarchy.local_to_world.size()) {
+				centers[i] = scene.hierarchy.local_to_world[object.transform.index][3];
+				radii[i] = object.radius;
+			} else {
+				centers[i] = glm::vec3(0.0f);
+				radii[i] = -1.0f; //(left out by build)
+			}
+		}
+	});
+
+	auto after = std::chrono::high_resolution_clock::now();
+
+	build(count, centers.data(), radii.data());
+
+	stats.world_ms = std::chrono::duration< float, std::milli >(after - before).count();
+}
+
+void SpatialHash::build(uint32_t count, glm::vec3 const *centers_, float const *radii_) {
+	auto before = std::chrono::high_resolution_clock::now();
+
+	//about one bucket per object:
+	uint32_t bucket_count = 16;
+	while (bucket_count < count) bucket_count *= 2;
+	bucket_mask = bucket_count - 1;
+
+	//objects are counting-sorted by bucket in two parallel passes:
+	// first into 'ranges' of consecutive buckets (with one more range for large objects),
+	// then each range by bucket. Both passes are stable, so the order doesn't depend on threading.
+	uint32_t ranges = std::min< uint32_t >(256, bucket_count);
+	uint32_t range_shift = 0;
+	while ((bucket_count >> range_shift) > ranges) range_shift += 1;
+	uint32_t const Large = ranges; //(range of large objects)
+	uint32_t const Absent = ranges + 1; //(range of left-out objects)
+
+	float large_radius = 0.5f * cell_size;
+	auto range_of = [&](Entry const &entry) {
+		if (!(entry.radius >= 0.0f)) return Absent;
+		if (entry.radius > large_radius) return Large;
+		return (hash(entry.cell) & bucket_mask) >> range_shift;
+	};
+
+	const uint32_t Grain = 4096;
+	uint32_t pieces = (count + Grain - 1) / Grain;
+	uint32_t columns = ranges + 2;
+	counts.assign(size_t(pieces) * columns, 0);
+	std::vector< float > piece_max_radius(pieces, 0.0f);
+
+	//make entries and count them per range (per piece):
+	unsorted.resize(count);
+	parallel_for(count, Grain, [&](uint32_t begin, uint32_t end) {
+		uint32_t *piece_counts = &counts[size_t(begin / Grain) * columns];
+		float &piece_max = piece_max_radius[begin / Grain];
+		for (uint32_t i = begin; i < end; ++i) {
+			Entry &entry = unsorted[i];
+			entry.center = centers_[i];
+			entry.radius = radii_[i];
+			entry.cell = cell_of(entry.center);
+			entry.object = i;
+			uint32_t range = range_of(entry);
+			piece_counts[range] += 1;
+			if (range < ranges) piece_max = std::max(piece_max, entry.radius);
+		}
+	});
+
+	//each piece's first slot in each range (ranges in order, pieces in order within each range):
+	std::vector< uint32_t > range_begin(columns + 1, 0);
+	uint32_t total = 0;
+	for (uint32_t range = 0; range < columns; ++range) {
+		range_begin[range] = total;
+		for (uint32_t piece = 0; piece < pieces; ++piece) {
+			uint32_t &c = counts[size_t(piece) * columns + range];
+			uint32_t n = c;
+			c = total;
+			total += n;
+		}
+	}
+	range_begin[columns] = total;
+	assert(total == count);
+
+	by_range.resize(count);
+	parallel_for(count, Grain, [&](uint32_t begin, uint32_t end) {
+		uint32_t *next = &counts[size_t(begin / Grain) * columns];
+		for (uint32_t i = begin; i < end; ++i) {
+			by_range[next[range_of(unsorted[i])]++] = unsorted[i];
+		}
+	});
+
+	//sort each range by bucket:
+	uint32_t small = range_begin[Large];
+	entries.resize(small);
+	bucket_begin.resize(bucket_count + 1);
+	parallel_for(ranges, 8, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t range = begin; range < end; ++range) {
+			uint32_t *first = &bucket_begin[range << range_shift];
+			uint32_t buckets = 1U << range_shift;
+			std::fill(first, first + buckets, 0);
+			for (uint32_t i = range_begin[range]; i < range_begin[range + 1]; ++i) {
+				first[hash(by_range[i].cell) & (buckets - 1)] += 1;
+			}
+			uint32_t at = range_begin[range];
+			for (uint32_t b = 0; b < buckets; ++b) {
+				uint32_t n = first[b];
+				first[b] = at;
+				at += n;
+			}
+			//(bucket_begin is used as the insertion point here, then shifted back below)
+			for (uint32_t i = range_begin[range]; i < range_begin[range + 1]; ++i) {
+				entries[first[hash(by_range[i].cell) & (buckets - 1)]++] = by_range[i];
+			}
+		}
+	});
+	//after insertion, bucket_begin[b] is where bucket b ends (== where bucket b+1 begins):
+	std::copy_backward(bucket_begin.begin(), bucket_begin.end() - 1, bucket_begin.end());
+	bucket_begin[0] = 0;
+
+	large.assign(by_range.begin() + range_begin[Large], by_range.begin() + range_begin[Absent]);
+
+	max_radius = 0.0f;
+	for (float r : piece_max_radius) {
+		max_radius = std::max(max_radius, r);
+	}
+
+	stats.objects = range_begin[Absent];
+	stats.large = uint32_t(large.size());
+	stats.world_ms = 0.0f;
+	stats.build_ms = std::chrono::duration< float, std::milli >(std::chrono::high_resolution_clock::now() - before).count();
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+/*
+ * SpatialHash finds moving objects (spheres) near a point, sphere, or box without testing all of them,
+ *  which turns all-pairs proximity checks into (roughly) one small query per object.
+ *
+ * Space is divided into a uniform grid of cubes (cell_size on a side), and each object is filed
+ *  under the cell that holds its center. Only occupied cells are stored: cells are hashed into
+ *  a table with about one bucket per object, so the grid is unbounded and costs nothing where empty.
+ *  (Objects larger than a cell are kept in a short separate list that every query checks.)
+ *
+ * The whole structure is rebuilt from scratch each tick -- objects move, and re-sorting them is
+ *  as cheap as tracking which ones changed cells -- using a parallel counting sort that puts
+ *  every bucket's objects next to each other in memory.
+ *
+ * Usage:
+ *  SpatialHash hash(2.0f);
+ *  uint32_t a = hash.add(scene, transform, 0.5f); //objects follow scene transforms
+ *  hash.update(scene); //each tick, after moving transforms
+ *  hash.query_sphere(center, radius, [](uint32_t object){ ... });
+ *  hash.for_each_pair([](uint32_t a, uint32_t b){ ... }); //every overlapping pair of objects
+ *
+ */
+
+#include "Scene.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+struct SpatialHash {
+	//queries are quickest with cell_size around one to two times the diameter of a typical object:
+	SpatialHash(float cell_size = 1.0f);
+
+	float cell_size;
+
+	//objects that follow scene transforms: a sphere of 'radius' (in world units) around the transform's world position:
+	struct Object {
+		Scene::TransformHandle transform;
+		float radius = 0.0f;
+	};
+	std::vector< Object > objects;
+
+	//add an object (transform must be in 'scene'); returns the object's index, which queries report:
+	uint32_t add(Scene const &scene, Scene::Transform const *transform, float radius);
+
+	//rebuild from the current world positions of every object's transform:
+	// (recomputes the scene's world matrices; objects whose handles are stale are left out)
+	void update(Scene const &scene);
+
+	//..or rebuild from any 'count' spheres (ignores 'objects'; queries report indices into centers/radii):
+	// (spheres with negative radii are left out)
+	void build(uint32_t count, glm::vec3 const *centers, float const *radii);
+
+	//call found(object) for every object whose sphere overlaps the given sphere or box:
+	template< typename Found >
+	void query_sphere(glm::vec3 const &center, float radius, Found const &found) const;
+	template< typename Found >
+	void query_box(glm::vec3 const &min, glm::vec3 const &max, Found const &found) const;
+
+	//call found(a, b) (with a < b) once for every pair of objects whose spheres overlap:
+	template< typename Found >
+	void for_each_pair(Found const &found) const;
+
+	//Measurements (from the most recent update or build):
+	struct {
+		uint32_t objects = 0; //objects in the hash
+		uint32_t large = 0; //..of which were too large for a cell
+		float world_ms = 0.0f; //time computing world positions (update only)
+		float build_ms = 0.0f; //time sorting objects into cells
+	} stats;
+
+	//----- internals -----
+	//objects, sorted by bucket (so each bucket's objects are contiguous):
+	struct Entry {
+		glm::vec3 center;
+		float radius;
+		glm::ivec3 cell;
+		uint32_t object;
+	};
+	static_assert(sizeof(Entry) == 32, "SpatialHash::Entry is packed.");
+	std::vector< Entry > entries;
+	std::vector< uint32_t > bucket_begin; //entries of bucket b are [bucket_begin[b], bucket_begin[b+1])
+	uint32_t bucket_mask = 0; //bucket count - 1 (bucket count is a power of two)
+
+	std::vector< Entry > large; //objects with radius > cell_size / 2, checked by every query
+	float max_radius = 0.0f; //largest radius in 'entries' (queries look this much further for centers)
+
+	//scratch space for building:
+	std::vector< glm::vec3 > centers;
+	std::vector< float > radii;
+	std::vector< Entry > unsorted; //in object order
+	std::vector< Entry > by_range; //sorted by range of buckets (see build())
+	std::vector< uint32_t > counts; //per piece, per range
+
+	glm::ivec3 cell_of(glm::vec3 const &position) const {
+		return glm::ivec3(glm::floor(position * (1.0f / cell_size)));
+	}
+	static uint32_t hash(glm::ivec3 const &cell) {
+		return (uint32_t(cell.x) * 73856093U) ^ (uint32_t(cell.y) * 19349663U) ^ (uint32_t(cell.z) * 83492791U);
+	}
+
+	//call test(entry) for every entry whose center is in a cell from 'lo' to 'hi' (inclusive), and for every large entry:
+	template< typename Test >
+	void visit(glm::ivec3 const &lo, glm::ivec3 const &hi, Test const &test) const;
+};
+
+template< typename Test >
+void SpatialHash::visit(glm::ivec3 const &lo, glm::ivec3 const &hi, Test const &test) const {
+	for (Entry const &entry : large) {
+		test(entry);
+	}
+	if (entries.empty()) return;
+
+	//if the range covers more cells than there are buckets, it's faster to check everything:
+	uint64_t cells = uint64_t(hi.x - lo.x + 1) * uint64_t(hi.y - lo.y + 1) * uint64_t(hi.z - lo.z + 1);
+	if (cells > uint64_t(bucket_mask) + 1) {
+		for (Entry const &entry : entries) {
+			if (glm::all(glm::greaterThanEqual(entry.cell, lo)) && glm::all(glm::lessThanEqual(entry.cell, hi))) test(entry);
+		}
+		return;
+	}
+
+	glm::ivec3 cell;
+	for (cell.z = lo.z; cell.z <= hi.z; ++cell.z) {
+		for (cell.y = lo.y; cell.y <= hi.y; ++cell.y) {
+			for (cell.x = lo.x; cell.x <= hi.x; ++cell.x) {
+				uint32_t bucket = hash(cell) & bucket_mask;
+				for (uint32_t i = bucket_begin[bucket]; i < bucket_begin[bucket + 1]; ++i) {
+					//(other cells may share this bucket)
+					if (entries[i].cell == cell) test(entries[i]);
+				}
+			}
+		}
+	}
+}
+
+template< typename Found >
+void SpatialHash::query_sphere(glm::vec3 const &center, float radius, Found const &found) const {
+	glm::vec3 reach = glm::vec3(radius + max_radius);
+	visit(cell_of(center - reach), cell_of(center + reach), [&](Entry const &entry) {
+		glm::vec3 to = entry.center - center;
+		float r = radius + entry.radius;
+		if (glm::dot(to, to) <= r * r) found(entry.object);
+	});
+}
+
+template< typename Found >
+void SpatialHash::query_box(glm::vec3 const &min, glm::vec3 const &max, Found const &found) const {
+	glm::vec3 reach = glm::vec3(max_radius);
+	visit(cell_of(min - reach), cell_of(max + reach), [&](Entry const &entry) {
+		glm::vec3 to = glm::clamp(entry.center, min, max) - entry.center;
+		if (glm::dot(to, to) <= entry.radius * entry.radius) found(entry.object);
+	});
+}
+
+template< typename Found >
+void SpatialHash::for_each_pair(Found const &found) const {
+	auto each = [&](Entry const &a) {
+		query_sphere(a.center, a.radius, [&](uint32_t b) {
+			if (a.object < b) found(a.object, b);
+		});
+	};
+	for (Entry const &entry : entries) each(entry);
+	for (Entry const &entry : large) each(entry);
+}
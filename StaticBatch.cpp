@@ -0,0 +1,233 @@
+#include "StaticBatch.hpp"
+
+#include "gl_errors.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+StaticBatch::~StaticBatch() {
+	for (auto const &program_vao : vaos) {
+		glDeleteVertexArrays(1, &program_vao.second);
+	}
+	if (meshes.buffer != 0) {
+		glDeleteBuffers(1, &meshes.buffer);
+		meshes.buffer = 0;
+	}
+}
+
+uint32_t StaticBatch::batch(Scene &scene, MeshBuffer const &source) {
+	if (scene.drawables_from) {
+		throw std::runtime_error("StaticBatch can't batch a scene that shares its drawables (call unshare_drawables() first).");
+	}
+	if (meshes.buffer != 0 || !meshes.meshes.empty()) {
+		throw std::runtime_error("StaticBatch::batch() can only be called once.");
+	}
+
+	//vertices are copied whole, then positions (and normals) are overwritten, so those need to be plain floats:
+	MeshBuffer::Attrib const &Position = source.Position;
+	MeshBuffer::Attrib const &Normal = source.Normal;
+	if (!(Position.size == 3 && Position.type == GL_FLOAT && Position.stride > 0)) {
+		throw std::runtime_error("StaticBatch needs three-float positions.");
+	}
+	if (!(Normal.size == 0 || (Normal.size == 3 && Normal.type == GL_FLOAT && Normal.stride == Position.stride))) {
+		throw std::runtime_error("StaticBatch needs three-float normals (or none).");
+	}
+	uint32_t stride = uint32_t(Position.stride);
+
+	//source vertex data (read back from the buffer if it was already uploaded):
+	std::vector< uint8_t > read_back;
+	uint8_t const *source_data = source.pending_upload.data();
+	size_t source_size = source.pending_upload.size();
+	if (source.pending_upload.empty() && source.buffer != 0) {
+		GLint size = 0;
+		glBindBuffer(GL_ARRAY_BUFFER, source.buffer);
+		glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+		read_back.resize(size_t(std::max(0, size)));
+		if (!read_back.empty()) glGetBufferSubData(GL_ARRAY_BUFFER, 0, GLsizeiptr(read_back.size()), read_back.data());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		GL_ERRORS();
+		source_data = read_back.data();
+		source_size = read_back.size();
+	}
+	uint32_t source_vertices = uint32_t(std::min(source_size / stride, source.positions.size()));
+
+	//is a transform static? (memoized, since siblings share ancestors)
+	std::unordered_map< Scene::Transform const *, bool > static_memo;
+	auto is_static = [&](Scene::Transform const *transform) {
+		std::vector< Scene::Transform const * > chain;
+		bool result = false;
+		for (Scene::Transform const *t = transform; t; t = t->parent) {
+			auto f = static_memo.find(t);
+			if (f != static_memo.end()) {
+				result = f->second;
+				break;
+			}
+			std::string_view name = scene.name(*t);
+			if (t->is_static || (!static_prefix.empty() && name.substr(0, static_prefix.size()) == static_prefix)) {
+				result = true;
+				break;
+			}
+			chain.emplace_back(t);
+		}
+		for (Scene::Transform const *t : chain) {
+			static_memo.emplace(t, result);
+		}
+		return result;
+	};
+
+	//group static drawables by pipeline state and grid cell:
+	// (std::map so that batches come out in the same order every time)
+	// (occluders are batched apart from everything else, so merged occluders stay small)
+	typedef std::tuple< bool, GLuint, uint32_t, uint32_t, int32_t, int32_t, int32_t > GroupKey; //occluder, program, material, texture layer, cell
+	std::map< GroupKey, std::vector< uint32_t > > groups;
+	std::vector< bool > batched(scene.drawables.size(), false);
+	std::vector< glm::mat4x3 > local_to_world(scene.drawables.size());
+
+	for (uint32_t i = 0; i < scene.drawables.size(); ++i) {
+		Scene::Drawable const &drawable = scene.drawables[i];
+		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+		if (pipeline.type != GL_TRIANGLES || pipeline.count == 0) continue;
+		//only meshes that live in 'source' (so their vertices can be found):
+		if (!drawable.mesh || !(source.positions.data() <= drawable.mesh->positions
+			&& drawable.mesh->positions < source.positions.data() + source.positions.size())) continue;
+		if (!(pipeline.start <= source_vertices && pipeline.count <= source_vertices - pipeline.start)) continue;
+		if (!is_static(drawable.transform)) continue;
+
+		local_to_world[i] = drawable.transform->make_local_to_world();
+		glm::vec3 min = drawable.min;
+		glm::vec3 max = drawable.max;
+		if (!(min.x <= max.x)) {
+			min = drawable.mesh->min;
+			max = drawable.mesh->max;
+		}
+		glm::vec3 center = local_to_world[i] * glm::vec4(0.5f * (min + max), 1.0f);
+		glm::ivec3 cell = glm::ivec3(glm::floor(center / cell_size));
+
+		batched[i] = true;
+		groups[GroupKey(drawable.occluder != nullptr, pipeline.program, pipeline.material, pipeline.texture_layer, cell.x, cell.y, cell.z)].emplace_back(i);
+	}
+
+	stats = Stats();
+	if (groups.empty()) return 0;
+
+	//copy vertices into world space, one contiguous range per group:
+	meshes.Position = source.Position;
+	meshes.Normal = source.Normal;
+	meshes.Color = source.Color;
+	meshes.TexCoord = source.TexCoord;
+
+	std::vector< uint8_t > &data = meshes.pending_upload;
+	std::vector< Mesh > batch_meshes;
+	batch_meshes.reserve(groups.size());
+	for (auto const &group : groups) {
+		batch_meshes.emplace_back();
+		Mesh &mesh = batch_meshes.back();
+		mesh.type = GL_TRIANGLES;
+		mesh.start = GLuint(meshes.positions.size());
+
+		for (uint32_t i : group.second) {
+			Scene::Drawable const &drawable = scene.drawables[i];
+			glm::mat4x3 const &xf = local_to_world[i];
+			glm::mat3 linear = glm::mat3(xf);
+			//normals transform by the inverse transpose (and need to be re-normalized after):
+			glm::mat3 normal_xf = (glm::determinant(linear) != 0.0f ? glm::transpose(glm::inverse(linear)) : linear);
+
+			size_t at = data.size();
+			data.resize(at + size_t(drawable.pipeline.count) * stride);
+			std::memcpy(data.data() + at, source_data + size_t(drawable.pipeline.start) * stride, size_t(drawable.pipeline.count) * stride);
+			for (uint32_t v = 0; v < drawable.pipeline.count; ++v) {
+				uint8_t *vertex = data.data() + at + size_t(v) * stride;
+
+				glm::vec3 position;
+				std::memcpy(&position, vertex + Position.offset, sizeof(position));
+				position = xf * glm::vec4(position, 1.0f);
+				std::memcpy(vertex + Position.offset, &position, sizeof(position));
+				meshes.positions.emplace_back(position);
+				mesh.min = glm::min(mesh.min, position);
+				mesh.max = glm::max(mesh.max, position);
+
+				if (Normal.size != 0) {
+					glm::vec3 normal;
+					std::memcpy(&normal, vertex + Normal.offset, sizeof(normal));
+					normal = normal_xf * normal;
+					float length = glm::length(normal);
+					if (length > 0.0f) normal /= length;
+					std::memcpy(vertex + Normal.offset, &normal, sizeof(normal));
+				}
+			}
+		}
+
+		mesh.count = GLuint(meshes.positions.size()) - mesh.start;
+		stats.static_drawables += uint32_t(group.second.size());
+	}
+	stats.batches = uint32_t(batch_meshes.size());
+	stats.vertices = uint32_t(meshes.positions.size());
+
+	//now that positions won't move, point meshes at them and build triangle BVHs for ray casts (as MeshBuffer does):
+	std::vector< Mesh const * > mesh_pointers;
+	mesh_pointers.reserve(batch_meshes.size());
+	for (uint32_t b = 0; b < batch_meshes.size(); ++b) {
+		Mesh &mesh = batch_meshes[b];
+		mesh.positions = meshes.positions.data() + mesh.start;
+		if (mesh.count >= 3) {
+			uint32_t count = mesh.count / 3;
+			std::vector< glm::vec3 > tri_min(count), tri_max(count);
+			for (uint32_t t = 0; t < count; ++t) {
+				glm::vec3 const *tri = mesh.positions + 3 * t;
+				tri_min[t] = glm::min(tri[0], glm::min(tri[1], tri[2]));
+				tri_max[t] = glm::max(tri[0], glm::max(tri[1], tri[2]));
+			}
+			auto bvh = std::make_shared< BVH >();
+			bvh->build(count, tri_min.data(), tri_max.data());
+			mesh.triangles = bvh;
+		}
+		auto inserted = meshes.meshes.insert(std::make_pair("batch" + std::to_string(b), std::move(mesh)));
+		mesh_pointers.emplace_back(&inserted.first->second);
+	}
+
+	meshes.upload();
+
+	//rebuild the drawable list with the unbatched drawables followed by one drawable per batch:
+	ChunkedArray< Scene::Drawable > drawables;
+	for (uint32_t i = 0; i < scene.drawables.size(); ++i) {
+		if (!batched[i]) drawables.emplace_back(scene.drawables[i]);
+	}
+	uint32_t b = 0;
+	for (auto const &group : groups) {
+		Mesh const &mesh = *mesh_pointers[b];
+		++b;
+
+		//batches are already in world space, so they hang off an identity transform:
+		Scene::Transform &transform = scene.transforms.emplace_back();
+		transform.is_static = true;
+		scene.rename(transform, static_prefix + "batch");
+
+		//pipeline state comes from the first drawable in the group (the rest match it):
+		Scene::Drawable const &first = scene.drawables[group.second[0]];
+		Scene::Drawable &drawable = drawables.emplace_back(&transform);
+		drawable.pipeline = first.pipeline;
+		GLuint &vao = vaos[first.pipeline.program];
+		if (vao == 0) vao = meshes.make_vao_for_program(first.pipeline.program);
+		drawable.pipeline.vao = vao;
+		drawable.pipeline.instanced_vao = 0; //(every batch is a different mesh, so there is nothing to instance)
+		drawable.pipeline.type = mesh.type;
+		drawable.pipeline.start = mesh.start;
+		drawable.pipeline.count = mesh.count;
+
+		drawable.min = mesh.min;
+		drawable.max = mesh.max;
+		drawable.mesh = &mesh;
+		//(the merged mesh is already in the batch's space, so it can serve as its own occluder)
+		if (std::get< 0 >(group.first)) drawable.occluder = &mesh;
+	}
+	scene.drawables = std::move(drawables);
+
+	GL_ERRORS();
+
+	return stats.static_drawables;
+}
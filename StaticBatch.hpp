@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+ * StaticBatch merges drawables that never move into a few large drawables,
+ *  so that static level geometry costs a handful of draw calls instead of one per object.
+ *
+ * At load time:
+ *  - mark transforms as static (Scene::Transform::is_static, or a name starting with static_prefix),
+ *  - batch() the scene's drawables whose meshes come from a given MeshBuffer,
+ *  - keep the StaticBatch around for as long as the scene is drawn (it owns the merged vertices).
+ *
+ * Static drawables are grouped by pipeline state (program, material, texture layer) and by the
+ *  cell of a coarse world-space grid they fall in (so batches can still be culled), their vertices
+ *  are transformed into world space, and each group is replaced by one drawable attached to a new
+ *  identity transform.
+ *
+ * Batching is best done before the source MeshBuffer is uploaded (see MeshBuffer's upload_now),
+ *  since otherwise its vertices need to be read back from OpenGL.
+ *
+ */
+
+#include "GL.hpp"
+#include "Mesh.hpp"
+#include "Scene.hpp"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+struct StaticBatch {
+	StaticBatch() = default;
+	~StaticBatch();
+	StaticBatch(StaticBatch const &) = delete;
+	StaticBatch &operator=(StaticBatch const &) = delete;
+
+	//drawables are static if their transform (or any ancestor) is_static or has a name starting with this:
+	// (empty to only use is_static)
+	std::string static_prefix = "static.";
+
+	//size of the world-space grid cells that batches are split by:
+	float cell_size = 64.0f;
+
+	//replace scene's static triangle-list drawables whose meshes are in 'source' with batched drawables:
+	// the remaining drawables keep their order and the batches are added after them
+	// drawables with an occluder are batched separately, and their batches use the merged mesh as occluder
+	// (so pointers to drawables -- and drawable indices -- from before the call are invalid after it).
+	// needs an OpenGL context; can only be called once per StaticBatch; throws if scene shares its drawables.
+	// returns the number of drawables that were replaced
+	uint32_t batch(Scene &scene, MeshBuffer const &source);
+
+	//Counts from batch():
+	struct Stats {
+		uint32_t static_drawables = 0; //drawables merged into batches
+		uint32_t batches = 0; //drawables made
+		uint32_t vertices = 0; //vertices in all batches
+	} stats;
+
+	//merged vertices (in world space) and a mesh per batch:
+	MeshBuffer meshes;
+	//vertex array objects binding 'meshes' for each program used by a batch:
+	std::unordered_map< GLuint, GLuint > vaos;
+};
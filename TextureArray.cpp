@@ -0,0 +1,94 @@
+#include "TextureArray.hpp"
+
+#include "load_save_png.hpp"
+#include "gl_errors.hpp"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+TextureArray::~TextureArray() {
+	if (!textures.empty()) {
+		glDeleteTextures(GLsizei(textures.size()), textures.data());
+		textures.clear();
+	}
+}
+
+uint32_t TextureArray::add(glm::uvec2 const &size, std::vector< glm::u8vec4 > const &data) {
+	if (size.x == 0 || size.y == 0) {
+		throw std::runtime_error("TextureArray can't hold empty images.");
+	}
+	if (data.size() != size_t(size.x) * size_t(size.y)) {
+		throw std::runtime_error("TextureArray image data doesn't match its size.");
+	}
+	uint32_t id = uint32_t(layers.size());
+	layers.emplace_back();
+	pending.emplace_back();
+	pending.back().id = id;
+	pending.back().size = size;
+	pending.back().data = data;
+	return id;
+}
+
+uint32_t TextureArray::add(std::string const &filename) {
+	glm::uvec2 size;
+	std::vector< glm::u8vec4 > data;
+	load_png(filename, &size, &data, LowerLeftOrigin);
+	return add(size, data);
+}
+
+void TextureArray::upload() {
+	if (pending.empty()) return;
+
+	GLint max_layers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+	max_layers = std::max(max_layers, 1);
+
+	//group pending images by size:
+	std::map< std::pair< uint32_t, uint32_t >, std::vector< uint32_t > > by_size; //indices in pending
+	for (uint32_t i = 0; i < pending.size(); ++i) {
+		by_size[std::make_pair(pending[i].size.x, pending[i].size.y)].emplace_back(i);
+	}
+
+	for (auto const &size_images : by_size) {
+		GLsizei width = GLsizei(size_images.first.first);
+		GLsizei height = GLsizei(size_images.first.second);
+		std::vector< uint32_t > const &images = size_images.second;
+
+		for (uint32_t begin = 0; begin < images.size(); begin += uint32_t(max_layers)) {
+			uint32_t end = std::min(uint32_t(images.size()), begin + uint32_t(max_layers));
+
+			GLuint texture = 0;
+			glGenTextures(1, &texture);
+			textures.emplace_back(texture);
+
+			glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, GLsizei(end - begin), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			for (uint32_t i = begin; i < end; ++i) {
+				Pending const &image = pending[images[i]];
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, GLint(i - begin), width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, image.data.data());
+
+				layers[image.id].texture = texture;
+				layers[image.id].layer = i - begin;
+			}
+			glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		}
+	}
+
+	pending.clear();
+
+	GL_ERRORS();
+}
+
+TextureArray::Layer const &TextureArray::lookup(uint32_t id) const {
+	if (id >= layers.size()) {
+		throw std::runtime_error("Looking up texture array image " + std::to_string(id) + " that doesn't exist.");
+	}
+	return layers[id];
+}
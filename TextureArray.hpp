@@ -0,0 +1,61 @@
+#pragma once
+
+/*
+ * TextureArray packs images of the same size into the layers of GL_TEXTURE_2D_ARRAY textures,
+ *  so that drawables that used to need different textures (and so different materials)
+ *  can share one material and pick their image with Scene::Drawable::Pipeline::texture_layer.
+ *
+ * Usage:
+ *  - add() images (from memory or png files),
+ *  - upload() them (needs an OpenGL context),
+ *  - point a material's texture at lookup(id).texture (target GL_TEXTURE_2D_ARRAY)
+ *    and set drawables' texture_layer to lookup(id).layer.
+ *
+ * Images are grouped into one array per size (or more, if there are more images of a size
+ *  than GL_MAX_ARRAY_TEXTURE_LAYERS). Arrays aren't changed once made, so images added after
+ *  upload() go into new arrays at the next upload().
+ *
+ */
+
+#include "GL.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct TextureArray {
+	TextureArray() = default;
+	~TextureArray();
+	TextureArray(TextureArray const &) = delete;
+	TextureArray &operator=(TextureArray const &) = delete;
+
+	//queue an image (size.x * size.y pixels, bottom row first) and return its id:
+	uint32_t add(glm::uvec2 const &size, std::vector< glm::u8vec4 > const &data);
+	//..or load one from a png file (throws on error):
+	uint32_t add(std::string const &filename);
+
+	//make array textures for the images added since the last upload():
+	void upload();
+
+	//where an image ended up (texture is 0 until it is uploaded):
+	struct Layer {
+		GLuint texture = 0; //GL_TEXTURE_2D_ARRAY texture
+		uint32_t layer = 0; //layer within the texture
+	};
+	Layer const &lookup(uint32_t id) const;
+
+	//----- internals -----
+
+	std::vector< Layer > layers; //indexed by id
+
+	struct Pending {
+		uint32_t id;
+		glm::uvec2 size;
+		std::vector< glm::u8vec4 > data;
+	};
+	std::vector< Pending > pending;
+
+	std::vector< GLuint > textures; //all array textures made so far
+};
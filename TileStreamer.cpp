@@ -0,0 +1,247 @@
+#include "TileStreamer.hpp"
+
+#include "read_write_chunk.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+TileStreamer::TileStreamer(std::string const &index_filename, OnDrawable const &on_drawable_) : on_drawable(on_drawable_) {
+	//Tile index file format:
+	// str0 len < char > * [tile file names, relative to the index]
+	// til0 len < TileEntry > *
+	struct TileEntry {
+		uint32_t name_begin, name_end; //tile files are name + ".scene" and name + ".pnct"
+		glm::vec3 min, max; //world-space bounds
+		uint32_t bytes; //combined size of the tile's files
+	};
+	static_assert(sizeof(TileEntry) == 4 + 4 + 4*3 + 4*3 + 4, "TileEntry is packed.");
+
+	std::ifstream file(index_filename, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Failed to open tile index '" + index_filename + "'");
+	}
+
+	std::vector< char > strings;
+	read_chunk(file, "str0", &strings);
+	std::vector< TileEntry > entries;
+	read_chunk(file, "til0", &entries);
+
+	if (file.peek() != EOF) {
+		std::cerr << "WARNING: trailing data in tile index '" << index_filename << "'" << std::endl;
+	}
+
+	//tile names are relative to the index file's directory:
+	std::string directory = index_filename.substr(0, index_filename.find_last_of("/\\") + 1);
+
+	tiles.resize(entries.size());
+	for (uint32_t i = 0; i < entries.size(); ++i) {
+		TileEntry const &entry = entries[i];
+		if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
+			throw std::runtime_error("tile index entry has out-of-range name begin/end");
+		}
+		Tile &tile = tiles[i];
+		tile.path = directory + std::string(strings.data() + entry.name_begin, strings.data() + entry.name_end);
+		tile.min = entry.min;
+		tile.max = entry.max;
+		tile.bytes = entry.bytes;
+	}
+
+	thread = std::thread([this](){ load_tiles(); });
+}
+
+TileStreamer::~TileStreamer() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	thread.join();
+
+	for (auto &tile : tiles) {
+		if (tile.state == Tile::Loaded || tile.state == Tile::Resident) {
+			release(tile);
+			tile.state = Tile::Unloaded;
+		}
+	}
+	resident.clear();
+}
+
+float TileStreamer::distance(Tile const &tile, glm::vec3 const &position) {
+	glm::vec3 outside = glm::max(glm::vec3(0.0f), glm::max(tile.min - position, position - tile.max));
+	return glm::length(outside);
+}
+
+void TileStreamer::release(Tile &tile) {
+	if (!tile.vaos.empty()) {
+		glDeleteVertexArrays(GLsizei(tile.vaos.size()), tile.vaos.data());
+		tile.vaos.clear();
+	}
+	if (tile.meshes && tile.meshes->buffer != 0) {
+		glDeleteBuffers(1, &tile.meshes->buffer);
+		tile.meshes->buffer = 0;
+	}
+	tile.scene.reset();
+	tile.meshes.reset();
+	tile.pending.clear();
+}
+
+void TileStreamer::update(Scene::Camera const &camera) {
+	assert(camera.transform);
+	update(glm::vec3(camera.transform->make_local_to_world()[3]));
+}
+
+void TileStreamer::update(glm::vec3 const &position) {
+	std::vector< float > distances(tiles.size());
+	for (uint32_t i = 0; i < tiles.size(); ++i) {
+		distances[i] = distance(tiles[i], position);
+	}
+	auto nearer = [&distances](uint32_t a, uint32_t b) {
+		return distances[a] < distances[b];
+	};
+
+	std::vector< uint32_t > to_release; //Loaded or Resident tiles that are no longer wanted
+	std::vector< uint32_t > arrived; //Loaded tiles to make resident
+
+	{ //decide what to load and unload (only bookkeeping happens while the lock is held):
+		std::unique_lock< std::mutex > lock(mutex);
+
+		std::vector< uint32_t > candidates; //Unloaded tiles within load_distance
+		std::vector< uint32_t > kept; //Loaded or Resident tiles that can stay
+		for (uint32_t i = 0; i < tiles.size(); ++i) {
+			Tile &tile = tiles[i];
+			bool too_far = (distances[i] > unload_distance);
+			if (tile.state == Tile::Unloaded) {
+				if (distances[i] <= load_distance) candidates.emplace_back(i);
+			} else if (tile.state == Tile::Queued) {
+				if (too_far) {
+					tile.state = Tile::Unloaded;
+					used -= tile.bytes;
+				}
+			} else if (tile.state == Tile::Loaded || tile.state == Tile::Resident) {
+				if (too_far) {
+					to_release.emplace_back(i);
+				} else {
+					kept.emplace_back(i);
+				}
+			}
+		}
+
+		//nearest candidates first; make room for them by dropping farther tiles if over budget:
+		std::sort(candidates.begin(), candidates.end(), nearer);
+		std::sort(kept.begin(), kept.end(), nearer);
+		for (uint32_t i : to_release) {
+			used -= tiles[i].bytes;
+		}
+		for (uint32_t i : candidates) {
+			Tile &tile = tiles[i];
+			while (used + tile.bytes > budget && !kept.empty() && distances[kept.back()] > distances[i]) {
+				to_release.emplace_back(kept.back());
+				used -= tiles[kept.back()].bytes;
+				kept.pop_back();
+			}
+			if (used + tile.bytes > budget) break; //everything resident is nearer than this tile
+			tile.state = Tile::Queued;
+			used += tile.bytes;
+		}
+
+		for (uint32_t i : to_release) {
+			tiles[i].state = Tile::Unloaded;
+		}
+		for (uint32_t i : kept) {
+			if (tiles[i].state == Tile::Loaded) arrived.emplace_back(i);
+		}
+		if (arrived.size() > uploads_per_update) arrived.resize(uploads_per_update);
+
+		//re-prioritize the loading queue by current distance:
+		queue.clear();
+		for (uint32_t i = 0; i < tiles.size(); ++i) {
+			if (tiles[i].state == Tile::Queued) queue.emplace_back(i);
+		}
+		std::sort(queue.begin(), queue.end(), [&nearer](uint32_t a, uint32_t b) { return nearer(b, a); });
+	}
+	wake.notify_one();
+
+	//(loading thread never touches tiles that aren't Queued or Loading, so the rest can happen without the lock)
+
+	for (uint32_t i : to_release) {
+		release(tiles[i]);
+	}
+	if (!to_release.empty()) {
+		resident.erase(std::remove_if(resident.begin(), resident.end(), [this](uint32_t i) {
+			return !tiles[i].scene;
+		}), resident.end());
+	}
+
+	for (uint32_t i : arrived) {
+		Tile &tile = tiles[i];
+		tile.meshes->upload();
+		for (auto const &ref : tile.pending) {
+			if (on_drawable) on_drawable(tile, ref.first, ref.second);
+		}
+		tile.pending.clear();
+		resident.emplace_back(i);
+	}
+	if (!arrived.empty()) {
+		std::unique_lock< std::mutex > lock(mutex);
+		for (uint32_t i : arrived) {
+			tiles[i].state = Tile::Resident;
+		}
+	}
+}
+
+void TileStreamer::draw(Scene::Camera const &camera) const {
+	assert(camera.transform);
+	glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(camera.transform->make_world_to_local());
+	draw(world_to_clip);
+}
+
+void TileStreamer::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+	for (uint32_t i : resident) {
+		tiles[i].scene->draw(world_to_clip, world_to_light);
+	}
+}
+
+void TileStreamer::load_tiles() {
+	std::unique_lock< std::mutex > lock(mutex);
+	while (true) {
+		wake.wait(lock, [this](){ return quit || !queue.empty(); });
+		if (quit) break;
+
+		uint32_t index = queue.back();
+		queue.pop_back();
+		Tile &tile = tiles[index];
+		if (tile.state != Tile::Queued) continue;
+		tile.state = Tile::Loading;
+		lock.unlock();
+
+		//read without holding the lock (update() won't touch a Loading tile):
+		std::unique_ptr< MeshBuffer > meshes;
+		std::unique_ptr< Scene > scene;
+		std::vector< std::pair< Scene::Transform *, std::string > > pending;
+		std::string error;
+		try {
+			meshes = std::make_unique< MeshBuffer >(tile.path + ".pnct", false);
+			scene = std::make_unique< Scene >();
+			scene->load(tile.path + ".scene", [&pending](Scene &, Scene::Transform *transform, std::string const &mesh_name) {
+				pending.emplace_back(transform, mesh_name);
+			});
+		} catch (std::exception &e) {
+			error = e.what();
+		}
+
+		lock.lock();
+		if (!error.empty()) {
+			std::cerr << "WARNING: failed to load tile '" << tile.path << "': " << error << std::endl;
+			tile.state = Tile::Failed;
+			used -= tile.bytes;
+			continue;
+		}
+		tile.meshes = std::move(meshes);
+		tile.scene = std::move(scene);
+		tile.pending = std::move(pending);
+		tile.state = Tile::Loaded;
+	}
+}
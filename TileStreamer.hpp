@@ -0,0 +1,113 @@
+#pragma once
+
+/*
+ * A TileStreamer keeps the part of a large, tiled world near the camera loaded.
+ *
+ * Tiled worlds are written by scenes/export-tiles.py as a tile index
+ *  ('.tiles' file) plus one .scene / .pnct pair per tile.
+ * Only the index is read up front; after that, call update() once per frame:
+ *  - tiles whose bounds come within 'load_distance' of the camera are read on a
+ *    background thread (nearest first, as long as they fit in 'budget' bytes),
+ *  - tiles that end up farther than 'unload_distance' are freed.
+ *
+ * File reads and parsing happen on the loading thread; update() only uploads
+ *  vertex buffers and makes drawables (through 'on_drawable') for tiles
+ *  that have finished loading.
+ *
+ */
+
+#include "Scene.hpp"
+#include "Mesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct TileStreamer {
+	struct Tile;
+
+	//called (from update()) for every mesh reference in a newly-loaded tile:
+	// should add a drawable to tile.scene, much like Scene::load's on_drawable callback.
+	// vertex arrays made with tile.meshes->make_vao_for_program() should be added to tile.vaos,
+	// so that they are freed along with the tile.
+	using OnDrawable = std::function< void(Tile &tile, Scene::Transform *transform, std::string const &mesh_name) >;
+
+	//read the tile index and start the loading thread:
+	// note: will throw if the index fails to read.
+	TileStreamer(std::string const &index_filename, OnDrawable const &on_drawable);
+	~TileStreamer();
+
+	TileStreamer(TileStreamer const &) = delete;
+	TileStreamer &operator=(TileStreamer const &) = delete;
+
+	//---- settings ----
+	float load_distance = 100.0f; //tiles closer than this are loaded...
+	float unload_distance = 150.0f; //...and stay loaded until farther than this
+	size_t budget = size_t(256) << 20; //limit on total bytes of resident + loading tiles
+	uint32_t uploads_per_update = 2; //limit on tiles made resident per update() (spreads out upload cost)
+
+	//---- per frame ----
+	//load / unload tiles around a position (or the camera's world position):
+	void update(glm::vec3 const &position);
+	void update(Scene::Camera const &camera);
+
+	//draw all resident tiles:
+	void draw(Scene::Camera const &camera) const;
+	void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
+
+	//---- tiles ----
+	struct Tile {
+		std::string path; //tile's files are path + ".scene" and path + ".pnct"
+		glm::vec3 min = glm::vec3(0.0f); //world-space bounds
+		glm::vec3 max = glm::vec3(0.0f);
+		size_t bytes = 0; //size of the tile's files (counted against the budget)
+
+		enum State : uint8_t {
+			Unloaded, //nothing in memory
+			Queued, //waiting for the loading thread
+			Loading, //being read by the loading thread
+			Loaded, //read, waiting for update() to upload it
+			Resident, //uploaded; drawn by draw()
+			Failed, //couldn't be read (won't be retried)
+		} state = Unloaded;
+
+		//valid when Loaded or Resident:
+		std::unique_ptr< Scene > scene;
+		std::unique_ptr< MeshBuffer > meshes;
+		std::vector< GLuint > vaos;
+
+		//mesh references read with the scene, waiting to be passed to on_drawable:
+		std::vector< std::pair< Scene::Transform *, std::string > > pending;
+	};
+	std::vector< Tile > tiles; //(fixed after construction)
+
+	//Resident tiles (only touched by the calling thread, so draw() doesn't need to lock):
+	std::vector< uint32_t > resident;
+
+	//bytes of Queued, Loading, Loaded, and Resident tiles (guarded by 'mutex'):
+	size_t used = 0;
+
+	//---- internals ----
+	OnDrawable on_drawable;
+
+	//distance from 'position' to tile's bounds (zero inside):
+	static float distance(Tile const &tile, glm::vec3 const &position);
+
+	//free the data and GL objects of a Loaded or Resident tile (state is left to the caller):
+	void release(Tile &tile);
+
+	//loading thread takes tiles from the back of 'queue' and leaves them Loaded:
+	// (Tile::state, Tile::scene/meshes/pending while Loading, queue, used, and quit are guarded by 'mutex')
+	void load_tiles();
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector< uint32_t > queue; //Queued tiles, farthest first
+	bool quit = false;
+	std::thread thread;
+};
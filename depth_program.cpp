@@ -0,0 +1,48 @@
+#include "depth_program.hpp"
+
+#include "gl_compile_program.hpp"
+#include "Scene.hpp"
+
+#include <stdexcept>
+#include <string>
+
+GLuint make_depth_program(GLuint matching, bool instanced) {
+	GLint Position = glGetAttribLocation(matching, "Position");
+	if (Position == -1) {
+		throw std::runtime_error("Depth program can't match a program without a 'Position' attribute.");
+	}
+	GLint OBJECT_TO_CLIP = -1;
+	if (instanced) {
+		OBJECT_TO_CLIP = glGetAttribLocation(matching, "OBJECT_TO_CLIP");
+		if (OBJECT_TO_CLIP == -1) {
+			throw std::runtime_error("Instanced depth program can't match a program without an 'OBJECT_TO_CLIP' attribute.");
+		}
+	}
+
+	GLuint program = gl_compile_program(
+		//vertex shader:
+		"#version 330\n"
+		"invariant gl_Position;\n"
+		+ (instanced
+			? "layout(location = " + std::to_string(OBJECT_TO_CLIP) + ") in mat4 OBJECT_TO_CLIP;\n"
+			: "layout(std140) uniform Object {\n"
+			  "	mat4 OBJECT_TO_CLIP;\n"
+			  "};\n"
+		) +
+		"layout(location = " + std::to_string(Position) + ") in vec4 Position;\n"
+		"void main() {\n"
+		"	gl_Position = OBJECT_TO_CLIP * Position;\n"
+		"}\n"
+	,
+		//fragment shader (only depth is written):
+		"#version 330\n"
+		"void main() {\n"
+		"}\n"
+	);
+
+	if (!instanced) {
+		glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Object"), Scene::ObjectBlockBinding);
+	}
+
+	return program;
+}
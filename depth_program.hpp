@@ -0,0 +1,12 @@
+#pragma once
+
+#include "GL.hpp"
+
+//compiles a position-only program for Scene::draw's depth pre-pass (see Scene::depth_prepass)
+// that can be drawn with the same vertex arrays as 'matching':
+// - reads Position at the same attribute location as 'matching'
+// - reads OBJECT_TO_CLIP from a per-instance attribute at the same location as 'matching' if 'instanced',
+//   and otherwise from the "Object" uniform block (see Scene::ObjectBlock)
+// (both programs should declare 'invariant gl_Position' so that their depths match exactly)
+// throws if 'matching' doesn't have the needed attributes.
+GLuint make_depth_program(GLuint matching, bool instanced);
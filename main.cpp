@@ -16,6 +16,9 @@
 //for screenshots:
 #include "load_save_png.hpp"
 
+//for drawing at a resolution that keeps frame time steady:
+#include "DynamicResolution.hpp"
+
 //Includes for libSDL:
 #include <SDL.h>
 
@@ -118,6 +121,10 @@ int main(int argc, char **argv) {
 	};
 	on_resize();
 
+	//frames are drawn offscreen at a resolution that adjusts to hold GPU frame time near a target, then stretched to the window:
+	// (set dynamic_resolution->disabled to draw straight to the window)
+	DynamicResolution *dynamic_resolution = new DynamicResolution();
+
 	//This will loop until the current mode is set to null:
 	while (Mode::current) {
 		//every pass through the game loop creates one frame of output
@@ -170,8 +177,9 @@ int main(int argc, char **argv) {
 		}
 
 		{ //(3) call the current mode's "draw" function to produce output:
-		
-			Mode::current->draw(drawable_size);
+			glm::uvec2 render_size = dynamic_resolution->begin(drawable_size);
+			Mode::current->draw(render_size);
+			dynamic_resolution->end();
 		}
 
 		//Wait until the recently-drawn frame is shown before doing it all again:
@@ -182,6 +190,10 @@ int main(int argc, char **argv) {
 	//------------  teardown ------------
 	Sound::shutdown();
 
+	//(frees GL objects, so needs to happen while the context still exists)
+	delete dynamic_resolution;
+	dynamic_resolution = nullptr;
+
 	SDL_GL_DeleteContext(context);
 	context = 0;
 
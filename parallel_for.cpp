@@ -0,0 +1,140 @@
+#include "parallel_for.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//local (to this file) data used by parallel_for:
+namespace {
+
+	//one call to parallel_for:
+	struct Job {
+		std::function< void(uint32_t, uint32_t) > const *body = nullptr;
+		uint32_t count = 0;
+		uint32_t grain = 0;
+		uint32_t pieces = 0;
+		std::atomic< uint32_t > next_piece{0};
+	};
+
+	//set while a thread is running pieces (so that nested calls can run serially):
+	thread_local bool in_parallel_for = false;
+
+	//take pieces from 'job' until none are left:
+	void run_pieces(Job &job) {
+		in_parallel_for = true;
+		while (true) {
+			uint32_t piece = job.next_piece.fetch_add(1, std::memory_order_relaxed);
+			if (piece >= job.pieces) break;
+			uint32_t begin = piece * job.grain;
+			uint32_t end = std::min(job.count, begin + job.grain);
+			(*job.body)(begin, end);
+		}
+		in_parallel_for = false;
+	}
+
+	struct Pool {
+		Pool() {
+			//leave one hardware thread for the calling thread:
+			uint32_t hardware = std::thread::hardware_concurrency();
+			uint32_t workers = (hardware > 1 ? std::min(hardware - 1, 15U) : 0);
+			for (uint32_t i = 0; i < workers; ++i) {
+				threads.emplace_back([this](){ work(); });
+			}
+		}
+		~Pool() {
+			{
+				std::unique_lock< std::mutex > lock(mutex);
+				quit = true;
+			}
+			wake.notify_all();
+			for (auto &thread : threads) {
+				thread.join();
+			}
+		}
+
+		//worker threads wait for a new job, help with it, and go back to waiting:
+		void work() {
+			uint32_t seen = 0;
+			std::unique_lock< std::mutex > lock(mutex);
+			while (true) {
+				wake.wait(lock, [&](){ return quit || serial != seen; });
+				if (quit) break;
+				seen = serial;
+				if (!job) continue; //job already finished
+				Job &current = *job;
+				active += 1;
+				lock.unlock();
+				run_pieces(current);
+				lock.lock();
+				active -= 1;
+				if (active == 0) done.notify_all();
+			}
+		}
+
+		void run(Job &job_) {
+			//only one job at a time (e.g., if several threads call parallel_for):
+			std::unique_lock< std::mutex > call_lock(call_mutex);
+
+			{
+				std::unique_lock< std::mutex > lock(mutex);
+				job = &job_;
+				serial += 1;
+			}
+			wake.notify_all();
+
+			run_pieces(job_);
+
+			//wait for workers to finish their pieces, and make sure no others start on this job:
+			std::unique_lock< std::mutex > lock(mutex);
+			done.wait(lock, [&](){ return active == 0; });
+			job = nullptr;
+		}
+
+		std::vector< std::thread > threads;
+
+		std::mutex call_mutex;
+
+		std::mutex mutex; //protects the members below:
+		std::condition_variable wake; //signalled when a job is posted (or on quit)
+		std::condition_variable done; //signalled when the last worker leaves a job
+		Job *job = nullptr;
+		uint32_t serial = 0; //incremented for every job
+		uint32_t active = 0; //workers currently running pieces
+		bool quit = false;
+	};
+
+	Pool &get_pool() {
+		static Pool pool;
+		return pool;
+	}
+
+}
+
+void parallel_for(uint32_t count, uint32_t grain, std::function< void(uint32_t begin, uint32_t end) > const &body) {
+	assert(grain > 0);
+	if (count == 0) return;
+
+	Job job;
+	job.body = &body;
+	job.count = count;
+	job.grain = grain;
+	job.pieces = (count + grain - 1) / grain;
+
+	if (job.pieces == 1 || in_parallel_for || get_pool().threads.empty()) {
+		//not worth (or not possible) to hand out to workers:
+		bool was_in = in_parallel_for;
+		run_pieces(job);
+		in_parallel_for = was_in;
+		return;
+	}
+
+	get_pool().run(job);
+}
+
+uint32_t parallel_for_threads() {
+	return uint32_t(get_pool().threads.size()) + 1;
+}
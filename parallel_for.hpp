@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+//split [0,count) into pieces of 'grain' elements and call body(begin, end) on each piece,
+// using a shared pool of worker threads (plus the calling thread); returns once every piece is done.
+// (pieces always begin at a multiple of 'grain', so body can use begin / grain to find per-piece storage)
+// (body runs concurrently on different pieces, must not throw, and any parallel_for calls it makes run serially)
+void parallel_for(uint32_t count, uint32_t grain, std::function< void(uint32_t begin, uint32_t end) > const &body);
+
+//number of threads that parallel_for can use, including the calling thread:
+uint32_t parallel_for_threads();
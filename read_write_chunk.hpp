@@ -4,6 +4,9 @@
 #include <vector>
 #include <stdexcept>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
 
 //helper function that reads an array of structures preceded by a simple header:
 //Expected format:
@@ -41,6 +44,78 @@ void read_chunk(std::istream &from, std::string const &magic, std::vector< T > *
 }
 
 
+//a chunk of T's found in memory by view_chunk:
+// (chunks follow each other without padding -- e.g., after a string chunk -- so entries may not be aligned for T;
+//  entries are copied out one at a time as they are used, which compiles to plain unaligned loads)
+template< typename T >
+struct ChunkView {
+	static_assert(std::is_trivially_copyable< T >::value, "chunk entries are plain-old-data.");
+	char const *bytes = nullptr;
+	size_t size = 0;
+
+	T operator[](size_t i) const {
+		assert(i < size);
+		T ret;
+		std::memcpy(&ret, bytes + i * sizeof(T), sizeof(T));
+		return ret;
+	}
+
+	//(for range-for loops)
+	struct Iterator {
+		ChunkView const *view;
+		size_t i;
+		T operator*() const { return (*view)[i]; }
+		Iterator &operator++() { ++i; return *this; }
+		bool operator!=(Iterator const &other) const { return i != other.i; }
+	};
+	Iterator begin() const { return Iterator{this, 0}; }
+	Iterator end() const { return Iterator{this, size}; }
+};
+
+//helper function that checks a chunk (in the same format as read_chunk) stored in memory at *at_,
+// points 'to' at the chunk's data without copying it, and advances *at_ past the chunk:
+template< typename T >
+void view_chunk(char const **at_, char const *end, std::string const &magic, ChunkView< T > *to_) {
+	assert(at_);
+	auto &at = *at_;
+	assert(to_);
+	auto &to = *to_;
+
+	struct ChunkHeader {
+		char magic[4] = {'\0', '\0', '\0', '\0'};
+		uint32_t size = 0;
+	};
+	static_assert(sizeof(ChunkHeader) == 8, "header is packed");
+
+	if (size_t(end - at) < sizeof(ChunkHeader)) {
+		throw std::runtime_error("Failed to read chunk header");
+	}
+	ChunkHeader header;
+	std::memcpy(&header, at, sizeof(header));
+	if (std::string(header.magic,4) != magic) {
+		throw std::runtime_error("Unexpected magic number in chunk");
+	}
+
+	if (header.size % sizeof(T) != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size");
+	}
+	if (size_t(end - at) - sizeof(ChunkHeader) < header.size) {
+		throw std::runtime_error("Failed to read chunk data.");
+	}
+
+	to.bytes = at + sizeof(ChunkHeader);
+	to.size = header.size / sizeof(T);
+
+	at = to.bytes + header.size;
+}
+
+//helper function that returns the magic number of the chunk stored in memory at 'at'
+// (or an empty string if there isn't room for a chunk header); useful when a file may contain one of several chunk versions:
+inline std::string peek_chunk_magic(char const *at, char const *end) {
+	if (size_t(end - at) < 8) return "";
+	return std::string(at, 4);
+}
+
 //helper function to write a chunk of data in the same format as read_chunk:
 template< typename T >
 void write_chunk(std::string const &magic, std::vector< T > const &from, std::ostream *to_) {
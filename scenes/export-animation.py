@@ -0,0 +1,182 @@
+#!/usr/bin/env python
+
+#Note: Script meant to be executed from within blender 2.8, as per:
+#blender --background --python export-animation.py -- [...see below...]
+
+import sys,re
+
+args = []
+for i in range(0,len(sys.argv)):
+	if sys.argv[i] == '--':
+		args = sys.argv[i+1:]
+
+if len(args) != 2:
+	print("\n\nUsage:\nblender --background --python export-animation.py -- <infile.blend>[:collection] <outfile.anim>\nExports the animated transforms of objects in collection (default: master collection) over the scene's frame range, as keyframes indexed by the paths of the objects they move.\n")
+	exit(1)
+
+infile = args[0]
+collection_name = None
+m = re.match(r'^(.*?):(.+)$', infile)
+if m:
+	infile = m.group(1)
+	collection_name = m.group(2)
+outfile = args[1]
+
+print("Will export animation of objects in ",end="")
+if collection_name:
+	print("collection '" + collection_name + "'",end="")
+else:
+	print('master collection',end="")
+print(" of '" + infile + "' to '" + outfile + "'.")
+
+import bpy
+import mathutils
+import struct
+import math
+
+bpy.ops.wm.open_mainfile(filepath=infile)
+
+if collection_name:
+	if not collection_name in bpy.data.collections:
+		print("ERROR: Collection '" + collection_name + "' does not exist in scene.")
+		exit(1)
+	collection = bpy.data.collections[collection_name]
+else:
+	collection = bpy.context.scene.collection
+
+scene = bpy.context.scene
+
+#Animation file format:
+# anm0 len < float uint > [frames per second, frame count]
+# str0 len < char > * [strings chunk]
+# trk0 len < uint uint uint uint float*10 float*10 > * [path begin/end, key begin/count, channel offset, channel step]
+# key0 len < ushort > * [key frame (from the start of the range)]
+# val0 len < ushort*10 > * [key values: position xyz, rotation xyzw, scale xyz; channel = offset + step * value]
+
+#how far (in each channel) interpolated keys may stray from the sampled frames:
+POSITION_TOLERANCE = 0.001
+ROTATION_TOLERANCE = 0.001
+SCALE_TOLERANCE = 0.001
+TOLERANCES = [POSITION_TOLERANCE]*3 + [ROTATION_TOLERANCE]*4 + [SCALE_TOLERANCE]*3
+
+#---------------------------------------------------------------------
+#Find animated objects:
+
+animated = []
+def find_animated(from_collection):
+	for obj in from_collection.objects:
+		if obj in animated: continue
+		if obj.animation_data and obj.animation_data.action:
+			animated.append(obj)
+	for child in from_collection.children:
+		find_animated(child)
+
+find_animated(collection)
+
+#objects are found by their path in the scene (see Scene::find):
+def object_path(obj):
+	if obj.parent == None: return obj.name
+	return object_path(obj.parent) + "/" + obj.name
+
+frame_start = scene.frame_start
+frame_end = scene.frame_end
+frame_count = frame_end - frame_start + 1
+frames_per_second = scene.render.fps / scene.render.fps_base
+if frame_count < 1 or frame_count > 0x10000:
+	print("ERROR: Frame range [" + str(frame_start) + "," + str(frame_end) + "] is empty or too long.")
+	exit(1)
+
+#---------------------------------------------------------------------
+#Sample every frame:
+# (local transforms are computed the same way as export-scene.py does, so parenting and constraints come along)
+
+samples = [[] for obj in animated] #per object, per frame: 10 channel values
+
+for frame in range(frame_start, frame_end + 1):
+	scene.frame_set(frame)
+	for i, obj in enumerate(animated):
+		if obj.parent == None:
+			world_to_parent = mathutils.Matrix()
+		else:
+			world_to_parent = obj.parent.matrix_world.copy()
+			world_to_parent.invert()
+		(translation, rotation, scale) = (world_to_parent @ obj.matrix_world).decompose()
+		#keep rotations in the same hemisphere as the previous frame, so interpolating them takes the short way:
+		if len(samples[i]) > 0:
+			prev = samples[i][-1]
+			if prev[3]*rotation.x + prev[4]*rotation.y + prev[5]*rotation.z + prev[6]*rotation.w < 0.0:
+				rotation = -rotation
+		samples[i].append([translation.x, translation.y, translation.z, rotation.x, rotation.y, rotation.z, rotation.w, scale.x, scale.y, scale.z])
+
+#---------------------------------------------------------------------
+#Fit keys:
+# starting from each key, keep going as long as interpolating straight to the next candidate
+# reproduces every frame in between (within tolerance); then put a key at the last frame that did.
+
+def fits(values, a, b):
+	for f in range(a + 1, b):
+		u = (f - a) / (b - a)
+		for c in range(10):
+			v = values[a][c] + u * (values[b][c] - values[a][c])
+			if abs(v - values[f][c]) > TOLERANCES[c]: return False
+	return True
+
+def fit_keys(values):
+	keys = [0]
+	while keys[-1] < len(values) - 1:
+		a = keys[-1]
+		b = a + 1
+		while b + 1 < len(values) and fits(values, a, b + 1):
+			b += 1
+		keys.append(b)
+	#a track that never moves only needs its first key:
+	if len(keys) == 2 and all(abs(values[0][c] - values[-1][c]) <= TOLERANCES[c] for c in range(10)) and fits(values, 0, len(values) - 1):
+		keys = [0]
+	return keys
+
+#---------------------------------------------------------------------
+#Quantize and write:
+
+strings_data = b""
+track_data = b""
+key_data = b""
+value_data = b""
+key_count = 0
+
+for i, obj in enumerate(animated):
+	values = samples[i]
+	keys = fit_keys(values)
+
+	lo = [min(values[k][c] for k in keys) for c in range(10)]
+	hi = [max(values[k][c] for k in keys) for c in range(10)]
+	step = [(hi[c] - lo[c]) / 65535.0 for c in range(10)]
+
+	path = object_path(obj)
+	name_begin = len(strings_data)
+	strings_data += bytes(path, 'utf8')
+	name_end = len(strings_data)
+
+	track_data += struct.pack('IIII', name_begin, name_end, key_count, len(keys))
+	track_data += struct.pack('10f', *lo)
+	track_data += struct.pack('10f', *step)
+	for k in keys:
+		key_data += struct.pack('H', k)
+		value_data += struct.pack('10H', *[0 if step[c] == 0.0 else int(round((values[k][c] - lo[c]) / step[c])) for c in range(10)])
+	key_count += len(keys)
+
+	print("track: " + path + " (" + str(len(keys)) + " of " + str(frame_count) + " frames kept)")
+
+blob = open(outfile, 'wb')
+def write_chunk(magic, data):
+	blob.write(struct.pack('4s',magic)) #type
+	blob.write(struct.pack('I', len(data))) #length
+	blob.write(data)
+
+write_chunk(b'anm0', struct.pack('fI', frames_per_second, frame_count))
+write_chunk(b'str0', strings_data)
+write_chunk(b'trk0', track_data)
+write_chunk(b'key0', key_data)
+write_chunk(b'val0', value_data)
+
+print("Wrote " + str(len(animated)) + " tracks (" + str(key_count) + " keys) in " + str(blob.tell()) + " bytes to '" + outfile + "'")
+blob.close()
@@ -39,6 +39,10 @@ print(" of '" + infile + "' to '" + outfile + "'.")
 
 import struct
 
+#number of simplified versions to write for each mesh, and the smallest one worth writing (in triangles):
+LOD_LEVELS = 3
+LOD_MIN_TRIANGLES = 32
+
 bpy.ops.wm.open_mainfile(filepath=infile)
 
 if collection_name:
@@ -97,7 +101,111 @@ strings = b''
 #index gives offsets into the data (and names) for each mesh:
 index = b''
 
+#Skinning:
+# a mesh is skinned if its object has vertex groups named after other objects; those objects are its bones.
+# (so bones are ordinary transforms in the exported scene, and can be moved by, e.g., export-animation.py's tracks)
+#skin gives bone indices and weights (out of 255) for every vertex (all zero for vertices of unskinned meshes):
+skin = []
+#bones gives mesh name, bone (object) name, and mesh-to-bone matrix for every bone of every skinned mesh:
+bones = []
+#any skinned meshes at all? (if not, the skin chunks aren't written)
+skinned = False
+
+#bone objects for the vertex groups of obj, as a map from group index to (bone index, object):
+def bone_groups(obj):
+	groups = dict()
+	for group in obj.vertex_groups:
+		if group.name in bpy.data.objects and bpy.data.objects[group.name] != obj:
+			groups[group.index] = (len(groups), bpy.data.objects[group.name])
+	return groups
+
+#write_bones records the bones of 'name', a mesh of 'obj' (or a simplified version of one):
+def write_bones(obj, name):
+	global strings
+	for (index, bone) in sorted(bone_groups(obj).values(), key=lambda x: x[0]):
+		#mesh-to-bone ("inverse bind") matrix, as the bone is posed now:
+		mesh_to_bone = bone.matrix_world.inverted() @ obj.matrix_world
+		mesh_begin = len(strings)
+		strings += bytes(name, "utf8")
+		mesh_end = len(strings)
+		bone_begin = len(strings)
+		strings += bytes(bone.name, "utf8")
+		bone_end = len(strings)
+		entry = struct.pack('IIII', mesh_begin, mesh_end, bone_begin, bone_end)
+		for c in range(4):
+			entry += struct.pack('3f', mesh_to_bone[0][c], mesh_to_bone[1][c], mesh_to_bone[2][c])
+		bones.append(entry)
+
+#skin_weights packs the (up to) four most important bones for a vertex:
+def skin_weights(vertex, groups):
+	influences = sorted([(g.weight, groups[g.group][0]) for g in vertex.groups if g.group in groups and g.weight > 0.0], reverse=True)[0:4]
+	total = sum(w for (w, b) in influences)
+	if total <= 0.0:
+		return struct.pack('8B', 0,0,0,0, 0,0,0,0)
+	quantized = [int(round(255 * w / total)) for (w, b) in influences]
+	quantized[0] += 255 - sum(quantized) #(so weights sum to exactly 255)
+	indices = [b for (w, b) in influences]
+	while len(indices) < 4:
+		indices.append(0)
+		quantized.append(0)
+	return struct.pack('4B', *indices) + struct.pack('4B', *quantized)
+
+#write_triangles appends the (already triangulated) mesh's vertices to data (and skin weights for them, using obj's vertex groups) and returns the number written:
+def write_triangles(mesh, name, obj):
+	groups = bone_groups(obj)
+	local_skin = b''
+	colors = None
+	if len(mesh.vertex_colors) == 0:
+		print("WARNING: trying to export color data, but mesh '" + name + "' does not have color data; will output 0xffffffff")
+	else:
+		colors = mesh.vertex_colors.active.data
+		if len(mesh.vertex_colors) != 1:
+			print("WARNING: mesh '" + name + "' has multiple vertex color layers; only exporting '" + mesh.vertex_colors.active.name + "'")
+
+	uvs = None
+	if len(mesh.uv_layers) == 0:
+		print("WARNING: trying to export texcoord data, but mesh '" + name + "' does not uv data; will output (0.0, 0.0)")
+	else:
+		uvs = mesh.uv_layers.active.data
+		if len(mesh.uv_layers) != 1:
+			print("WARNING: mesh '" + name + "' has multiple texture coordinate layers; only exporting '" + mesh.uv_layers.active.name + "'")
+
+	local_data = b''
+
+	#write the mesh triangles:
+	for poly in mesh.polygons:
+		assert(len(poly.loop_indices) == 3)
+		for i in range(0,3):
+			assert(mesh.loops[poly.loop_indices[i]].vertex_index == poly.vertices[i])
+			loop = mesh.loops[poly.loop_indices[i]]
+			vertex = mesh.vertices[loop.vertex_index]
+			for x in vertex.co:
+				local_data += struct.pack('f', x)
+			for x in loop.normal:
+				local_data += struct.pack('f', x)
+			if colors != None:
+				col = colors[poly.loop_indices[i]].color
+				local_data += struct.pack('BBBB', int(col[0] * 255), int(col[1] * 255), int(col[2] * 255), 255)
+			else:
+				local_data += struct.pack('BBBB', 255, 255, 255, 255)
+			if uvs != None:
+				uv = uvs[poly.loop_indices[i]].uv
+				local_data += struct.pack('ff', uv.x, uv.y)
+			else:
+				local_data += struct.pack('ff', 0, 0)
+			local_skin += skin_weights(vertex, groups)
+		if len(local_data) > 1000:
+			data.append(local_data)
+			local_data = b''
+			skin.append(local_skin)
+			local_skin = b''
+
+	data.append(local_data)
+	skin.append(local_skin)
+	return len(mesh.polygons) * 3
+
 vertex_count = 0
+lod_objects = [] #objects whose meshes get simpler versions written after the full-detail meshes
 for obj in bpy.data.objects:
 	if obj.data in to_write:
 		to_write.remove(obj.data)
@@ -133,6 +241,8 @@ for obj in bpy.data.objects:
 	#compute normals (respecting face smoothing):
 	mesh.calc_normals_split()
 
+	lod_objects.append(obj)
+
 	#record mesh name, start position and vertex count in the index:
 	name_begin = len(strings)
 	strings += bytes(name, "utf8")
@@ -143,58 +253,67 @@ for obj in bpy.data.objects:
 	index += struct.pack('I', vertex_count) #vertex_begin
 	#...count will be written below
 
-	colors = None
-	if len(obj.data.vertex_colors) == 0:
-		print("WARNING: trying to export color data, but object '" + name + "' does not have color data; will output 0xffffffff")
-	else:
-		colors = obj.data.vertex_colors.active.data
-		if len(obj.data.vertex_colors) != 1:
-			print("WARNING: object '" + name + "' has multiple vertex color layers; only exporting '" + obj.data.vertex_colors.active.name + "'")
-
-	uvs = None
-	if len(obj.data.uv_layers) == 0:
-		print("WARNING: trying to export texcoord data, but object '" + name + "' does not uv data; will output (0.0, 0.0)")
-	else:
-		uvs = obj.data.uv_layers.active.data
-		if len(obj.data.uv_layers) != 1:
-			print("WARNING: object '" + name + "' has multiple texture coordinate layers; only exporting '" + obj.data.uv_layers.active.name + "'")
-
-	local_data = b''
+	vertex_count += write_triangles(mesh, name, obj)
 
-	#write the mesh triangles:
-	for poly in mesh.polygons:
-		assert(len(poly.loop_indices) == 3)
-		for i in range(0,3):
-			assert(mesh.loops[poly.loop_indices[i]].vertex_index == poly.vertices[i])
-			loop = mesh.loops[poly.loop_indices[i]]
-			vertex = mesh.vertices[loop.vertex_index]
-			for x in vertex.co:
-				local_data += struct.pack('f', x)
-			for x in loop.normal:
-				local_data += struct.pack('f', x)
-			if colors != None:
-				col = colors[poly.loop_indices[i]].color
-				local_data += struct.pack('BBBB', int(col[0] * 255), int(col[1] * 255), int(col[2] * 255), 255)
-			else:
-				local_data += struct.pack('BBBB', 255, 255, 255, 255)
-			if uvs != None:
-				uv = uvs[poly.loop_indices[i]].uv
-				local_data += struct.pack('ff', uv.x, uv.y)
-			else:
-				local_data += struct.pack('ff', 0, 0)
-		if len(local_data) > 1000:
-			data.append(local_data)
-			local_data = b''
-	vertex_count += len(mesh.polygons) * 3
+	index += struct.pack('I', vertex_count) #vertex_end
 
-	data.append(local_data)
+	if len(bone_groups(obj)) > 0:
+		print("  skinned to " + str(len(bone_groups(obj))) + " bones")
+		write_bones(obj, name)
+		skinned = True
 
-	index += struct.pack('I', vertex_count) #vertex_end
+#Levels of detail:
+# each level is written as an extra mesh named '<name>:lod<level>' with about half the triangles of the level before.
+# (Blender's 'collapse' decimation is a quadric-error edge-collapse simplifier, so use it rather than rolling our own.)
+for obj in lod_objects:
+	mesh = obj.data
+	name = mesh.name
+	triangles = len(mesh.polygons)
+	bpy.ops.object.select_all(action='DESELECT')
+	obj.select_set(True)
+	bpy.context.view_layer.objects.active = obj
+	for level in range(1, LOD_LEVELS+1):
+		ratio = 0.5 ** level
+		if triangles * ratio < LOD_MIN_TRIANGLES: break
+
+		#simplify a copy of the full-detail mesh:
+		obj.data = mesh.copy()
+		decimate = obj.modifiers.new(name='LOD', type='DECIMATE')
+		decimate.decimate_type = 'COLLAPSE'
+		decimate.ratio = ratio
+		decimate.use_collapse_triangulate = True
+		bpy.ops.object.modifier_apply(modifier=decimate.name)
+		lod_mesh = obj.data
+		obj.data = mesh
+
+		#(not worth keeping if the simplifier couldn't make much progress, e.g. because of mesh boundaries)
+		if len(lod_mesh.polygons) > 0.75 * triangles * (0.5 ** (level-1)):
+			bpy.data.meshes.remove(lod_mesh)
+			break
+
+		lod_mesh.calc_normals_split()
+		lod_name = name + ":lod" + str(level)
+		print("Writing '" + lod_name + "' (" + str(len(lod_mesh.polygons)) + " of " + str(triangles) + " triangles)...")
+
+		name_begin = len(strings)
+		strings += bytes(lod_name, "utf8")
+		name_end = len(strings)
+		index += struct.pack('I', name_begin)
+		index += struct.pack('I', name_end)
+		index += struct.pack('I', vertex_count) #vertex_begin
+		vertex_count += write_triangles(lod_mesh, lod_name, obj)
+		index += struct.pack('I', vertex_count) #vertex_end
+		write_bones(obj, lod_name)
+
+		bpy.data.meshes.remove(lod_mesh)
 
 data = b''.join(data)
+skin = b''.join(skin)
+bones = b''.join(bones)
 
 #check that code created as much data as anticipated:
 assert(vertex_count * (4*3+4*3+1*4+4*2) == len(data))
+assert(vertex_count * 8 == len(skin))
 
 #write the data chunk and index chunk to an output blob:
 blob = open(outfile, 'wb')
@@ -210,6 +329,14 @@ blob.write(strings)
 blob.write(struct.pack('4s',b'idx0')) #type
 blob.write(struct.pack('I', len(index))) #length
 blob.write(index)
+#(optional) fourth and fifth chunks: skin weights and bones
+if skinned:
+	blob.write(struct.pack('4s',b'skn0')) #type
+	blob.write(struct.pack('I', len(skin))) #length
+	blob.write(skin)
+	blob.write(struct.pack('4s',b'bnd0')) #type
+	blob.write(struct.pack('I', len(bones))) #length
+	blob.write(bones)
 wrote = blob.tell()
 blob.close()
 
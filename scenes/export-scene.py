@@ -54,12 +54,15 @@ else:
 #Scene file format:
 # str0 len < char > * [strings chunk]
 # xfh0 len < ... > * [transform hierarchy]
+#  ..or, if the hierarchy fits, quantized:
+#  xfq1 len < float*3 float*3 > [position bounds min/max]
+#  xfh1 len < ushort ushort*2 ushort ushort*3 ushort*3 ushort*3 > * [parent delta, name begin (low,high) + length, position (fixed point in bounds), rotation (smallest three), scale (half)]
 # msh0 len < uint uint uint > [hierarchy point + mesh name]
 # cam0 len < uint params > [heirarchy point + camera params]
 # lig0 len < uint params > [hierarchy point + light params]
 
 strings_data = b""
-xfh_data = b""
+xfh_entries = [] #(parent index or -1, name begin, name end, translation, rotation, scale)
 mesh_data = b""
 camera_data = b""
 lamp_data = b""
@@ -88,7 +91,6 @@ def parent_names():
 
 #write_xfh will add an object [and its parents] to the hierarchy section and return a packed (idx) reference:
 def write_xfh(obj):
-	global xfh_data
 	par_obj = tuple(instance_parents + [obj])
 	if par_obj in obj_to_xfh: return obj_to_xfh[par_obj]
 
@@ -111,11 +113,8 @@ def write_xfh(obj):
 	transform = (world_to_parent @ obj.matrix_world).decompose()
 	#print(repr(transform))
 
-	xfh_data += parent_ref
-	xfh_data += write_string(obj.name)
-	xfh_data += struct.pack('3f', transform[0].x, transform[0].y, transform[0].z)
-	xfh_data += struct.pack('4f', transform[1].x, transform[1].y, transform[1].z, transform[1].w)
-	xfh_data += struct.pack('3f', transform[2].x, transform[2].y, transform[2].z)
+	name_begin, name_end = struct.unpack('II', write_string(obj.name))
+	xfh_entries.append((struct.unpack('i', parent_ref)[0], name_begin, name_end, transform[0], transform[1], transform[2]))
 
 	return ref
 
@@ -213,6 +212,66 @@ def write_objects(from_collection):
 
 write_objects(collection)
 
+#---------------------------------------------------------------------
+#Pack the hierarchy:
+
+#largest position step (in units) the quantized hierarchy may use before falling back to full precision:
+MAX_POSITION_STEP = 0.01
+
+def pack_hierarchy_v0():
+	data = b""
+	for (parent, name_begin, name_end, translation, rotation, scale) in xfh_entries:
+		data += struct.pack('iII', parent, name_begin, name_end)
+		data += struct.pack('3f', translation.x, translation.y, translation.z)
+		data += struct.pack('4f', rotation.x, rotation.y, rotation.z, rotation.w)
+		data += struct.pack('3f', scale.x, scale.y, scale.z)
+	return data
+
+#smallest-three quaternion packing (see unpack_smallest_three in Scene.cpp):
+def pack_smallest_three(rotation):
+	q = rotation.normalized()
+	c = [q.x, q.y, q.z, q.w]
+	largest = max(range(4), key=lambda i: abs(c[i]))
+	if c[largest] < 0.0: c = [-v for v in c]
+	packed = largest
+	for i in range(4):
+		if i == largest: continue
+		f = (c[i] / math.sqrt(0.5)) * 0.5 + 0.5
+		packed = (packed << 15) | max(0, min(32767, int(round(f * 32767))))
+	return struct.pack('3H', packed & 0xffff, (packed >> 16) & 0xffff, (packed >> 32) & 0xffff)
+
+#returns (bounds chunk, entries chunk), or None if the hierarchy doesn't fit the quantized format:
+def pack_hierarchy_v1():
+	if len(xfh_entries) == 0: return None
+	lo = [min(e[3][a] for e in xfh_entries) for a in range(3)]
+	hi = [max(e[3][a] for e in xfh_entries) for a in range(3)]
+	step = [(hi[a] - lo[a]) / 65535.0 for a in range(3)]
+	if max(step) > MAX_POSITION_STEP:
+		print("Positions span too much to quantize (step " + str(max(step)) + " > " + str(MAX_POSITION_STEP) + ").")
+		return None
+	bounds = struct.pack('3f', *lo) + struct.pack('3f', *hi)
+	data = b""
+	for h, (parent, name_begin, name_end, translation, rotation, scale) in enumerate(xfh_entries):
+		delta = 0 if parent == -1 else h - parent
+		if not (0 <= delta <= 0xffff):
+			print("Parent of transform " + str(h) + " is too far away to quantize.")
+			return None
+		if name_end - name_begin > 0xffff or name_begin > 0xffffffff:
+			print("Name of transform " + str(h) + " is too long to quantize.")
+			return None
+		if max(abs(scale.x), abs(scale.y), abs(scale.z)) > 65504.0:
+			print("Scale of transform " + str(h) + " is too large to quantize.")
+			return None
+		data += struct.pack('H', delta)
+		data += struct.pack('HHH', name_begin & 0xffff, name_begin >> 16, name_end - name_begin)
+		data += struct.pack('3H', *[0 if step[a] == 0.0 else int(round((translation[a] - lo[a]) / step[a])) for a in range(3)])
+		data += pack_smallest_three(rotation)
+		data += struct.pack('3e', scale.x, scale.y, scale.z)
+	print("Quantized " + str(len(xfh_entries)) + " transforms (position step " + str(max(step)) + ").")
+	return (bounds, data)
+
+quantized = pack_hierarchy_v1()
+
 #write the strings chunk and scene chunk to an output blob:
 blob = open(outfile, 'wb')
 def write_chunk(magic, data):
@@ -221,7 +280,11 @@ def write_chunk(magic, data):
 	blob.write(data)
 
 write_chunk(b'str0', strings_data)
-write_chunk(b'xfh0', xfh_data)
+if quantized:
+	write_chunk(b'xfq1', quantized[0])
+	write_chunk(b'xfh1', quantized[1])
+else:
+	write_chunk(b'xfh0', pack_hierarchy_v0())
 write_chunk(b'msh0', mesh_data)
 write_chunk(b'cam0', camera_data)
 write_chunk(b'lmp0', lamp_data)
@@ -0,0 +1,156 @@
+#!/usr/bin/env python
+
+#Note: Script meant to be executed from within blender 2.8, as per:
+#blender --background --python export-tiles.py -- [...see below...]
+
+import sys,re
+
+args = []
+for i in range(0,len(sys.argv)):
+	if sys.argv[i] == '--':
+		args = sys.argv[i+1:]
+
+if len(args) != 2 and len(args) != 3:
+	print("\n\nUsage:\nblender --background --python export-tiles.py -- <infile.blend>[:collection] <outfile.tiles> [tile size]\nSplits the objects in collection (default: master collection) into square tiles on the xy plane (default size: 50 units), exports each tile as a .scene / .pnct pair next to outfile, and writes a tile index to outfile.\n")
+	exit(1)
+
+infile = args[0]
+collection_name = None
+m = re.match(r'^(.*?):(.+)$', infile)
+if m:
+	infile = m.group(1)
+	collection_name = m.group(2)
+outfile = args[1]
+tile_size = 50.0
+if len(args) == 3:
+	tile_size = float(args[2])
+
+assert outfile.endswith(".tiles")
+
+print("Will export tiles of size " + str(tile_size) + " from ",end="")
+if collection_name:
+	print("collection '" + collection_name + "'",end="")
+else:
+	print('master collection',end="")
+print(" of '" + infile + "' to '" + outfile + "'.")
+
+import bpy
+import mathutils
+import struct
+import math
+import os
+import subprocess
+import tempfile
+
+bpy.ops.wm.open_mainfile(filepath=infile)
+
+if collection_name:
+	if not collection_name in bpy.data.collections:
+		print("ERROR: Collection '" + collection_name + "' does not exist in scene.")
+		exit(1)
+	collection = bpy.data.collections[collection_name]
+else:
+	collection = bpy.context.scene.collection
+
+#---------------------------------------------------------------------
+#Assign objects to tiles:
+# each root object (no parent) goes in the tile containing the center of its bounds,
+# and takes all of its descendants along with it.
+
+def world_bounds(obj, bounds):
+	if obj.type == 'MESH':
+		corners = [obj.matrix_world @ mathutils.Vector(c) for c in obj.bound_box]
+	else:
+		corners = [obj.matrix_world.translation]
+	for c in corners:
+		bounds[0] = mathutils.Vector((min(bounds[0].x, c.x), min(bounds[0].y, c.y), min(bounds[0].z, c.z)))
+		bounds[1] = mathutils.Vector((max(bounds[1].x, c.x), max(bounds[1].y, c.y), max(bounds[1].z, c.z)))
+	for child in obj.children:
+		world_bounds(child, bounds)
+
+def descendants(obj):
+	yield obj
+	for child in obj.children:
+		yield from descendants(child)
+
+#tile (x,y) => [objects, bounds min, bounds max]
+tiles = dict()
+for obj in collection.all_objects:
+	if obj.parent != None: continue
+	bounds = [mathutils.Vector((math.inf,)*3), mathutils.Vector((-math.inf,)*3)]
+	world_bounds(obj, bounds)
+	center = 0.5 * (bounds[0] + bounds[1])
+	key = (int(math.floor(center.x / tile_size)), int(math.floor(center.y / tile_size)))
+	if key not in tiles:
+		tiles[key] = [[], bounds[0], bounds[1]]
+	tile = tiles[key]
+	tile[0] += list(descendants(obj))
+	tile[1] = mathutils.Vector((min(tile[1].x, bounds[0].x), min(tile[1].y, bounds[0].y), min(tile[1].z, bounds[0].z)))
+	tile[2] = mathutils.Vector((max(tile[2].x, bounds[1].x), max(tile[2].y, bounds[1].y), max(tile[2].z, bounds[1].z)))
+
+print("Objects fall into " + str(len(tiles)) + " tiles.")
+
+#make a collection per tile (so the usual exporters can be pointed at it):
+tile_collections = dict()
+for key, tile in tiles.items():
+	tile_collection = bpy.data.collections.new("tile " + str(key[0]) + " " + str(key[1]))
+	for obj in tile[0]:
+		if obj.name not in tile_collection.objects:
+			tile_collection.objects.link(obj)
+	tile_collections[key] = tile_collection.name
+
+#save a copy of the file with the tile collections added:
+temp_dir = tempfile.mkdtemp()
+temp_blend = os.path.join(temp_dir, "tiles.blend")
+bpy.ops.wm.save_as_mainfile(filepath=temp_blend, copy=True)
+
+#---------------------------------------------------------------------
+#Export each tile with export-scene.py and export-meshes.py:
+
+script_dir = os.path.dirname(os.path.abspath(__file__))
+out_dir = os.path.dirname(os.path.abspath(outfile))
+out_base = os.path.basename(outfile)[:-len(".tiles")]
+
+def run_exporter(script, target, out):
+	command = [bpy.app.binary_path, '-y', '--background', '--python', os.path.join(script_dir, script), '--', temp_blend + ':' + target, out]
+	if subprocess.call(command) != 0:
+		print("ERROR: '" + script + "' failed for '" + target + "'.")
+		exit(1)
+
+#Tile index file format:
+# str0 len < char > * [tile file names, relative to the index]
+# til0 len < uint uint float*3 float*3 uint > * [name begin/end, world bounds min/max, bytes]
+strings_data = b""
+tile_data = b""
+
+for key in sorted(tiles.keys()):
+	tile = tiles[key]
+	name = out_base + "-" + str(key[0]) + "_" + str(key[1])
+	path = os.path.join(out_dir, name)
+	print("Tile " + name + " (" + str(len(tile[0])) + " objects):")
+	run_exporter('export-scene.py', tile_collections[key], path + '.scene')
+	run_exporter('export-meshes.py', tile_collections[key], path + '.pnct')
+	size = os.path.getsize(path + '.scene') + os.path.getsize(path + '.pnct')
+
+	name_begin = len(strings_data)
+	strings_data += bytes(name, 'utf8')
+	name_end = len(strings_data)
+	tile_data += struct.pack('II', name_begin, name_end)
+	tile_data += struct.pack('3f', tile[1].x, tile[1].y, tile[1].z)
+	tile_data += struct.pack('3f', tile[2].x, tile[2].y, tile[2].z)
+	tile_data += struct.pack('I', size)
+
+os.remove(temp_blend)
+os.rmdir(temp_dir)
+
+blob = open(outfile, 'wb')
+def write_chunk(magic, data):
+	blob.write(struct.pack('4s',magic)) #type
+	blob.write(struct.pack('I', len(data))) #length
+	blob.write(data)
+
+write_chunk(b'str0', strings_data)
+write_chunk(b'til0', tile_data)
+
+print("Wrote " + str(blob.tell()) + " bytes to '" + outfile + "'")
+blob.close()
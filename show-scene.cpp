@@ -4,6 +4,14 @@
 #include "GL.hpp"
 #include "load_save_png.hpp"
 #include "ShowSceneProgram.hpp"
+#include "TileStreamer.hpp"
+#include "StaticBatch.hpp"
+#include "Animation.hpp"
+#include "Skinning.hpp"
+#include "SpatialHash.hpp"
+#include "Affine.hpp"
+#include "data_path.hpp"
+#include "parallel_for.hpp"
 
 #include <SDL.h>
 
@@ -12,6 +20,302 @@
 #include <stdexcept>
 #include <memory>
 #include <algorithm>
+#include <limits>
+#include <random>
+
+//marks drawables as occluders (drawn into the occlusion buffer as-is) if they are:
+// - under a transform whose name starts with "occluder.", or
+// - big, flat-ish things like walls and floors -- at least two sides of their world-space bounding box are
+//   a tenth of the scene's size -- with few enough triangles to be cheap to rasterize on the CPU.
+// (Scene::draw further limits occluders to those that are big on screen; see Scene::occluder_size)
+// returns the number of occluders
+static uint32_t pick_occluders(Scene &scene) {
+	constexpr uint32_t MaxTriangles = 1024; //(for occluders picked by size)
+	std::string const OccluderPrefix = "occluder.";
+
+	auto is_named_occluder = [&](Scene::Transform const *transform) {
+		for (Scene::Transform const *t = transform; t; t = t->parent) {
+			if (scene.name(*t).substr(0, OccluderPrefix.size()) == OccluderPrefix) return true;
+		}
+		return false;
+	};
+
+	//world-space bounding boxes (of drawables with known bounds and triangle meshes):
+	struct Box {
+		Scene::Drawable *drawable;
+		glm::vec3 min, max;
+	};
+	std::vector< Box > boxes;
+	glm::vec3 scene_min = glm::vec3( std::numeric_limits< float >::infinity());
+	glm::vec3 scene_max = glm::vec3(-std::numeric_limits< float >::infinity());
+	for (Scene::Drawable &drawable : scene.drawables) {
+		if (!drawable.mesh || drawable.mesh->type != GL_TRIANGLES || !drawable.mesh->positions) continue;
+		if (!(drawable.min.x <= drawable.max.x)) continue;
+		glm::mat4x3 to_world = drawable.transform->make_local_to_world();
+		glm::vec3 center = to_world * glm::vec4(0.5f * (drawable.min + drawable.max), 1.0f);
+		glm::vec3 half = 0.5f * (drawable.max - drawable.min);
+		glm::vec3 extent = glm::abs(to_world[0]) * half.x + glm::abs(to_world[1]) * half.y + glm::abs(to_world[2]) * half.z;
+		boxes.emplace_back(Box{&drawable, center - extent, center + extent});
+		scene_min = glm::min(scene_min, center - extent);
+		scene_max = glm::max(scene_max, center + extent);
+	}
+	float big = 0.1f * glm::length(scene_max - scene_min);
+
+	uint32_t occluders = 0;
+	for (Box const &box : boxes) {
+		Scene::Drawable &drawable = *box.drawable;
+		glm::vec3 size = box.max - box.min;
+		uint32_t big_sides = uint32_t(size.x >= big) + uint32_t(size.y >= big) + uint32_t(size.z >= big);
+		if (is_named_occluder(drawable.transform) || (big_sides >= 2 && drawable.mesh->count <= 3 * MaxTriangles)) {
+			drawable.occluder = drawable.mesh;
+			occluders += 1;
+		}
+	}
+	return occluders;
+}
+
+//computes world matrices for a big hierarchy of transforms, with Scene::update_hierarchy and by walking up parent pointers:
+static void benchmark_hierarchy() {
+	constexpr uint32_t Transforms = 100000;
+	constexpr uint32_t Repeats = 20;
+
+	//a forest of shallow trees (each transform's parent, if any, is one of the transforms made shortly before it):
+	Scene scene;
+	std::mt19937 mt(0xbeef);
+	std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+	for (uint32_t i = 0; i < Transforms; ++i) {
+		Scene::Transform &transform = scene.transforms.emplace_back();
+		transform.position = glm::vec3(unit(mt), unit(mt), unit(mt));
+		transform.rotation = glm::normalize(glm::quat(unit(mt) - 0.5f, unit(mt) - 0.5f, unit(mt) - 0.5f, unit(mt) - 0.5f));
+		transform.scale = glm::vec3(0.5f + unit(mt));
+		if (i % 16 != 0) transform.parent = &scene.transforms[i - 1 - uint32_t(unit(mt) * float(i % 16))];
+	}
+
+	//(the first update also builds the flattened hierarchy)
+	auto before = std::chrono::high_resolution_clock::now();
+	scene.update_hierarchy();
+	float first_ms = std::chrono::duration< float, std::milli >(std::chrono::high_resolution_clock::now() - before).count();
+
+	before = std::chrono::high_resolution_clock::now();
+	for (uint32_t r = 0; r < Repeats; ++r) {
+		scene.transforms[r].position.x += 1.0f; //(something moved)
+		scene.update_hierarchy();
+	}
+	float update_ms = std::chrono::duration< float, std::milli >(std::chrono::high_resolution_clock::now() - before).count() / Repeats;
+
+	std::vector< glm::mat4x3 > walked(Transforms);
+	before = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < Transforms; ++i) {
+		walked[i] = scene.transforms[i].make_local_to_world();
+	}
+	float walk_ms = std::chrono::duration< float, std::milli >(std::chrono::high_resolution_clock::now() - before).count();
+
+	float max_error = 0.0f;
+	for (uint32_t i = 0; i < Transforms; ++i) {
+		for (uint32_t c = 0; c < 4; ++c) {
+			glm::vec3 d = glm::abs(walked[i][c] - scene.hierarchy.local_to_world[i][c]);
+			max_error = std::max(max_error, std::max(d.x, std::max(d.y, d.z)));
+		}
+	}
+
+	std::cout << "World matrices for " << Transforms << " transforms (" << parallel_for_threads() << " threads):\n"
+		<< "  update_hierarchy " << update_ms << " ms (" << first_ms << " ms the first time, including flattening)\n"
+		<< "  walking up parent pointers " << walk_ms << " ms (one thread), " << walk_ms / std::max(update_ms, 1e-6f) << "x slower\n"
+		<< "  largest difference " << max_error << std::endl;
+}
+
+//casts many rays at a scene (without a window), using the scene's BVH (and each mesh's triangle BVH) to find what they hit:
+static void benchmark_raycast(std::string const &scene_file, std::string const &meshes_file) {
+	constexpr uint32_t Rays = 1 << 20;
+	constexpr uint32_t SerialRays = 1 << 16;
+
+	//(nothing is drawn, so the meshes stay on the CPU)
+	MeshBuffer buffer(meshes_file, false);
+	Scene scene;
+	scene.load(scene_file, [&buffer](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
+		Mesh const &mesh = buffer.lookup(mesh_name);
+		scene.drawables.emplace_back(transform);
+		Scene::Drawable &drawable = scene.drawables.back();
+		drawable.min = mesh.min;
+		drawable.max = mesh.max;
+		drawable.mesh = &mesh;
+	});
+	scene.update_hierarchy();
+	scene.raycast(Scene::Ray()); //(builds the raycast index)
+	if (scene.raycast_index.bvh.nodes.empty()) {
+		std::cerr << "ERROR: scene '" << scene_file << "' has nothing to cast rays at." << std::endl;
+		return;
+	}
+
+	//rays from all around the scene's bounds, aimed at points inside them:
+	glm::vec3 min = scene.raycast_index.bvh.nodes[0].min;
+	glm::vec3 max = scene.raycast_index.bvh.nodes[0].max;
+	glm::vec3 center = 0.5f * (min + max);
+	float radius = glm::length(max - min);
+	std::vector< Scene::Ray > rays(Rays);
+	std::mt19937 mt(0xfeed);
+	std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+	for (Scene::Ray &ray : rays) {
+		float z = 2.0f * unit(mt) - 1.0f;
+		float angle = 2.0f * 3.1415926f * unit(mt);
+		float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+		ray.origin = center + radius * glm::vec3(r * std::cos(angle), r * std::sin(angle), z);
+		glm::vec3 target = min + glm::vec3(unit(mt), unit(mt), unit(mt)) * (max - min);
+		ray.direction = glm::normalize(target - ray.origin);
+	}
+
+	std::vector< Scene::RayHit > hits(Rays);
+	auto before = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < SerialRays; ++i) {
+		hits[i] = scene.raycast(rays[i]);
+	}
+	float serial_ms = std::chrono::duration< float, std::milli >(std::chrono::high_resolution_clock::now() - before).count();
+
+	before = std::chrono::high_resolution_clock::now();
+	scene.raycast(Rays, rays.data(), hits.data());
+	float batch_ms = std::chrono::duration< float, std::milli >(std::chrono::high_resolution_clock::now() - before).count();
+
+	uint32_t hit = uint32_t(std::count_if(hits.begin(), hits.end(), [](Scene::RayHit const &h){ return h.drawable != -1U; }));
+	uint32_t triangles = 0;
+	for (auto const &drawable : scene.drawables) {
+		if (drawable.mesh && drawable.mesh->type == GL_TRIANGLES) triangles += drawable.mesh->count / 3;
+	}
+
+	std::cout << "Ray casts against '" << scene_file << "' (" << scene.drawables.size() << " drawables, " << triangles << " triangles); " << hit << " of " << Rays << " rays hit:\n"
+		<< "  one thread " << SerialRays / std::max(serial_ms, 1e-6f) * 1000.0f << " rays per second\n"
+		<< "  " << parallel_for_threads() << " threads " << Rays / std::max(batch_ms, 1e-6f) * 1000.0f << " rays per second" << std::endl;
+}
+
+//inverts many matrices one at a time and then in batches, comparing Affine::normal_matrix with Affine::make_normal_matrices:
+static void benchmark_normal_matrices() {
+	constexpr uint32_t Matrices = 1 << 20;
+	constexpr uint32_t Repeats = 10;
+
+	//random rotations with non-uniform scales (the kind of matrix Scene::draw needs a real inverse for):
+	std::vector< glm::mat4x3 > in;
+	in.reserve(Matrices);
+	std::mt19937 mt(0x0a11ce);
+	std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+	for (uint32_t i = 0; i < Matrices; ++i) {
+		glm::quat rotation = glm::normalize(glm::quat(unit(mt) - 0.5f, unit(mt) - 0.5f, unit(mt) - 0.5f, unit(mt) - 0.5f));
+		glm::vec3 scale = 0.5f + 2.0f * glm::vec3(unit(mt), unit(mt), unit(mt));
+		glm::vec3 position = 10.0f * glm::vec3(unit(mt), unit(mt), unit(mt));
+		Affine::make_local_to_parent(1, &position, &rotation, &scale, 0, &in.emplace_back());
+	}
+
+	std::vector< glm::mat3 > one(Matrices), batched(Matrices);
+	auto time = [&](auto const &body) {
+		auto before = std::chrono::high_resolution_clock::now();
+		for (uint32_t r = 0; r < Repeats; ++r) body();
+		return std::chrono::duration< float, std::milli >(std::chrono::high_resolution_clock::now() - before).count() / Repeats;
+	};
+	float one_ms = time([&](){
+		for (uint32_t i = 0; i < Matrices; ++i) {
+			one[i] = Affine::normal_matrix(in[i]);
+		}
+	});
+	float batched_ms = time([&](){
+		Affine::make_normal_matrices(Matrices, in.data(), batched.data());
+	});
+
+	float max_error = 0.0f;
+	for (uint32_t i = 0; i < Matrices; ++i) {
+		for (uint32_t c = 0; c < 3; ++c) {
+			glm::vec3 d = glm::abs(one[i][c] - batched[i][c]);
+			max_error = std::max(max_error, std::max(d.x, std::max(d.y, d.z)));
+		}
+	}
+
+	std::cout << "Normal matrices for " << Matrices << " transforms (one thread):\n"
+		<< "  one at a time " << one_ms << " ms (" << Matrices / std::max(one_ms, 1e-6f) << " per ms)\n"
+		<< "  batched " << batched_ms << " ms (" << Matrices / std::max(batched_ms, 1e-6f) << " per ms), " << one_ms / std::max(batched_ms, 1e-6f) << "x speedup\n"
+		<< "  largest difference " << max_error << std::endl;
+}
+
+//moves many small objects around a box for a while, using a SpatialHash to find which ones touch:
+static void benchmark_spatial_hash() {
+	constexpr uint32_t Objects = 100000;
+	constexpr uint32_t Ticks = 100;
+	constexpr float Tick = 1.0f / 60.0f;
+	glm::vec3 const BoxMin = glm::vec3(-50.0f, -50.0f, 0.0f);
+	glm::vec3 const BoxMax = glm::vec3( 50.0f,  50.0f, 10.0f);
+
+	Scene scene;
+	SpatialHash hash(2.0f);
+	std::vector< glm::vec3 > velocities;
+	velocities.reserve(Objects);
+	std::mt19937 mt(0x15e1f00d);
+	std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+	for (uint32_t i = 0; i < Objects; ++i) {
+		Scene::Transform &transform = scene.transforms.emplace_back();
+		transform.position = BoxMin + glm::vec3(unit(mt), unit(mt), unit(mt)) * (BoxMax - BoxMin);
+		velocities.emplace_back(4.0f * glm::vec3(unit(mt), unit(mt), unit(mt)) - 2.0f);
+		hash.add(scene, &transform, 0.25f + 0.25f * unit(mt));
+	}
+
+	float world_ms = 0.0f, build_ms = 0.0f, query_ms = 0.0f;
+	uint64_t contacts = 0;
+	for (uint32_t t = 0; t < Ticks; ++t) {
+		//move everything (bouncing off the sides of the box):
+		parallel_for(Objects, 4096, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t i = begin; i < end; ++i) {
+				Scene::Transform &transform = scene.transforms[i];
+				transform.position += velocities[i] * Tick;
+				for (uint32_t c = 0; c < 3; ++c) {
+					if ((transform.position[c] < BoxMin[c] && velocities[i][c] < 0.0f) || (transform.position[c] > BoxMax[c] && velocities[i][c] > 0.0f)) {
+						velocities[i][c] = -velocities[i][c];
+					}
+				}
+			}
+		});
+
+		hash.update(scene);
+		world_ms += hash.stats.world_ms;
+		build_ms += hash.stats.build_ms;
+
+		//every object asks what it touches (queries don't modify the hash, so they can run in parallel):
+		auto before = std::chrono::high_resolution_clock::now();
+		std::vector< uint32_t > piece_contacts((Objects + 4095) / 4096, 0);
+		parallel_for(Objects, 4096, [&](uint32_t begin, uint32_t end) {
+			uint32_t found = 0;
+			for (uint32_t i = begin; i < end; ++i) {
+				hash.query_sphere(hash.centers[i], hash.objects[i].radius, [&](uint32_t other) {
+					if (other != i) found += 1;
+				});
+			}
+			piece_contacts[begin / 4096] = found;
+		});
+		query_ms += std::chrono::duration< float, std::milli >(std::chrono::high_resolution_clock::now() - before).count();
+		for (uint32_t c : piece_contacts) contacts += c;
+	}
+
+	//compare some objects against testing everything:
+	constexpr uint32_t Checks = 200;
+	auto before = std::chrono::high_resolution_clock::now();
+	uint32_t mismatches = 0;
+	for (uint32_t i = 0; i < Checks; ++i) {
+		uint32_t expected = 0;
+		for (uint32_t j = 0; j < Objects; ++j) {
+			glm::vec3 to = hash.centers[j] - hash.centers[i];
+			float r = hash.objects[i].radius + hash.objects[j].radius;
+			if (j != i && glm::dot(to, to) <= r * r) expected += 1;
+		}
+		uint32_t found = 0;
+		hash.query_sphere(hash.centers[i], hash.objects[i].radius, [&](uint32_t other) {
+			if (other != i) found += 1;
+		});
+		if (found != expected) mismatches += 1;
+	}
+	float brute_ms = std::chrono::duration< float, std::milli >(std::chrono::high_resolution_clock::now() - before).count() * (float(Objects) / Checks);
+
+	std::cout << "Spatial hash: " << Objects << " moving objects, " << contacts / Ticks << " contacts per tick (" << parallel_for_threads() << " threads):\n"
+		<< "  update " << (world_ms + build_ms) / Ticks << " ms per tick (world positions " << world_ms / Ticks << " ms, sorting into cells " << build_ms / Ticks << " ms)\n"
+		<< "  queries " << query_ms / Ticks << " ms per tick (" << float(Objects) * Ticks / std::max(query_ms, 1e-6f) << " queries per ms)\n"
+		<< "  testing every pair instead would take about " << brute_ms << " ms per tick (on one thread)" << std::endl;
+	if (mismatches != 0) {
+		std::cerr << "ERROR: " << mismatches << " of " << Checks << " queries disagree with testing every object." << std::endl;
+	}
+}
 
 int main(int argc, char **argv) {
 #ifdef _WIN32
@@ -19,6 +323,56 @@ int main(int argc, char **argv) {
 	try {
 #endif
 
+	//'--hierarchy', '--normal-matrices', and '--spatial-hash' run benchmarks (no window or scene needed) and exit:
+	if (argc == 2 && std::string(argv[1]) == "--hierarchy") {
+		benchmark_hierarchy();
+		return 0;
+	}
+	if (argc == 2 && std::string(argv[1]) == "--normal-matrices") {
+		benchmark_normal_matrices();
+		return 0;
+	}
+	if (argc == 2 && std::string(argv[1]) == "--spatial-hash") {
+		benchmark_spatial_hash();
+		return 0;
+	}
+	//'--raycast' casts rays at a scene (by default, the hexapod in dist/) without a window, prints rays per second, and exits:
+	if ((argc == 2 || argc == 4) && std::string(argv[1]) == "--raycast") {
+		try {
+			if (argc == 4) benchmark_raycast(argv[2], argv[3]);
+			else benchmark_raycast(data_path("../dist/hexapod.scene"), data_path("../dist/hexapod.pnct"));
+		} catch (std::exception &e) {
+			std::cerr << "ERROR loading scene to cast rays at: " << e.what() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	//'--occlusion' turns on occlusion culling (see pick_occluders() for which drawables occlude):
+	bool occlusion = false;
+	if (argc >= 2 && std::string(argv[1]) == "--occlusion") {
+		occlusion = true;
+		argv[1] = argv[0];
+		argv += 1;
+		argc -= 1;
+	}
+	//'--overdraw' draws one frame in each draw order (in a hidden window), prints overdraw and state change statistics, and exits:
+	bool measure_overdraw = false;
+	if (argc >= 2 && std::string(argv[1]) == "--overdraw") {
+		measure_overdraw = true;
+		argv[1] = argv[0];
+		argv += 1;
+		argc -= 1;
+	}
+	//'--skinning' draws frames with CPU and then GPU skinning (in a hidden window), prints skinning statistics, and exits:
+	bool measure_skinning = false;
+	if (argc >= 2 && std::string(argv[1]) == "--skinning") {
+		measure_skinning = true;
+		argv[1] = argv[0];
+		argv += 1;
+		argc -= 1;
+	}
+
 	//------------  initialization ------------
 
 	//Initialize SDL library:
@@ -46,6 +400,7 @@ int main(int argc, char **argv) {
 		SDL_WINDOW_OPENGL
 		| SDL_WINDOW_RESIZABLE //uncomment to allow resizing
 		| SDL_WINDOW_ALLOW_HIGHDPI //uncomment for full resolution on high-DPI screens
+		| (measure_overdraw || measure_skinning ? SDL_WINDOW_HIDDEN : 0)
 	);
 
 	//prevent exceedingly tiny windows when resizing:
@@ -83,6 +438,15 @@ int main(int argc, char **argv) {
 	bool usage = false;
 	std::string scene_file;
 	std::string meshes_file;
+	std::string animation_file;
+	//a trailing '.anim' file is played on the scene:
+	if (argc >= 3) {
+		std::string last = argv[argc-1];
+		if (last.size() >= 5 && last.substr(last.size()-5) == ".anim") {
+			animation_file = last;
+			argc -= 1;
+		}
+	}
 	if (argc == 2) {
 		scene_file = argv[1];
 	} else if (argc == 3) {
@@ -91,6 +455,36 @@ int main(int argc, char **argv) {
 	} else {
 		usage = true;
 	}
+	//a '.tiles' index is streamed instead (each tile brings its own meshes):
+	TileStreamer *streamer = nullptr;
+	if (meshes_file == "" && scene_file.size() >= 6 && scene_file.substr(scene_file.size()-6) == ".tiles") {
+		try {
+			streamer = new TileStreamer(scene_file, [](TileStreamer::Tile &tile, Scene::Transform *transform, std::string const &mesh_name){
+				if (tile.vaos.empty()) {
+					tile.vaos.emplace_back(tile.meshes->make_vao_for_program(show_scene_program->program));
+				}
+				Mesh const &mesh = tile.meshes->lookup(mesh_name);
+
+				tile.scene->drawables.emplace_back(transform);
+				Scene::Drawable &drawable = tile.scene->drawables.back();
+
+				drawable.pipeline = show_scene_program_pipeline;
+
+				drawable.pipeline.vao = tile.vaos[0];
+				drawable.pipeline.type = mesh.type;
+				drawable.pipeline.start = mesh.start;
+				drawable.pipeline.count = mesh.count;
+
+				drawable.min = mesh.min;
+				drawable.max = mesh.max;
+				drawable.mesh = &mesh;
+			});
+		} catch (std::exception &e) {
+			std::cerr << "ERROR loading tile index '" << scene_file << "': " << e.what() << std::endl;
+			usage = true;
+			streamer = nullptr;
+		}
+	}
 	MeshBuffer *buffer = nullptr;
 	GLuint buffer_vao = 0;
 	if (meshes_file != "") {
@@ -103,8 +497,23 @@ int main(int argc, char **argv) {
 			buffer = nullptr;
 		}
 	}
+	//drawables of skinned meshes can be drawn from vertices skinned on the CPU or skinned on the GPU:
+	Skinning *skinning = nullptr;
+	struct SkinnedDrawable {
+		Scene::Drawable *drawable;
+		Scene::Drawable::Pipeline cpu, gpu;
+	};
+	std::vector< SkinnedDrawable > skinned_drawables;
+	auto set_skinning = [&](bool cpu) {
+		skinning->cpu = cpu;
+		for (SkinnedDrawable &skinned : skinned_drawables) {
+			skinned.drawable->pipeline = (cpu ? skinned.cpu : skinned.gpu);
+		}
+	};
 	Scene *scene = nullptr;
-	if (scene_file != "") {
+	if (streamer) {
+		scene = new Scene(); //(tiles are drawn by the streamer)
+	} else if (scene_file != "") {
 		try {
 			scene = new Scene();
 			scene->load(scene_file, [&buffer,&buffer_vao](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
@@ -121,27 +530,176 @@ int main(int argc, char **argv) {
 				drawable.pipeline.start = mesh.start;
 				drawable.pipeline.count = mesh.count;
 
+				drawable.min = mesh.min;
+				drawable.max = mesh.max;
+				drawable.mesh = &mesh;
 			});
+			//(occluders are picked per object, before batching; StaticBatch keeps them in batches of their own)
+			if (occlusion) {
+				uint32_t occluders = pick_occluders(*scene);
+				scene->occlusion_culling = true;
+				std::cout << "Occlusion culling with " << occluders << " occluders." << std::endl;
+			}
+
+			//merge drawables under 'static.'-named transforms into a few big draws:
+			// (the batch is never freed, like the mesh buffer)
+			if (buffer) {
+				StaticBatch *static_batch = new StaticBatch();
+				if (static_batch->batch(*scene, *buffer)) {
+					std::cout << "Batched " << static_batch->stats.static_drawables << " static drawables into "
+						<< static_batch->stats.batches << " drawables (" << static_batch->stats.vertices << " vertices)." << std::endl;
+				}
+			}
+
+			//skin drawables of meshes with bones:
+			// (like the mesh buffer, skinning is never freed)
+			if (buffer && !buffer->skin.empty()) {
+				skinning = new Skinning(*buffer);
+				GLuint cpu_vao = skinning->output.make_vao_for_program(show_scene_program->program);
+				GLuint gpu_vao = buffer->make_vao_for_program(show_scene_program_skinned->program);
+				for (auto &drawable : scene->drawables) {
+					if (!drawable.mesh || drawable.mesh->bones.empty()) continue;
+					Mesh const &mesh = *drawable.mesh;
+					uint32_t instance = skinning->add(*scene, drawable.transform, mesh);
+
+					SkinnedDrawable skinned;
+					skinned.drawable = &drawable;
+					skinned.cpu = drawable.pipeline;
+					skinned.cpu.vao = cpu_vao;
+					skinned.cpu.start = skinning->instances[instance].output_start;
+					skinned.gpu = show_scene_program_skinned_pipeline;
+					skinned.gpu.vao = gpu_vao;
+					skinned.gpu.type = mesh.type;
+					skinned.gpu.start = mesh.start;
+					skinned.gpu.count = mesh.count;
+					skinned.gpu.material = skinning->make_material(instance, show_scene_program_skinned_pipeline.material, show_scene_program_skinned->BONE_OFFSET_int);
+					skinned_drawables.emplace_back(skinned);
+
+					//posed vertices can go anywhere, so bounds, levels of detail, and ray casts against the mesh don't apply:
+					drawable.min = glm::vec3( std::numeric_limits< float >::infinity());
+					drawable.max = glm::vec3(-std::numeric_limits< float >::infinity());
+					drawable.mesh = nullptr;
+					drawable.occluder = nullptr;
+				}
+				set_skinning(true);
+				std::cout << "Skinning " << skinning->instances.size() << " drawables (" << skinning->total_vertices << " vertices, " << skinning->total_bones << " bones)." << std::endl;
+			}
 		} catch (std::exception &e) {
 			std::cerr << "ERROR loading scene '" << scene_file << "': " << e.what() << std::endl;
 			usage = true;
 			scene = nullptr;
 		}
 	}
-	if (!scene) {
+	Animation::Player *animation = nullptr;
+	if (scene && !streamer && animation_file != "") {
+		try {
+			//(like the mesh buffer, the animation is never freed)
+			animation = new Animation::Player(*new Animation(animation_file), *scene);
+
+			//benchmark: sample the whole clip at many evenly-spaced times:
+			constexpr uint32_t Samples = 1000;
+			float sample_ms = 0.0f;
+			for (uint32_t s = 0; s < Samples; ++s) {
+				animation->time = animation->animation.duration * (s + 0.5f) / float(Samples);
+				animation->apply();
+				sample_ms += animation->stats.sample_ms;
+			}
+			animation->time = 0.0f;
+			std::cout << "Animation has " << animation->animation.tracks.size() << " tracks (" << animation->stats.transforms << " bound) with "
+				<< animation->animation.times.size() << " keys; sampled " << float(animation->stats.transforms) * Samples / std::max(sample_ms, 1e-6f) << " animated transforms per ms." << std::endl;
+		} catch (std::exception &e) {
+			std::cerr << "ERROR loading animation '" << animation_file << "': " << e.what() << std::endl;
+			usage = true;
+			animation = nullptr;
+		}
+	}
+	if (!scene || (measure_overdraw && streamer) || (streamer && animation_file != "") || (measure_skinning && !skinning)) {
 		usage = true;
 	}
 	if (usage) {
-		std::cerr << "Usage:\n\t" << argv[0] << " <path/to/scene.scene> [path/to/meshes.pnct]" << std::endl;
+		std::cerr << "Usage:\n\t" << argv[0] << " [--occlusion] [--overdraw|--skinning] <path/to/scene.scene> [path/to/meshes.pnct] [path/to/animation.anim]\n\t" << argv[0] << " <path/to/world.tiles>\n\t" << argv[0] << " --hierarchy|--normal-matrices|--spatial-hash\n\t" << argv[0] << " --raycast [path/to/scene.scene path/to/meshes.pnct]" << std::endl;
 		return 1;
 	}
 	std::cout << "Showing scene from '" << scene_file << "' with";
-	if (meshes_file != "") {
+	if (streamer) {
+		std::cout << " " << streamer->tiles.size() << " streamed tiles" << std::endl;
+	} else if (meshes_file != "") {
 		std::cout << " meshes from '" << meshes_file << "'" << std::endl;
 	} else {
 		std::cout << " no meshes -- consider passing a '.pnct' file as the second argument." << std::endl;
 	}
-	Mode::set_current(std::make_shared< ShowSceneMode >(*scene));
+	Mode::set_current(std::make_shared< ShowSceneMode >(*scene, streamer, animation, skinning));
+
+	if (measure_overdraw) {
+		//draw the same frame with each ordering and count the samples that get shaded:
+		// (along with state changes: "state order" is draw()'s state sorting, "front to back" sorts by depth first instead)
+		int w,h;
+		SDL_GL_GetDrawableSize(window, &w, &h);
+		glViewport(0, 0, w, h);
+		struct {
+			char const *name;
+			bool front_to_back;
+			bool depth_prepass;
+		} orders[] = {
+			{"state order", false, false},
+			{"front to back", true, false},
+			{"depth pre-pass", false, true},
+		};
+		scene->count_samples = true;
+		for (auto const &order : orders) {
+			scene->front_to_back = order.front_to_back;
+			scene->depth_prepass = order.depth_prepass;
+			Mode::current->draw(glm::uvec2(w, h));
+			glFinish();
+			Scene::DrawStats const &stats = scene->stats;
+			std::cout << order.name << ": " << stats.shaded_samples << " shaded samples ("
+				<< float(stats.shaded_samples) / float(w * h) << " per pixel), "
+				<< stats.draw_calls << " draw calls + " << stats.depth_draw_calls << " depth-only, "
+				<< stats.program_binds << " program binds, " << stats.vertex_array_binds << " vertex array binds, "
+				<< stats.texture_binds << " texture binds" << std::endl;
+		}
+		Mode::set_current(nullptr);
+	}
+
+	if (measure_skinning) {
+		//draw the same frames with each kind of skinning, timing the skinning (on the CPU) and the drawing (on the GPU):
+		// (the GPU's extra drawing time with GPU skinning is the cost of skinning there)
+		int w,h;
+		SDL_GL_GetDrawableSize(window, &w, &h);
+		glViewport(0, 0, w, h);
+		GLuint query = 0;
+		glGenQueries(1, &query);
+		constexpr uint32_t Frames = 100;
+		float draw_ms[2] = {0.0f, 0.0f};
+		for (uint32_t pass = 0; pass < 2; ++pass) {
+			bool cpu = (pass == 0);
+			set_skinning(cpu);
+			float update_ms = 0.0f;
+			for (uint32_t frame = 0; frame < Frames; ++frame) {
+				Mode::current->update(1.0f / 60.0f);
+				update_ms += skinning->stats.bones_ms + skinning->stats.skin_ms;
+				glBeginQuery(GL_TIME_ELAPSED, query);
+				Mode::current->draw(glm::uvec2(w, h));
+				glEndQuery(GL_TIME_ELAPSED);
+				GLuint64 ns = 0;
+				glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns); //(waits for the GPU)
+				draw_ms[pass] += float(double(ns) * 1e-6);
+			}
+			update_ms /= Frames;
+			draw_ms[pass] /= Frames;
+			std::cout << (cpu ? "CPU" : "GPU") << " skinning: update " << update_ms << " ms, draw " << draw_ms[pass] << " ms (GPU time)";
+			if (cpu) {
+				std::cout << "; " << float(skinning->total_vertices) / std::max(update_ms, 1e-6f) << " skinned vertices per ms on " << parallel_for_threads() << " threads";
+			} else if (draw_ms[1] > draw_ms[0]) {
+				std::cout << "; " << float(skinning->total_vertices) / (draw_ms[1] - draw_ms[0]) << " skinned vertices per ms of extra GPU time";
+			} else {
+				std::cout << "; no measurable extra GPU time";
+			}
+			std::cout << std::endl;
+		}
+		glDeleteQueries(1, &query);
+		Mode::set_current(nullptr);
+	}
 
 	//------------ main loop ------------
 